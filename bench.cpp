@@ -0,0 +1,458 @@
+//
+// bench.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fast_bitstring.h"
+#include "fbs_codec.h"
+
+
+//
+// Benchmarks.
+//
+// Every operation is timed on every data set at sizes from --min-bits to
+// --max-bits, by factors of 16.  Each timing is the best of TRIALS trials,
+// each of which repeats the operation for at least MIN_TRIAL_SECONDS.
+//
+// Throughput is in GB/s of the exploded bitstring, one byte per bit, which is
+// what every operation but explode and load reads or writes in full; ns/bit is
+// the same figure the other way up.  RLE and codec rows also give the
+// compression ratio, encoded bytes over packed bytes.
+//
+// Results go to stdout as a table and to --out as CSV.  Given a --baseline,
+// a CSV from an earlier run, every result more than --threshold percent
+// slower than its baseline is reported and the exit status is 1.
+//
+
+#define TRIALS 3
+#define MIN_TRIAL_SECONDS 0.02
+
+typedef fast_bitstring::byte byte;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Seconds per call of fn, best of TRIALS.
+template <class FN> static double time_op(FN fn) {
+
+	double best = 1e30;
+
+	for (int t = 0; t < TRIALS; ++t) {
+		size_t reps = 0;
+		double elapsed;
+		const double t0 = now();
+		do {
+			fn();
+			++reps;
+			elapsed = now() - t0;
+		} while (elapsed < MIN_TRIAL_SECONDS);
+		if (elapsed / reps < best) best = elapsed / reps;
+	}
+
+	return best;
+}
+
+static inline uint64_t xorshift(uint64_t &s) {
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+
+//
+// Data sets, generated packed.
+//
+
+typedef void (*generator)(byte *packed, size_t n_bytes);
+
+static void gen_zero(byte *packed, size_t n_bytes) {
+	memset(packed, 0, n_bytes);
+}
+
+// About one bit in 1024 set.
+static void gen_sparse(byte *packed, size_t n_bytes) {
+	uint64_t s = 88172645463325252ULL;
+	memset(packed, 0, n_bytes);
+	for (size_t i = xorshift(s) % 2048; i < n_bytes * 8; i += 1 + xorshift(s) % 2048)
+		packed[i / 8] |= 0x80 >> (i % 8);
+}
+
+static void gen_random(byte *packed, size_t n_bytes) {
+	uint64_t s = 88172645463325252ULL;
+	for (size_t i = 0; i < n_bytes; ++i)
+		packed[i] = (byte)(xorshift(s) >> 32);
+}
+
+// Alternate 64K bit regions of random and sparse bits, roughly the make up
+// of test.bin followed by long runs.
+static void gen_soup(byte *packed, size_t n_bytes) {
+	const size_t region = (1 << 16) / 8;
+	gen_random(packed, n_bytes);
+	for (size_t i = region; i < n_bytes; i += 2 * region)
+		gen_sparse(&packed[i], n_bytes - i < region ? n_bytes - i : region);
+}
+
+// The --file data set, tiled.
+static std::vector<byte> file_bytes;
+
+static void gen_file(byte *packed, size_t n_bytes) {
+	for (size_t i = 0; i < n_bytes; i += file_bytes.size())
+		memcpy(&packed[i], &file_bytes[0], n_bytes - i < file_bytes.size() ? n_bytes - i : file_bytes.size());
+}
+
+typedef struct {
+	std::string name;
+	generator gen;
+} data_set;
+
+
+//
+// Results.
+//
+
+typedef struct {
+	std::string op;
+	std::string data;
+	size_t n_bits;
+	double seconds;		// Per operation.
+	double ratio;		// Compression ratio, or < 0 if there is none.
+} result;
+
+static inline double gb_per_s(const result &r) { return r.n_bits / r.seconds / 1e9; }
+static inline double ns_per_bit(const result &r) { return r.seconds * 1e9 / r.n_bits; }
+
+static const char *only_op = NULL;	// --op
+
+static inline bool wanted(const char *op) { return !only_op || !strcmp(op, only_op); }
+
+static void report(std::vector<result> &results, const char *op, const std::string &data, size_t n_bits, double seconds, double ratio = -1) {
+
+	result r = { op, data, n_bits, seconds, ratio };
+	results.push_back(r);
+
+	printf("%-12s %-10s %14lu %10.3f %10.4f", op, data.c_str(), n_bits, gb_per_s(r), ns_per_bit(r));
+	if (ratio >= 0) printf(" %8.4f", ratio);
+	printf("\n");
+	fflush(stdout);
+}
+
+static int write_csv(const char *filename, const std::vector<result> &results) {
+
+	FILE *f = fopen(filename, "w");
+	if (!f) return errno;
+
+	fprintf(f, "op,data,bits,seconds,ns_per_bit,gb_per_s,ratio\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const result &r = results[i];
+		fprintf(f, "%s,%s,%lu,%.9g,%.6g,%.6g,%.6g\n", r.op.c_str(), r.data.c_str(), r.n_bits,
+			r.seconds, ns_per_bit(r), gb_per_s(r), r.ratio);
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static bool read_csv(const char *filename, std::vector<result> &results) {
+
+	FILE *f = fopen(filename, "r");
+	if (!f) return false;
+
+	char line[256], op[64], data[64];
+	result r;
+
+	while (fgets(line, sizeof(line), f)) {
+		double ns, gb;
+		if (sscanf(line, "%63[^,],%63[^,],%lu,%lf,%lf,%lf,%lf", op, data, &r.n_bits, &r.seconds, &ns, &gb, &r.ratio) != 7)
+			continue;	// The header.
+		r.op = op;
+		r.data = data;
+		results.push_back(r);
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+// Report results more than threshold percent slower than the baseline.
+// Returns the number of regressions.
+static size_t compare_baseline(const std::vector<result> &results, const std::vector<result> &baseline, double threshold) {
+
+	size_t compared = 0, regressions = 0;
+
+	printf("\n# Against baseline, %.0f%% threshold\n", threshold);
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const result &r = results[i];
+		for (size_t j = 0; j < baseline.size(); ++j) {
+			const result &b = baseline[j];
+			if (b.op != r.op || b.data != r.data || b.n_bits != r.n_bits) continue;
+			++compared;
+			const double change = 100 * (gb_per_s(r) / gb_per_s(b) - 1);
+			if (change < -threshold) {
+				++regressions;
+				printf("REGRESSION %-12s %-10s %14lu %10.3f -> %10.3f GB/s (%+.1f%%)\n",
+					r.op.c_str(), r.data.c_str(), r.n_bits, gb_per_s(b), gb_per_s(r), change);
+			}
+			break;
+		}
+	}
+
+	printf("# %lu of %lu results compared, %lu regressions\n", compared, results.size(), regressions);
+
+	return regressions;
+}
+
+
+//
+// The operations, on one data set at one size.
+//
+
+// Time and report fn as op, if op is wanted.
+template <class FN> static void run(std::vector<result> &results, const char *op, const data_set &d, size_t n_bits, FN fn, double ratio = -1) {
+	if (wanted(op)) report(results, op, d.name, n_bits, time_op(fn), ratio);
+}
+
+static void bench_size(std::vector<result> &results, const data_set &d, size_t n_bits, const char *tmp_file) {
+
+	const size_t n_bytes = (n_bits + 7) / 8;
+	byte *packed = (byte *)malloc(n_bytes);
+	d.gen(packed, n_bytes);
+
+	fast_bitstring fbs(packed, 0, n_bits);
+	fast_bitstring same(fbs);
+	fast_bitstring scratch(n_bits, fast_bitstring::FROM_BITS, fast_bitstring::NO_FILL);
+	byte *out = (byte *)malloc(n_bytes);
+
+	run(results, "explode", d, n_bits, [&] {
+		fast_bitstring::explode_bits(&scratch[0], packed, 0, n_bits);
+	});
+
+	run(results, "explode_mt", d, n_bits, [&] {
+		fast_bitstring::explode_bits_parallel(&scratch[0], packed, 0, n_bits);
+	});
+
+	run(results, "to_bytes", d, n_bits, [&] {
+		fbs.to_bytes(out);
+	});
+
+	run(results, "to_bytes_mt", d, n_bits, [&] {
+		fbs.to_bytes_parallel(out);
+	});
+
+	run(results, "compare", d, n_bits, [&] {
+		if (fbs.compare(same) != 0) throw "Benchmark compare mismatch.";
+	});
+
+	run(results, "count", d, n_bits, [&] {
+		fbs.count();
+	});
+
+	run(results, "reverse", d, n_bits, [&] {
+		scratch.reverse();
+	});
+
+	run(results, "save", d, n_bits, [&] {
+		fbs.save(tmp_file);
+	});
+
+	if (wanted("load")) {
+		fbs.save(tmp_file);
+		run(results, "load", d, n_bits, [&] {
+			fast_bitstring loaded((char *)tmp_file);
+		});
+	}
+	unlink(tmp_file);
+
+	byte *rle = NULL;
+	const size_t rle_bytes = fbs.run_length_encode(&rle);
+	const double ratio = (double)rle_bytes / n_bytes;
+
+	run(results, "rle_encode", d, n_bits, [&] {
+		byte *encoding;
+		fbs.run_length_encode(&encoding);
+		free(encoding);
+	}, ratio);
+
+	run(results, "rle_decode", d, n_bits, [&] {
+		fast_bitstring::run_length_decode_into(rle, rle_bytes, &scratch[0], n_bits);
+	}, ratio);
+
+	if (wanted("rle_decode") && scratch.compare(fbs) != 0) throw "Benchmark RLE round trip mismatch.";
+
+	byte *coded = NULL;
+	const size_t coded_bytes = fbs_codec::encode(fbs, &coded);
+	const double coded_ratio = (double)coded_bytes / n_bytes;
+
+	run(results, "codec_encode", d, n_bits, [&] {
+		byte *encoding;
+		fbs_codec::encode(fbs, &encoding);
+		free(encoding);
+	}, coded_ratio);
+
+	run(results, "codec_decode", d, n_bits, [&] {
+		fbs_codec::decode_into(coded, coded_bytes, &scratch[0], n_bits);
+	}, coded_ratio);
+
+	if (wanted("codec_decode") && scratch.compare(fbs) != 0) throw "Benchmark codec round trip mismatch.";
+
+	free(coded);
+	free(rle);
+	free(out);
+	free(packed);
+}
+
+
+//
+// RLE encode and decode throughput for 1, 2, 4 ... threads up to one per core.
+//
+static void bench_rle_scaling(size_t n_bits) {
+
+	const size_t n_bytes = (n_bits + 7) / 8;
+	byte *packed = (byte *)malloc(n_bytes);
+	gen_soup(packed, n_bytes);
+	fast_bitstring *fbs = new fast_bitstring(packed, 0, n_bits);
+	free(packed);
+
+	size_t max_threads = std::thread::hardware_concurrency();
+	if (max_threads < 1) max_threads = 1;
+
+	printf("# RLE scaling, %lu bits\n", n_bits);
+	printf("%-8s %12s %12s %12s\n", "threads", "bytes", "enc Gbit/s", "dec Gbit/s");
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		fast_bitstring::byte *rle_bytes = NULL;
+
+		double t0 = now();
+		size_t num_bytes = fbs->run_length_encode_parallel(&rle_bytes, threads);
+		double t1 = now();
+		fast_bitstring *rld = fast_bitstring::run_length_decode_parallel(rle_bytes, num_bytes, threads);
+		double t2 = now();
+
+		assert(rld->compare(*fbs) == 0);
+		printf("%-8lu %12lu %12.3f %12.3f\n", threads, num_bytes, n_bits / (t1 - t0) / 1e9, n_bits / (t2 - t1) / 1e9);
+
+		delete rld;
+		free(rle_bytes);
+
+		if (threads < max_threads && threads * 2 > max_threads) threads = max_threads / 2;
+	}
+
+	delete fbs;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"usage: fbs_bench [options]\n"
+		"  --min-bits N      smallest size (default 64)\n"
+		"  --max-bits N      largest size (default 2^26)\n"
+		"  --data NAME       only this data set: zero, sparse, random, soup or file\n"
+		"  --op NAME         only this operation\n"
+		"  --file PATH       add PATH, tiled, as the file data set (default test.bin if present)\n"
+		"  --out PATH        CSV results (default bench_output.txt)\n"
+		"  --baseline PATH   CSV to compare against\n"
+		"  --threshold PCT   slow down counted as a regression (default 10)\n"
+		"  --scaling         RLE thread scaling at --max-bits instead\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[]) {
+
+	size_t min_bits = 64, max_bits = (size_t)1 << 26;
+	const char *only_data = NULL;
+	const char *file = NULL, *out = "bench_output.txt", *baseline = NULL;
+	double threshold = 10;
+	bool scaling = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--min-bits") && more) min_bits = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--max-bits") && more) max_bits = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--data") && more) only_data = argv[++i];
+		else if (!strcmp(argv[i], "--op") && more) only_op = argv[++i];
+		else if (!strcmp(argv[i], "--file") && more) file = argv[++i];
+		else if (!strcmp(argv[i], "--out") && more) out = argv[++i];
+		else if (!strcmp(argv[i], "--baseline") && more) baseline = argv[++i];
+		else if (!strcmp(argv[i], "--threshold") && more) threshold = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--scaling")) scaling = true;
+		else usage();
+	}
+
+	if (min_bits == 0 || min_bits > max_bits) usage();
+
+	if (scaling) {
+		bench_rle_scaling(max_bits);
+		return 0;
+	}
+
+	std::vector<data_set> sets;
+	const data_set builtin[] = {
+		{ "zero", gen_zero }, { "sparse", gen_sparse }, { "random", gen_random }, { "soup", gen_soup }
+	};
+	sets.assign(builtin, builtin + sizeof(builtin) / sizeof(builtin[0]));
+
+	if (!file && access("test.bin", R_OK) == 0) file = "test.bin";
+	if (file) {
+		FILE *f = fopen(file, "rb");
+		if (!f) { fprintf(stderr, "Cannot read %s\n", file); return 2; }
+		byte buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+			file_bytes.insert(file_bytes.end(), buf, buf + n);
+		fclose(f);
+		if (!file_bytes.empty()) {
+			data_set d = { "file", gen_file };
+			sets.push_back(d);
+		}
+	}
+
+	std::vector<result> results;
+	const char *tmp_file = "bench.tmp";
+
+	printf("# SIMD level %s\n", fast_bitstring::simd_level_name(fast_bitstring::simd_level()));
+	printf("%-12s %-10s %14s %10s %10s %8s\n", "op", "data", "bits", "GB/s", "ns/bit", "ratio");
+
+	for (size_t s = 0; s < sets.size(); ++s) {
+		if (only_data && sets[s].name != only_data) continue;
+		for (size_t n_bits = min_bits; n_bits <= max_bits; n_bits *= 16) {
+			bench_size(results, sets[s], n_bits, tmp_file);
+			if (n_bits > max_bits / 16) break;
+		}
+	}
+
+	if (out && write_csv(out, results)) {
+		fprintf(stderr, "Cannot write %s\n", out);
+		return 2;
+	}
+
+	if (baseline) {
+		std::vector<result> base;
+		if (!read_csv(baseline, base)) {
+			fprintf(stderr, "Cannot read baseline %s\n", baseline);
+			return 2;
+		}
+		if (compare_baseline(results, base, threshold)) return 1;
+	}
+
+	return 0;
+}
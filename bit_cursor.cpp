@@ -0,0 +1,165 @@
+//
+// bit_cursor.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "bit_cursor.h"
+
+
+//
+// bit_reader
+//
+
+bit_reader::bit_reader(const byte *bytes, size_t n_bits, size_t bit_offset)
+	: packed(bytes), buf(0), avail(0), begin(bit_offset), pos(bit_offset), end(bit_offset + n_bits) {
+}
+
+bit_reader::bit_reader(const fast_bitstring_view &bits)
+	: packed(NULL), bits(bits), buf(0), avail(0), begin(0), pos(0), end(bits.length()) {
+}
+
+void bit_reader::skip(size_t n) {
+
+	if (n < avail) {
+		buf <<= n;
+		avail -= n;
+		return;
+	}
+
+	// Drop the buffer and move the source position on.
+	n -= avail;
+	if (n > end - pos) throw "Bit reader skip past end of bits.";
+	pos += n;
+	buf = 0;
+	avail = 0;
+}
+
+size_t bit_reader::read_unary() {
+
+	size_t zeros = 0;
+
+	for (;;) {
+		if (avail == 0) {
+			refill();
+			if (avail == 0) throw "Bit reader read past end of bits.";
+		}
+
+		// The bits below avail are 0, so a 1 found is a buffered one.
+		if (buf) {
+			const unsigned int z = __builtin_clzll(buf);
+			buf <<= z;
+			buf <<= 1;
+			avail -= z + 1;
+			return zeros + z;
+		}
+
+		zeros += avail;
+		avail = 0;
+	}
+}
+
+
+//
+// bit_writer
+//
+
+bit_writer::bit_writer() : dst(NULL), tail(false), buf(0), nbuf(0), flushed(0) {
+	out.reserve(4096);
+}
+
+bit_writer::bit_writer(fast_bitstring &dst) : dst(&dst), tail(false), buf(0), nbuf(0), flushed(0) {
+}
+
+void bit_writer::write_unary(size_t n) {
+
+	for (; n >= 64; n -= 64)
+		write(0, 64);
+
+	write(1, n + 1);
+}
+
+// Big endian, so the first bit lands in the first byte.
+static inline void store_word(fast_bitstring::byte *p, uint64_t w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	memcpy(p, &w, 8);
+}
+
+void bit_writer::flush_word() {
+
+	byte bytes[8];
+
+	store_word(bytes, buf);
+
+	if (dst) {
+		dst->append_packed(bytes, 0, 64);
+	} else {
+		if (tail) {
+			out.pop_back();
+			tail = false;
+		}
+		out.insert(out.end(), bytes, bytes + 8);
+	}
+
+	flushed += 64;
+}
+
+void bit_writer::flush() {
+
+	if (nbuf == 0) return;
+
+	byte bytes[8];
+	store_word(bytes, buf);
+
+	if (dst) {
+		dst->append_packed(bytes, 0, nbuf);
+		flushed += nbuf;
+		buf = 0;
+		nbuf = 0;
+		return;
+	}
+
+	// Whole bytes only; the rest stay buffered for the next write.
+	const unsigned int n = nbuf / 8;
+	if (n == 0) return;
+
+	if (tail) {
+		out.pop_back();
+		tail = false;
+	}
+	out.insert(out.end(), bytes, bytes + n);
+
+	buf = n < 8 ? buf << (8 * n) : 0;
+	nbuf -= 8 * n;
+	flushed += 8 * n;
+}
+
+const bit_writer::byte *bit_writer::bytes() {
+
+	flush();
+
+	// The partial byte may have had bits added since it was last copied.
+	if (tail) {
+		out.pop_back();
+		tail = false;
+	}
+	if (!dst && nbuf) {
+		out.push_back((byte)(buf >> 56));
+		tail = true;
+	}
+
+	return out.data();
+}
+
+size_t bit_writer::n_bytes() {
+	bytes();
+	return out.size();
+}
@@ -0,0 +1,244 @@
+/*
+ * bit_cursor.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _BIT_CURSOR_H
+#define _BIT_CURSOR_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * Sequential bit cursors.
+ *
+ * bit_reader walks packed bytes, or the bits of a fast_bitstring or view,
+ * front to back through a 64 bit buffer refilled a word at a time, so
+ * reading a field is a shift and a mask rather than a byte per bit.  Fields
+ * are read first bit most significant, the order bits are packed in:
+ *
+ *	bit_reader r(frame, n_bits);
+ *	unsigned int type = r.read(4);
+ *	uint64_t length = r.read_exp_golomb();
+ *
+ * bit_writer is the reverse, filling a 64 bit buffer and flushing it a word
+ * at a time into packed bytes it owns or onto the end of a fast_bitstring.
+ *
+ * Unary codes are n 0's then a 1.  Exp-Golomb codes of order k are those of
+ * H.264 and friends: value + 2^k in binary, preceded by one 0 for each bit
+ * of it past the first k + 1.
+ */
+class bit_reader {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	// The most peek() may look ahead.
+	static const unsigned int MAX_PEEK = 57;
+
+	// n_bits packed bits, skipping the first bit_offset bits of bytes.
+	bit_reader(const byte *bytes, size_t n_bits, size_t bit_offset = 0);
+
+	// The bits of a fast_bitstring or view, which must outlive the reader.
+	bit_reader(const fast_bitstring_view &bits);
+
+	// Next n <= 64 bits as an unsigned integer.  Throws past the end.
+	inline uint64_t read(unsigned int n) {
+
+		if (n > MAX_PEEK) {
+			const uint64_t high = read(n - 32);
+			return (high << 32) | read(32);
+		}
+
+		if (n == 0) return 0;
+		if (avail < n) refill();
+		if (avail < n) throw "Bit reader read past end of bits.";
+
+		const uint64_t v = buf >> (64 - n);
+		buf <<= n;
+		avail -= n;
+
+		return v;
+	}
+
+	inline byte read_bit() { return (byte)read(1); }
+
+	// Next n <= MAX_PEEK bits without consuming them, 0 filled past the end.
+	inline uint64_t peek(unsigned int n) {
+		if (n == 0) return 0;
+		if (avail < n) refill();
+		return buf >> (64 - n);
+	}
+
+	// Step over n bits.  Throws past the end.
+	void skip(size_t n);
+
+	// Number of 0's before the next 1, consuming both.
+	size_t read_unary();
+
+	inline uint64_t read_exp_golomb(unsigned int k = 0) {
+		const size_t z = read_unary();
+		if (z + k > 63) throw "Bit reader Exp-Golomb code too long.";
+		return (((uint64_t)1 << (z + k)) | read(z + k)) - ((uint64_t)1 << k);
+	}
+
+	// Signed Exp-Golomb: 0, 1, -1, 2, -2, ... in code order.
+	inline int64_t read_signed_exp_golomb() {
+		const uint64_t v = read_exp_golomb();
+		return v & 1 ? (int64_t)((v + 1) / 2) : -(int64_t)(v / 2);
+	}
+
+	// Bits consumed so far, and left to read.
+	inline size_t position() const { return pos - avail - begin; }
+	inline size_t remaining() const { return end - (pos - avail); }
+	inline bool at_end() const { return remaining() == 0; }
+
+private:
+	// Top up the buffer to at least MAX_PEEK bits, or as many as are left.
+	inline void refill() {
+
+		const size_t want = (size_t)(64 - avail) < end - pos ? 64 - avail : end - pos;
+		if (want == 0) return;
+
+		const uint64_t w = packed ? fetch_packed(pos, want) : bits.get_uint(pos, want);
+		buf |= w << (64 - avail - want);
+		avail += want;
+		pos += want;
+	}
+
+	// n, 1..64, packed bits from bit[p] on, right aligned.
+	inline uint64_t fetch_packed(size_t p, size_t n) const {
+
+		const byte *b = &packed[p / 8];
+		const unsigned int r = p % 8;
+		const size_t n_bytes = (r + n + 7) / 8;
+		uint64_t w = 0;
+
+		if (n_bytes >= 8) {
+			memcpy(&w, b, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			w = __builtin_bswap64(w);
+#endif
+		} else {
+			for (size_t i = 0; i < n_bytes; ++i)
+				w |= (uint64_t)b[i] << (56 - 8 * i);
+		}
+
+		w <<= r;
+		if (r + n > 64) w |= b[8] >> (8 - r);
+
+		return w >> (64 - n);
+	}
+
+	const byte *packed;		// Packed source, or NULL for an exploded one.
+	fast_bitstring_view bits;	// Exploded source.
+
+	uint64_t buf;		// Buffered bits, next first, 0 below them.
+	unsigned int avail;	// Number of bits in buf.
+	size_t begin;		// Source bit of the first bit.
+	size_t pos;		// Source bit the buffer refills from.
+	size_t end;		// Source bit one past the last.
+};
+
+
+class bit_writer {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	// Write packed bytes held by the writer, see bytes().
+	bit_writer();
+
+	// Append to a fast_bitstring, which must outlive the writer.
+	bit_writer(fast_bitstring &dst);
+
+	// Flushes, but as a destructor must not throw, a failure to, e.g., for
+	// want of memory to append to a fast_bitstring, is ignored and the bits
+	// lost.  Call flush() first to hear of it.
+	~bit_writer() {
+		try {
+			flush();
+		} catch (...) {
+		}
+	}
+
+	// The low n <= 64 bits of value, most significant first.
+	inline void write(uint64_t value, unsigned int n) {
+
+		if (n == 0) return;
+		if (n < 64) value &= ((uint64_t)1 << n) - 1;
+
+		const unsigned int room = 64 - nbuf;
+
+		if (n < room) {
+			buf |= value << (room - n);
+			nbuf += n;
+			return;
+		}
+
+		// Fill the word, flush it and start the next with what is left.
+		buf |= value >> (n - room);
+		flush_word();
+		n -= room;
+		buf = n ? value << (64 - n) : 0;
+		nbuf = n;
+	}
+
+	inline void write_bit(byte bit) { write(bit ? 1 : 0, 1); }
+
+	// n 0's then a 1.
+	void write_unary(size_t n);
+
+	inline void write_exp_golomb(uint64_t value, unsigned int k = 0) {
+		if (value > ~(uint64_t)0 - ((uint64_t)1 << k)) throw "Bit writer value too large for Exp-Golomb code.";
+		const uint64_t w = value + ((uint64_t)1 << k);
+		const unsigned int width = 64 - __builtin_clzll(w);
+		write_unary(width - k - 1);
+		write(w, width - 1);
+	}
+
+	// Positive values map to odd codes, the rest to even ones, so INT64_MIN
+	// alone has no code.
+	inline void write_signed_exp_golomb(int64_t value) {
+		if (value == INT64_MIN) throw "Bit writer value too large for Exp-Golomb code.";
+		write_exp_golomb(value > 0 ? 2 * (uint64_t)value - 1 : 2 * -(uint64_t)value);
+	}
+
+	// Move the buffered bits out to the destination: all of them to a
+	// fast_bitstring, the whole bytes of them to packed bytes.
+	void flush();
+
+	// Bits written so far.
+	inline size_t length() const { return flushed + nbuf; }
+
+	// The packed bytes written, the last one 0 filled past length().  Flushes.
+	const byte *bytes();
+	size_t n_bytes();
+
+private:
+	bit_writer(const bit_writer &);
+	bit_writer &operator =(const bit_writer &);
+
+	void flush_word();
+
+	fast_bitstring *dst;		// Exploded destination, or NULL for packed.
+	std::vector<byte> out;		// Packed destination.
+	bool tail;			// out ends with a copy of the partial byte in buf, see bytes().
+
+	uint64_t buf;		// Pending bits, first most significant.
+	unsigned int nbuf;	// Number of bits in buf, < 64.
+	size_t flushed;		// Bits moved out of buf.
+};
+
+#endif
@@ -0,0 +1,95 @@
+//
+// bit_search.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "bit_search.h"
+
+
+bit_searcher::bit_searcher(const fast_bitstring_view &p, fast_bitstring::match_handler handler, void *context, bool overlapping)
+	: m(p.length()), handler(handler), context(context), overlapping(overlapping) {
+
+	pattern = (byte *)malloc(m ? m : 1);
+	if (m) memcpy(pattern, &p[0], m);
+	carry = (byte *)malloc(m ? 2 * (m - 1) + 1 : 1);
+
+	reset();
+}
+
+bit_searcher::~bit_searcher() {
+	free(pattern);
+	free(carry);
+}
+
+void bit_searcher::reset() {
+	n_carry = 0;
+	consumed = 0;
+	next = 0;
+}
+
+int bit_searcher::report(size_t position, void *searcher) {
+
+	bit_searcher *s = (bit_searcher *)searcher;
+
+	// Matches are found in order, so the first one past the limit ends the search.
+	if (position >= s->limit) return 1;
+
+	position += s->base;
+
+	if (!s->overlapping) {
+		if (position < s->next) return 0;
+		s->next = position + s->m;
+	}
+
+	return s->rc = s->handler(position, s->context);
+}
+
+int bit_searcher::search(const byte *bits, size_t n) {
+
+	rc = 0;
+
+	if (m == 0 || n == 0) {
+		consumed += n;
+		return 0;
+	}
+
+	// Matches starting in the carried bits, which end at most m - 1 bits into
+	// this chunk.
+	if (n_carry) {
+		const size_t head = n < m - 1 ? n : m - 1;
+		memcpy(&carry[n_carry], bits, head);
+		base = consumed - n_carry;
+		limit = n_carry;
+		fast_bitstring::search_bits(carry, n_carry + head, pattern, m, report, this);
+	}
+
+	if (!rc) {
+		base = consumed;
+		limit = n;
+		fast_bitstring::search_bits(bits, n, pattern, m, report, this);
+	}
+
+	// Carry the last m - 1 bits, some of which may be from earlier chunks.
+	const size_t keep = n_carry + n < m - 1 ? n_carry + n : m - 1;
+	if (n >= keep) {
+		memcpy(carry, &bits[n - keep], keep);
+	} else {
+		memmove(carry, &carry[n_carry - (keep - n)], keep - n);
+		memcpy(&carry[keep - n], bits, n);
+	}
+	n_carry = keep;
+	consumed += n;
+
+	return rc;
+}
+
+int bit_searcher::consumer(const byte *bits, size_t offset_in_bits, size_t n_bits, void *searcher) {
+	return ((bit_searcher *)searcher)->search(bits, n_bits);
+}
@@ -0,0 +1,74 @@
+/*
+ * bit_search.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _BIT_SEARCH_H
+#define _BIT_SEARCH_H
+
+#include "fast_bitstring.h"
+
+/*
+ * Incremental bit pattern search.
+ *
+ * The stream is fed in arbitrary chunks, one byte per bit, and every match is
+ * handed to the handler with its position in the whole stream, including
+ * matches that straddle chunks.  The last pattern length - 1 bits are carried
+ * from chunk to chunk, so memory use is constant.
+ *
+ * consumer() fits fast_bitstring::stream(), to search a file in one pass:
+ *
+ *	bit_searcher s(syncword, on_match, &ctx);
+ *	fast_bitstring::stream(filename, bit_searcher::consumer, &s);
+ */
+class bit_searcher {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	bit_searcher(const fast_bitstring_view &pattern, fast_bitstring::match_handler handler, void *context, bool overlapping = true);
+	~bit_searcher();
+
+	// Search the next n bits of the stream.  Returns 0, or the handler's
+	// non-zero return if it asked to stop.
+	int search(const byte *bits, size_t n);
+
+	// fast_bitstring::chunk_consumer taking the bit_searcher as its context.
+	static int consumer(const byte *bits, size_t offset_in_bits, size_t n_bits, void *searcher);
+
+	// Start over on a new stream.
+	void reset();
+
+	// Total number of bits searched so far.
+	inline size_t length() const { return consumed; }
+
+private:
+	bit_searcher(const bit_searcher &);
+	bit_searcher &operator =(const bit_searcher &);
+
+	static int report(size_t position, void *searcher);
+
+	byte *pattern;
+	size_t m;		// Pattern length.
+	fast_bitstring::match_handler handler;
+	void *context;
+	bool overlapping;
+
+	byte *carry;		// The last n_carry bits searched, with room for m - 1 more.
+	size_t n_carry;
+	size_t consumed;	// Bits searched so far.
+	size_t next;		// First position a non-overlapping match may start at.
+
+	size_t base;		// Stream position of the bits being searched.
+	size_t limit;		// Matches must start before this, relative to base.
+	int rc;
+};
+
+#endif
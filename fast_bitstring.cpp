@@ -33,65 +33,83 @@
 //	encoded as a byte array is passed back via this pararmeter. The caller takes
 //	ownership of the allocated memory and is responsible for freeing it.
 //
-size_t fast_bitstring::run_length_encode(byte **encoding, size_t n_bits) const {
+size_t fast_bitstring_view::run_length_encode(byte **encoding, size_t n_bits) const {
 
 	if (this->blength == 0) {
 		if (encoding) *encoding = NULL;
-		printf("Empty FBS\n");
 		return 0;
 	}
 
-	const size_t len = n_bits ? n_bits - 1 : this->blength - 1;	// RLE looks one ahead, so stop before last bit.
-	byte *  bits = this->barray;	    				// Bits being run-length encoded.
-	size_t  b = 0;			  				// Index of current RLE byte
-	size_t  run_len;						// Length of the current run.
-	fbs     verbatim_bits(32);	      				// Current run of verbatim bits (32 bytes).
-	size_t  v;			  				// Index into current run of verbatim bits.
-	size_t  h;			      				// Start of next segment being analyzed.
+	if (n_bits == 0 || n_bits > this->blength) n_bits = this->blength;
+
+	const size_t len = n_bits - 1;		// RLE looks one ahead, so stop before last bit.
+	const byte *bits = this->barray;	// Bits being run-length encoded.
+	size_t  b = 0;				// Index of current RLE byte
+	size_t  run_len;			// Length of the current run.
+	size_t  v = 0;				// Number of pending verbatim bits.
+	size_t  vs = 0;				// Index of the first pending verbatim bit.
+	size_t  h;				// Start of next segment being analyzed.
 	size_t	i;
+	size_t	n_runs = 0, run_bits = 0;	// Statistics, see fbs_stats.
+	size_t	n_verbatim = 0, verbatim_bits = 0;
 
-	// Worst case analysis: We could get an RLE of 9 followed by a verbatim string of
-	// 8, followed by a RLE of 9 then another verb str of 8, which leads to the true
-	// worst case, I think.  This could be approximated as VS's of 8 bits, which is
-	// then 3 bytes where 1 would have sufficed, which is then 3 * the # of 8 bit VS's.
-	size_t worst_case_rle_len = 3 * ((this->blength / 8) + 1);
+	// Worst case analysis: the costliest pattern is an RLE of 9 followed by a single
+	// verbatim bit, repeated: 1 run byte + 3 verbatim bytes (sentinal, count, bits)
+	// per 10 bits, i.e., 0.4 bytes per bit.  Every other mix of runs and verbatim
+	// blocks costs less per bit, bar a leading verbatim block of up to 3 bytes.
+	// (The old bound of 3 bytes per 8 bits was 0.375 bytes per bit and overflowed.)
+	size_t worst_case_rle_len = 3 + (2 * this->blength + 4) / 5;
 
 	// If encoding not requested then return # of bytes needed to store encoding.
 	if (!encoding) return worst_case_rle_len;
 
+	const uint64_t t0 = fbs_stats::now_ns();
+	fbs_stats::counters *stats = fbs_stats::local();
+
 	byte *rle_bytes = (byte *)calloc(1, worst_case_rle_len);
 
 	if (FBS_TRACE) printf("Worst case REL len: %lu\n", worst_case_rle_len);
 
-#define APPEND_VERBATIM_BITS							\
-										\
-if (FBS_DEBUG) printf("AV: %3lu v's\n", v);					\
-assert(v <= 256);								\
+	// Verbatim bits are always a contiguous range of the source, bits[vs, vs + v),
+	// since they are only ever the short runs between two long ones, so they are
+	// packed straight from the source into the output with no staging copy.
+#define APPEND_VERBATIM_BITS(N)							\
 										\
-/* Append verbatim bits sentinal. */						\
-rle_bytes[b++] = 128;							   	\
+if (FBS_DEBUG) printf("AV: %3lu v's\n", (size_t)(N));				\
+assert((N) > 0 && (N) <= 256);							\
 										\
-/* Store bytes at [b + 1] to leave room for the actual byte count */	    	\
-/* byte to come after the 128 sentinal and before the verbatim bits. */	 	\
-size_t y = verbatim_bits.to_bytes(&rle_bytes[b + 1], 0, v);		     	\
-assert(y == ((v / 8) + ((v % 8) ? 1 : 0)));				     	\
-										\
-/* map bit count of 1..256 to 0..255, insert after sentinal and before bytes */	\
-rle_bytes[b++] = (byte)(v - 1);							\
-b += y;									 	\
+/* Verbatim bits sentinal, then the bit count 1..256 mapped to 0..255, */	\
+/* then the bits themselves. */							\
+rle_bytes[b++] = 128;								\
+rle_bytes[b++] = (byte)((N) - 1);						\
+b += fast_bitstring::pack_bits(&rle_bytes[b], &bits[vs], (N));			\
 assert(b <= worst_case_rle_len);						\
-v = 0;
+++n_verbatim;									\
+verbatim_bits += (N);								\
+vs += (N);									\
+v -= (N);
+
+	// Add n bits starting at bits[h] to the pending verbatim bits, flushing
+	// full 256 bit blocks once there is something to follow them.
+#define ACCUMULATE_VERBATIM_BITS(h, n)						\
+										\
+if (v == 0) vs = (h);								\
+v += (n);									\
+while (v > 256) {								\
+	if (FBS_TRACE) printf("VFBS full: appending 256 verbatim bits.\n");	\
+	APPEND_VERBATIM_BITS(256)						\
+}
 
-	for (i = v = 0; i < len; ++i) {
+	for (i = 0; i < len; i = h + run_len) {
 
 		// Store starting index when checking for a new run, so if the run is too short
 		// to be encoded as a run we know from where to start copying verbatim bits.
 		h = i;
 
-		// Calculate the current run length: a sequence of contiguous 1's or 0's.
-		for (run_len = 1; i < len && bits[i] == bits[i + 1] && run_len < 127; ++i) {
-			run_len += 1;
-		}
+		// Calculate the current run length: a sequence of contiguous 1's or 0's, at
+		// most 127 long.  A run may end on the last bit, bits[len], and if it does
+		// not the last bit is picked up as verbatim after the loop.
+		run_len = fast_bitstring::scan_run(&bits[h], (len - h) < 126 ? (len - h) + 1 : 127);
 
 		if (FBS_TRACE) printf("Gathered run of length %lu\n", run_len);
 
@@ -99,14 +117,11 @@ v = 0;
 		// bits so as to ammortize out the memory cost of verbatim bits accounting bytes.
 		if (run_len > 8) {
 
-			assert(v <= 256);
-
 			// Store any residual verbatim bits before appending the new run.
 			if (v > 0) {
 				if (FBS_TRACE) printf("Appending previous verbatim bits: %lu verbatim bits\n", v);
-				assert(v <= 256);
 
-				APPEND_VERBATIM_BITS
+				APPEND_VERBATIM_BITS(v)
 			}
 
 			// Append run encoded as a single byte: < 128 = run of 0's, > 128 = run of 1's
@@ -119,130 +134,169 @@ v = 0;
 			b++;
 			assert(b <= worst_case_rle_len);
 
+			++n_runs;
+			run_bits += run_len;
+			fbs_stats::add(stats->run_length[run_len], 1);
+
 		} else {
-			// Append verbatim bits to the verbatim bits fbs.
+			// Append verbatim bits to the pending verbatim bits.
 			assert(run_len > 0);
 
 			if (FBS_TRACE) printf("Accumulating %lu verbatim bits\n", run_len);
 
-			while (run_len-- > 0) {
-				assert(v <= 256);
-				if (v == 256) {
-					// verbatim bits is full so append them to the rle bytes.
-					if (FBS_TRACE) printf("VFBS full: appending %lu verbatim bits.\n", v);
-
-					APPEND_VERBATIM_BITS
-				}
-				verbatim_bits[v++] = bits[h++];
-			}
+			ACCUMULATE_VERBATIM_BITS(h, run_len)
 		}
 	}
-tail:
-	while (i < this->blength ) {
-		assert(v <= 256);
-		if (v == 256) {
-			// verbatim bits is full so append them to the rle bytes.
-			if (FBS_TRACE) printf("VFBS full: appending %lu verbatim bits.\n", v);
-
-			APPEND_VERBATIM_BITS
-		}
-		verbatim_bits[v++] = bits[i++];
+
+	// The last bit, if it did not end a run.
+	if (i < n_bits) {
+		ACCUMULATE_VERBATIM_BITS(i, n_bits - i)
+		i = n_bits;
 	}
 
 	if (v > 0) {
-		assert(v <= 256);
 		// Finally, append any residual verbatim bits, which occurs if the tail
 		// of the bit string did not end on a run or 0's or 1's.
 		if (FBS_TRACE) printf("Appending %lu residual verbatim bits.\n", v);
 
-		APPEND_VERBATIM_BITS
+		APPEND_VERBATIM_BITS(v)
 	}
 
+#undef ACCUMULATE_VERBATIM_BITS
+#undef APPEND_VERBATIM_BITS
+
 	if (FBS_DEBUG) printf("EI: %lu\n", i);
 
-	if (encoding)
-		*encoding = rle_bytes;
-	else
-		free(rle_bytes);
+	*encoding = rle_bytes;
 
 	assert(b <= worst_case_rle_len);
+
+	fbs_stats::add(stats->rle_encode_calls, 1);
+	fbs_stats::add(stats->rle_encode_bits, n_bits);
+	fbs_stats::add(stats->rle_encode_bytes, b);
+	fbs_stats::add(stats->rle_runs, n_runs);
+	fbs_stats::add(stats->rle_run_bits, run_bits);
+	fbs_stats::add(stats->rle_verbatim_blocks, n_verbatim);
+	fbs_stats::add(stats->rle_verbatim_bits, verbatim_bits);
+	fbs_stats::add(stats->rle_encode_ns, fbs_stats::now_ns() - t0);
+
 	return b;
 }
 
 //
-// Decode an RLE encoded byte stream into an fast_bitstring.
+// Count the bits an RLE encoded byte stream decodes to, without decoding it.
 //
-// See comments for run_length_encode (above) for details.
+// See comments for run_length_encode (above) for details of the format.
 //
-fast_bitstring *fast_bitstring::run_length_decode(const byte *rle_bytes, const size_t num_bytes) {
+size_t fast_bitstring::run_length_decoded_length(const byte *rle_bytes, const size_t num_bytes) {
 
 	size_t	bits_needed = 0,
 		b,			// tmp variable
-		stride,			// number of bytes to skip to the next RLE guide byte
-		nb,			// number of bits
-		nvb,			// number of virtual bits
-		nby;			// number bytes
+		nvb;			// number of verbatim bits
 
 	// Calculate total # of bits needed for the decoding.
 	for (b = 0; b < num_bytes; ) {
 		if (rle_bytes[b] == 128) {
+			if (b + 1 >= num_bytes) throw "Truncated RLE encoding.";
 			// Count verbatim bits
 			nvb = rle_bytes[b + 1] + 1;
 			bits_needed += nvb;
-			// Compute stride to next RLE guide byte, ie, skip over encoded verbatim bytes.
-			stride = (nvb / 8) + (((nvb < 8) || (nvb % 8)) ? 1 : 0);
-			// Stride + 2 to account for guide and count bytes.
-			b += (stride + 2);
+			// Skip over the guide and count bytes and the encoded verbatim bytes.
+			b += 2 + bit_count_to_byte_count(nvb);
 		} else {
-			// Count 0|1 run bits.
-			nb = rle_bytes[b] & 0x7F;	// Mask off indicator (high) bit; we only care about the count here.
-			bits_needed += nb;
-			// Move to next guide byte
+			// Count 0|1 run bits; mask off indicator (high) bit.
+			bits_needed += rle_bytes[b] & 0x7F;
 			b += 1;
 		}
 	}
+
 	// Ensure all input bytes have been processed.
-	assert(b == num_bytes);
+	if (b != num_bytes) throw "Truncated RLE encoding.";
 
 	if (FBS_DEBUG) printf("Bits needed: %lu\n", bits_needed);
 
-	fbs *decoded_fbs = new fbs(bits_needed, FROM_BITS);
-	byte value;
-	size_t v;	// index to next decoded bit
+	return bits_needed;
+}
+
+//
+// Decode an RLE encoded byte stream into the caller's buffer of max_bits bytes,
+// one byte per bit, in a single pass.  Runs are memset and verbatim bits are
+// exploded straight from the encoding into place.  Returns the number of bits
+// decoded; throws if the decoding would overrun max_bits.
+//
+size_t fast_bitstring::run_length_decode_into(const byte *rle_bytes, const size_t num_bytes, byte *bits, const size_t max_bits) {
+
+	size_t	b,			// index of the current RLE guide byte
+		v,			// index to next decoded bit
+		nvb;			// number of bits in the current run or verbatim block
+
+	const uint64_t t0 = fbs_stats::now_ns();
 
-	// Decode RLE bits into an fbs for continued use.
 	for (b = v = 0; b < num_bytes; ) {
 		if (rle_bytes[b] == 128) {
-			// Decode verbatim bits...
-			nvb = rle_bytes[b + 1] + 1;	// verbatim count is stored less 1 to fit all 256 possible lengths.
-			fbs verbatim_bits(&rle_bytes[b + 2], 0, nvb);
-			size_t n_appended = decoded_fbs->append(v, verbatim_bits);
-			assert(n_appended <= 256);
-			if (FBS_DEBUG) printf("DV: %3lu (%lu)\n", n_appended, verbatim_bits.length());
-			assert(n_appended == nvb);
-			v += n_appended;
+			// Decode verbatim bits; count is stored less 1 to fit all 256 possible lengths.
+			if (b + 1 >= num_bytes) throw "Truncated RLE encoding.";
+			nvb = rle_bytes[b + 1] + 1;
+			const size_t stride = bit_count_to_byte_count(nvb);
+			if (b + 2 + stride > num_bytes) throw "Truncated RLE encoding.";
+			if (v + nvb > max_bits) throw "RLE decoding overruns destination.";
+			if (FBS_DEBUG) printf("DV: %3lu\n", nvb);
+			explode_bits(&bits[v], &rle_bytes[b + 2], 0, nvb);
+			v += nvb;
 			// Stride to next RLE guide byte.
-			stride = (nvb / 8) + (((nvb < 8) || (nvb % 8)) ? 1 : 0);
-			b += (stride + 2);
+			b += stride + 2;
 		} else {
 			// Decode 1/0 run...
-			nvb = rle_bytes[b];
-			if (nvb > 128) {
-				nvb &= 0x7F;
-				value = 1;
-			} else {
-				value = 0;
-			}
-			if (FBS_DEBUG) printf("DR: %3lu %d's\n", nvb, value);
-			// Could refactor this with an append_n_bits() method or a memset() call.
-			for (size_t i = 0; i < nvb; ++i) {
-				(*decoded_fbs)[v++] = value;
-			}
+			nvb = rle_bytes[b] & 0x7F;
+			if (v + nvb > max_bits) throw "RLE decoding overruns destination.";
+			if (FBS_DEBUG) printf("DR: %3lu %d's\n", nvb, rle_bytes[b] >> 7);
+			memset(&bits[v], rle_bytes[b] >> 7, nvb);
+			v += nvb;
 			// Stride to next guide byte
 			b += 1;
 		}
 	}
-	assert(b == num_bytes);
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->rle_decode_calls, 1);
+	fbs_stats::add(stats->rle_decode_bytes, num_bytes);
+	fbs_stats::add(stats->rle_decode_bits, v);
+	fbs_stats::add(stats->rle_decode_ns, fbs_stats::now_ns() - t0);
+
+	return v;
+}
+
+//
+// Decode an RLE encoded byte stream into dst, starting at dst[offset].
+//
+size_t fast_bitstring::run_length_decode_into(const byte *rle_bytes, const size_t num_bytes, fast_bitstring &dst, const size_t offset) {
+
+	if (offset > dst.blength) throw "Invalid RLE decode offset: offset > destination length.";
+
+	return run_length_decode_into(rle_bytes, num_bytes, &dst.barray[offset], dst.blength - offset);
+}
+
+//
+// Decode an RLE encoded byte stream into an fast_bitstring.
+//
+// If the decoded length is known, passing it as n_bits saves the sizing pass
+// over the encoding; the decoding must then be exactly n_bits long.
+//
+// See comments for run_length_encode (above) for details.
+//
+fast_bitstring *fast_bitstring::run_length_decode(const byte *rle_bytes, const size_t num_bytes, size_t n_bits) {
+
+	if (n_bits == 0) n_bits = run_length_decoded_length(rle_bytes, num_bytes);
+
+	fbs *decoded_fbs = new fbs(n_bits, FROM_BITS, NO_FILL);
+
+	try {
+		if (run_length_decode_into(rle_bytes, num_bytes, *decoded_fbs) != n_bits)
+			throw "RLE decoding is shorter than expected.";
+	} catch (...) {
+		delete decoded_fbs;
+		throw;
+	}
 
 	return decoded_fbs;
 }
@@ -251,3 +305,90 @@ size_t fast_bitstring::bit_count_to_byte_count(size_t n) {
 	return (n / 8) + (((n < 8) || (n % 8)) ? 1 : 0);
 }
 
+
+
+//
+// Bulk bit fields.
+//
+// Fields are moved a block at a time through 64 bit words holding the bits
+// least significant first: get_uints() gathers a block with the mask_bits()
+// kernel and shifts the fields out of the words; set_uints() shifts the fields
+// into words, turns those into packed bytes and explodes them into place.
+//
+
+#define FIELD_BLOCK_WORDS 64
+
+static inline uint64_t field_mask(size_t width) {
+	return width == 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+}
+
+void fast_bitstring_view::get_uints(uint64_t *values, size_t offset, size_t width, size_t count, BIT_ORDER order) const {
+
+	if (count == 0) return;
+
+	check_field(offset, width);
+	if (count > (blength - offset) / width)
+		throw "Invalid bit field parameters: fields past end of bitstring.";
+
+	const size_t per_block = FIELD_BLOCK_WORDS * 64 / width;
+	const uint64_t mask = field_mask(width);
+	uint64_t words[FIELD_BLOCK_WORDS + 1];
+
+	for (size_t first = 0; first < count; first += per_block) {
+
+		const size_t n = count - first < per_block ? count - first : per_block;
+		const size_t n_bits = n * width;
+
+		fast_bitstring::mask_bits(words, &barray[offset + first * width], n_bits);
+
+		for (size_t i = 0; i < n; ++i) {
+			const size_t p = i * width, w = p / 64, s = p % 64;
+			uint64_t v = words[w] >> s;
+			if (s + width > 64) v |= words[w + 1] << (64 - s);
+			v &= mask;
+			values[first + i] = order == LSB_FIRST ? v : bit_reverse(v) >> (64 - width);
+		}
+	}
+}
+
+void fast_bitstring::set_uints(size_t offset, size_t width, const uint64_t *values, size_t count, BIT_ORDER order) {
+
+	if (count == 0) return;
+
+	check_field(offset, width);
+	if (count > (blength - offset) / width)
+		throw "Invalid bit field parameters: fields past end of bitstring.";
+
+	const size_t per_block = FIELD_BLOCK_WORDS * 64 / width;
+	const uint64_t mask = field_mask(width);
+	uint64_t words[FIELD_BLOCK_WORDS + 1];
+	byte packed[FIELD_BLOCK_WORDS * 8 + 8];
+
+	for (size_t first = 0; first < count; first += per_block) {
+
+		const size_t n = count - first < per_block ? count - first : per_block;
+		const size_t n_bits = n * width;
+		const size_t n_words = (n_bits + 63) / 64;
+
+		memset(words, 0, (n_words + 1) * sizeof(uint64_t));
+
+		for (size_t i = 0; i < n; ++i) {
+			const size_t p = i * width, w = p / 64, s = p % 64;
+			const uint64_t v = order == LSB_FIRST ? values[first + i] & mask : bit_reverse(values[first + i] << (64 - width));
+			words[w] |= v << s;
+			if (s + width > 64) words[w + 1] |= v >> (64 - s);
+		}
+
+		// Reversing the bits of each byte turns least significant first words
+		// into bytes packed most significant bit first.
+		for (size_t w = 0; w < n_words; ++w) {
+			const uint64_t r = bit_reverse(__builtin_bswap64(words[w]));
+			for (size_t b = 0; b < 8; ++b)
+				packed[w * 8 + b] = r >> (8 * b);
+		}
+
+		explode_bits(&barray[offset + first * width], packed, 0, n_bits);
+	}
+
+	++gen;
+}
@@ -21,11 +21,18 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <vector>
+
+#include "fbs_allocator.h"
+#include "fbs_stats.h"
+#include "fast_bitstring_view.h"
+
 
 /*
  * NOTES:
@@ -39,113 +46,256 @@
  *   And alternative would be a fast compare whose contract is barrys={0|1}
  */
 
-class fast_bitstring {
+namespace fbs_expr { template <class E> struct expr; }
+
+class fast_bitstring : public fast_bitstring_view {
 
 protected:
-	fast_bitstring() : BITS_PER_BYTE(8) {
-		blength = 0;
-		barray = NULL;
-	}
+	fast_bitstring() : BITS_PER_BYTE(8), gen(0), allocator(fbs_allocator::get_default()), bcapacity(0) {}
 
 	typedef fast_bitstring fbs;
 
 public:
-	typedef unsigned char byte;
 	typedef enum { FROM_BYTES, FROM_BITS } BIT_SOURCE;
 
-	// Construct bit array of all zero bits.
+	// NO_FILL leaves a new bit array uninitialized, for when it is about to be
+	// overwritten anyway.
+	typedef enum { ZERO_FILL, NO_FILL } FILL;
+
+	// Packed bytes read per chunk by the file loader: 4MB in, 32MB exploded.
+	static const size_t DEFAULT_LOAD_CHUNK = 1 << 22;
+
+	// Construct bit array of all zero bits, or of unset bits with NO_FILL.  A
+	// NULL allocator means fbs_allocator::get_default().
 	// TODO: XXX does bit_source make sense for this constructor?
-	fast_bitstring(const size_t length, const BIT_SOURCE bit_source=FROM_BYTES) : BITS_PER_BYTE(8) {
+	fast_bitstring(const size_t length, const BIT_SOURCE bit_source=FROM_BYTES, const FILL fill=ZERO_FILL, fbs_allocator *allocator=NULL)
+		: BITS_PER_BYTE(8), gen(0), allocator(allocator ? allocator : fbs_allocator::get_default()), bcapacity(0) {
 		blength = bit_source == FROM_BYTES ? (length * BITS_PER_BYTE) : length;
-		barray = (byte *)calloc(blength, 1);
+		barray = (byte *)(fill == ZERO_FILL ? allocate_bits(blength, true) : allocate_bits(blength));
+		bcapacity = blength;
 	}
 
 	// Construct bit array from given bit string packed in byte_array.
-	fast_bitstring(const byte *byte_array, const size_t length_in_bytes) : BITS_PER_BYTE(8) {
+	fast_bitstring(const byte *byte_array, const size_t length_in_bytes) : BITS_PER_BYTE(8), gen(0), allocator(fbs_allocator::get_default()), bcapacity(0) {
 		explode(byte_array, 0, length_in_bytes * BITS_PER_BYTE);
 	}
 
 	// Construct bit array from given bit string packed in byte_array, skipping the first "offset_in_bits" bits.
-	fast_bitstring(const byte *byte_array, const size_t offset_in_bits, const size_t length_in_bits) : BITS_PER_BYTE(8) {
+	fast_bitstring(const byte *byte_array, const size_t offset_in_bits, const size_t length_in_bits) : BITS_PER_BYTE(8), gen(0), allocator(fbs_allocator::get_default()), bcapacity(0) {
 		explode(byte_array, offset_in_bits, length_in_bits);
 	}
 
-	fast_bitstring(char *filename) : BITS_PER_BYTE(8) {
-		FILE *f = fopen(filename, "rb");
-		fseek(f, 0L, SEEK_END);
-		size_t size = ftell(f);
-		byte *bytes = (byte *) calloc(1, size);
-		rewind(f);
-		if (fread(bytes, 1, size, f) != size) throw "Failed to read bytes for fast bitstring";
-		fclose(f);
-		explode(bytes, 0, size * BITS_PER_BYTE);
-		free(bytes);
+	// Load a file of packed bits, exploding each chunk as soon as it has been
+	// read while the next chunk is read in the background.
+	fast_bitstring(char *filename, size_t chunk_bytes = DEFAULT_LOAD_CHUNK) : BITS_PER_BYTE(8), gen(0), allocator(fbs_allocator::get_default()), bcapacity(0) {
+		load(filename, chunk_bytes);
+	}
+
+	// Evaluate a boolean expression of bitstrings, see fast_bitstring_expr.h.
+	template <class E> fast_bitstring(const fbs_expr::expr<E> &e);
+
+	fast_bitstring(const fast_bitstring &f) : BITS_PER_BYTE(8), gen(0), allocator(f.allocator), bcapacity(0) {
+		copy(f.barray, f.blength);
+	}
+
+	// Copy bit[offset, offset + len) of a bitstring or view.
+	explicit fast_bitstring(const fast_bitstring_view &f, size_t len = ~0, size_t offset = 0, fbs_allocator *allocator=NULL)
+		: BITS_PER_BYTE(8), gen(0), allocator(allocator ? allocator : fbs_allocator::get_default()), bcapacity(0) {
+		if (len == ~0) len = f.length() > offset ? f.length() - offset : 0;
+		if (offset > f.length() || len > f.length() - offset) throw "Invalid copy constructor parameters: offset + length > copy source length.";
+		copy(f.data() + offset, len);
 	}
 
-	fast_bitstring(fast_bitstring &f, size_t len = ~0, size_t offset = 0) : BITS_PER_BYTE(8) {
-		if (len == ~0) len = f.length();
-		if (offset + len > f.length()) throw "Invalid copy constructor parameters: offset + length > copy source length.";
-		blength = len;
-		barray = (byte *)calloc(blength, 1);
+	// Take over f's bits, leaving f empty.
+	fast_bitstring(fast_bitstring &&f) noexcept : fast_bitstring_view(f), BITS_PER_BYTE(8), gen(0), allocator(f.allocator), bcapacity(f.bcapacity) {
+		f.blength = 0;
+		f.barray = NULL;
+		f.bcapacity = 0;
+		++f.gen;
+	}
+
+	fast_bitstring &operator =(const fast_bitstring &f) {
+		return *this = (const fast_bitstring_view &)f;
+	}
+
+	// Copy the bits of a view, which may be a view of this bitstring.
+	fast_bitstring &operator =(const fast_bitstring_view &f) {
+		const size_t n = f.length();
+		if (n <= bcapacity) {
+			if (n) memmove(barray, f.data(), n);
+		} else {
+			byte *bits = allocate_bits(n);
+			memcpy(bits, f.data(), n);
+			if (barray) release_bits(barray, bcapacity);
+			barray = bits;
+			bcapacity = n;
+		}
+		blength = n;
+		++gen;
+		return *this;
+	}
 
-		memcpy((void *)barray, (void *)&f[offset], blength);
+	fast_bitstring &operator =(fast_bitstring &&f) noexcept {
+		if (&f != this) {
+			if (barray) release_bits(barray, bcapacity);
+			allocator = f.allocator;
+			blength = f.blength;
+			barray = f.barray;
+			bcapacity = f.bcapacity;
+			f.blength = 0;
+			f.barray = NULL;
+			f.bcapacity = 0;
+			++f.gen;
+			++gen;
+		}
+		return *this;
 	}
 
 	~fast_bitstring() {
 		if (barray) {
-			free(barray);
+			release_bits(barray, bcapacity);
 			barray = NULL;
 		}
 		blength = 0;
+		bcapacity = 0;
+	}
+
+	// Storage policy of the bit array.
+	inline fbs_allocator *get_allocator() const { return allocator; }
+
+	inline void clear() { memset((void *)barray, 0, blength); ++gen; }
+
+	inline void set_all(byte val = 1) { memset((void *)barray, val, blength); ++gen; }
+
+	// Mutation count, bumped by every method that changes the bits so derived
+	// structures, e.g. a rank_select directory, can tell they are stale.
+	// Writes through operator[] cannot be seen: call touch() after them.
+	inline size_t generation() const { return gen; }
+	inline void touch() { ++gen; }
+
+	/*
+	 * Boolean algebra.  Operators on whole bitstrings, which must be the same
+	 * length, build expressions evaluated in a single fused pass on assignment;
+	 * see fast_bitstring_expr.h.  apply() and invert() work on a range of bits
+	 * in place and bitwise() on raw byte per bit arrays.  Results are 0 or 1.
+	 */
+	typedef enum { BIT_AND, BIT_OR, BIT_XOR, BIT_AND_NOT, BIT_NOT } BIT_OP;
+
+	// dst[i] = a[i] op b[i] for i < n; b is ignored for BIT_NOT.  dst may be a or b.
+	static void bitwise(BIT_OP op, byte *dst, const byte *a, const byte *b, size_t n);
+
+	// this[offset + i] = this[offset + i] op src[src_offset + i] for i < n.
+	void apply(BIT_OP op, const fast_bitstring_view &src, size_t offset = 0, size_t src_offset = 0, size_t n = ~(size_t)0) {
+		if (offset > blength) offset = blength;
+		if (src_offset > src.length()) src_offset = src.length();
+		if (n > blength - offset) n = blength - offset;
+		if (n > src.length() - src_offset) n = src.length() - src_offset;
+		bitwise(op, &barray[offset], &barray[offset], src.data() + src_offset, n);
+		++gen;
 	}
 
-	// Length of bit string in bits.
-	inline size_t length() const { return blength; }
+	void invert(size_t offset = 0, size_t n = ~(size_t)0) {
+		if (offset > blength) offset = blength;
+		if (n > blength - offset) n = blength - offset;
+		bitwise(BIT_NOT, &barray[offset], &barray[offset], NULL, n);
+		++gen;
+	}
 
-	inline void clear() { memset((void *)barray, 0, blength); }
+	fast_bitstring &operator &=(const fast_bitstring_view &that) { check_length(that); apply(BIT_AND, that); return *this; }
+	fast_bitstring &operator |=(const fast_bitstring_view &that) { check_length(that); apply(BIT_OR, that); return *this; }
+	fast_bitstring &operator ^=(const fast_bitstring_view &that) { check_length(that); apply(BIT_XOR, that); return *this; }
+	fast_bitstring &and_not(const fast_bitstring_view &that) { check_length(that); apply(BIT_AND_NOT, that); return *this; }
 
-	inline void set_all(byte val = 1) { memset((void *)barray, val, blength); }
+	template <class E> fast_bitstring &operator =(const fbs_expr::expr<E> &e);
+	template <class E> fast_bitstring &operator &=(const fbs_expr::expr<E> &e);
+	template <class E> fast_bitstring &operator |=(const fbs_expr::expr<E> &e);
+	template <class E> fast_bitstring &operator ^=(const fbs_expr::expr<E> &e);
 
 	// Array opperator to access bit[i].
 	inline byte &operator [](const size_t i) const {
 		return barray[i];
 	}
 
+	// Change the length to new_size bits, growing the capacity geometrically
+	// if need be and never shrinking it.  Bits past the old length are left
+	// unset unless clear is given, which zeroes them all.
 	size_t resize(size_t new_size, bool clear=false) {
 
-		if (new_size == blength) {
-			if (clear) memset(barray, 0, blength);
-			return blength;
-		}
+		++gen;
 
-		barray = (byte *) realloc(barray, new_size);
+		grow(new_size);
 		blength = new_size;
 		if (clear) memset(barray, 0, blength);
 
 		return blength;
 	}
 
-	// TODO: Unit test needed.
-	int compare(const fast_bitstring &that) const {
-
-		if (this->blength < that.blength)
-			return -1;
-		if (this->blength > that.blength)
-			return 1;
-
-		for (size_t i = 0; i < this->blength; ++i) {
-			if (!this->barray[i] && that.barray[i])
-				return -1;
-			if (this->barray[i] && !that.barray[i])
-				return 1;
-		}
+	/*
+	 * Capacity.  The bit array may be allocated beyond length() so a bitstring
+	 * can be built up a piece at a time; whenever it has to grow it at least
+	 * doubles, so appending n bits costs O(n) in all.  Growing moves the bits,
+	 * leaving any views of them dangling.
+	 */
+	inline size_t capacity() const { return bcapacity; }
+
+	// Make room for n bits in all without further reallocation.
+	void reserve(size_t n) {
+		if (n <= bcapacity) return;
+		barray = reallocate_bits(barray, bcapacity, n);
+		bcapacity = n;
+	}
+
+	// Give back the capacity beyond length().
+	void shrink_to_fit() {
+		if (bcapacity == blength) return;
+		barray = reallocate_bits(barray, bcapacity, blength);
+		bcapacity = blength;
+	}
+
+	inline void push_back(byte bit) {
+		if (blength == bcapacity) grow(blength + 1);
+		barray[blength++] = bit ? 1 : 0;
+		++gen;
+	}
+
+	// Append bits[src_offset, src_offset + n), clipped to bits, which may be a
+	// view of this bitstring.  Returns the number of bits appended.
+	size_t append(const fast_bitstring_view &bits, size_t src_offset = 0, size_t n = ~(size_t)0) {
+		const fast_bitstring_view s = bits.slice(src_offset, n);
+		return append(blength, s, s.length());
+	}
+
+	// Append n_bits packed bits, skipping the first bit_offset bits of bytes,
+	// exploding them straight into place.
+	size_t append_packed(const byte *bytes, size_t bit_offset, size_t n_bits) {
+		grow(blength + n_bits);
+		explode_bits(&barray[blength], bytes, bit_offset, n_bits);
+		blength += n_bits;
+		++gen;
+		return n_bits;
+	}
 
-		return 0;
+	// Append a run of n copies of bit value.
+	size_t append_run(byte value, size_t n) {
+		grow(blength + n);
+		memset(&barray[blength], value ? 1 : 0, n);
+		blength += n;
+		++gen;
+		return n;
 	}
 
+	// Called with the position of each match in turn; non-zero stops the search.
+	typedef int (*match_handler)(size_t position, void *context);
+
+	// Hand every match of pattern[0, m) in bits[0, n), in order, to the handler.
+	// Returns the number of matches handed over.
+	static size_t search_bits(const byte *bits, size_t n, const byte *pattern, size_t m, match_handler handler, void *context);
+
 	// TODO: Unit test needed.
 	void reverse() {
 
+		++gen;
+
 		register byte b;
 
 		for (size_t i = 0, j = blength - 1; i < j; ++i, --j) {
@@ -155,170 +305,143 @@ public:
 		}
 	}
 
-	// TODO: Unit test needed.
-	byte to_byte(size_t i) const {
+	// Bit fields, see fast_bitstring_view::get_uint(); on write bytes are set
+	// to 0 or 1.
+	inline void set_uint(size_t offset, size_t width, uint64_t value, BIT_ORDER order = MSB_FIRST) {
 
-		size_t byte = 0;
-		size_t mask = 0x7;
-		size_t j = i + 8;
+		check_field(offset, width);
 
-		if (j >= this->blength) j = this->blength;
+		byte *p = &barray[offset];
+		uint64_t v = order == LSB_FIRST ? value : bit_reverse(value << (64 - width));
+		size_t j = 0;
 
-		for (; i < j; ++i, mask >>= 1) {
-			if (this->barray[i])
-				byte |= mask;
-		}
+		for (; j + 8 <= width; j += 8, v >>= 8)
+			scatter8(&p[j], v, 8);
+		if (j < width)
+			scatter8(&p[j], v, width - j);
 
-		return byte;
+		++gen;
 	}
 
-	// Convert internal byte per bit representation back to bits packed into
-	// the given byte array.
-	size_t to_bytes(byte *bytes, size_t offset=0, size_t num_bits=0) const {
-
-		if (num_bits == 0 || num_bits > blength)
-			num_bits = blength;
+	// Write count consecutive fields of the same width from bit[offset] on from
+	// values[0, count).  See fast_bitstring.cpp.
+	void set_uints(size_t offset, size_t width, const uint64_t *values, size_t count, BIT_ORDER order = MSB_FIRST);
 
-		if (!bytes) {
-			return (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
-		}
+	static size_t bit_count_to_byte_count(size_t n);
 
-		const size_t end = offset + num_bits;
-		register byte b;
-		register byte *bap = barray;
-		register byte *bp = bytes;
-		size_t n = 0;
-
-		for (size_t i = offset; i < end; ++n) {
-			b  = 0;
-			if (i++ < end) b |= (*bap++ & 1) << 7;
-			if (i++ < end) b |= (*bap++ & 1) << 6;
-			if (i++ < end) b |= (*bap++ & 1) << 5;
-			if (i++ < end) b |= (*bap++ & 1) << 4;
-			if (i++ < end) b |= (*bap++ & 1) << 3;
-			if (i++ < end) b |= (*bap++ & 1) << 2;
-			if (i++ < end) b |= (*bap++ & 1) << 1;
-			if (i++ < end) b |= (*bap++ & 1) << 0;
-			*bp++ = b;
-		}
+	/*
+	 * SIMD kernel levels for the bulk kernels below.  The best level the CPU
+	 * supports is selected on first use, safely from any thread;
+	 * set_simd_level() forces a lower one, which is mostly useful for testing
+	 * and benchmarking the fallbacks, and is not thread safe.
+	 */
+	typedef enum { SIMD_SCALAR, SIMD_SSSE3, SIMD_BMI2, SIMD_AVX2, SIMD_AVX512 } SIMD_LEVEL;
 
-		return n;
-	}
+	static SIMD_LEVEL simd_level();
+	static SIMD_LEVEL set_simd_level(SIMD_LEVEL level);
+	static const char *simd_level_name(SIMD_LEVEL level);
 
-	size_t to_ascii(FILE *f = NULL, size_t n = ~0, bool csv=false) const {
+	// Explode n_bits packed bits, skipping the first offset_in_bits bits of src,
+	// into dst one byte (0 or 1) per bit.
+	static void explode_bits(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits);
 
-		if (!f) f = stdout;
+	// Pack n_bits bits, one per byte of src, into dst.  Returns bytes written.
+	static size_t pack_bits(byte *dst, const byte *src, size_t n_bits);
 
-		if (n == ~0 || n > blength) n = blength;
+	/*
+	 * Multi-threaded explode_bits() and pack_bits(), with identical results.
+	 * The output is cut into page aligned pieces, one per thread, so every
+	 * page of it is first written, and on a NUMA machine placed, by the
+	 * thread that fills it: output not yet touched, e.g., fresh from a
+	 * NO_FILL allocation, lands next to its writer.  Outputs of
+	 * fbs_allocator::HUGE_PAGE_MIN_BYTES or more are cut on huge page
+	 * boundaries.  n_threads = 0 for one per core; small jobs run on the
+	 * calling thread.
+	 */
+	static void explode_bits_parallel(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits, size_t n_threads = 0, executor exec = NULL, void *exec_context = NULL);
+	static size_t pack_bits_parallel(byte *dst, const byte *src, size_t n_bits, size_t n_threads = 0, executor exec = NULL, void *exec_context = NULL);
 
-		for (size_t i = 0; i < n; ++i) {
-			if (csv) {
-				fprintf (f, "%u", (unsigned int)barray[i]);
-				if (i < (n - 1)) fputc(',', f);
-			} else
-				fprintf (f, "%u ", (unsigned int)barray[i]);
-		}
-		fprintf(f, "\n");
+	// Explode packed bits into a new fast_bitstring owned by the caller, in
+	// parallel as above.
+	static fast_bitstring *explode_parallel(const byte *byte_array, size_t offset_in_bits, size_t length_in_bits, size_t n_threads = 0, executor exec = NULL, void *exec_context = NULL, fbs_allocator *allocator = NULL);
 
-		fflush(f);
+	// Number of non-zero bytes, i.e., 1 bits, in bits[0, n).
+	static size_t count_bits(const byte *bits, size_t n);
 
-		return n;
-	}
+	// Index of the first of n bits where a and b differ, or n; and the number
+	// that differ.  Any non-zero byte is a 1.
+	static size_t first_difference_bits(const byte *a, const byte *b, size_t n);
+	static size_t hamming_bits(const byte *a, const byte *b, size_t n);
 
-	typedef	struct {
-		size_t length;
-		byte *bytes;
-	} save_header;
+	// Gather n bits into (n + 63) / 64 words, bit k of each word (least
+	// significant first) set iff the bit's byte is non-zero.
+	static void mask_bits(uint64_t *dst, const byte *bits, size_t n);
 
-	static size_t bit_count_to_byte_count(size_t n);
+	// Copy n_bits packed bits, skipping the first offset_in_bits bits of src,
+	// byte aligned into dst.  Returns bytes written.
+	static size_t copy_bits(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits);
 
-	int save(const char *filename, size_t n_bits = 0, save_header *header=NULL) const {
+	// Length of the run of bytes equal to bits[0] at the start of bits[0, n).
+	static size_t scan_run(const byte *bits, size_t n);
 
-		size_t n = 0;
+	/*
+	 * Stream a file of packed bits through a consumer without ever holding the
+	 * whole exploded bitstring.  The consumer is handed each chunk exploded, one
+	 * byte per bit, along with the bit offset of the chunk within the file, and
+	 * may return non-zero to stop early.  The next chunk is read in the
+	 * background while the consumer runs.
+	 *
+	 * Returns 0 on success, the consumer's non-zero return if it stopped early,
+	 * or an errno value if the file could not be read, ENOMEM should its
+	 * chunk buffers not be had.
+	 */
+	typedef int (*chunk_consumer)(const byte *bits, size_t offset_in_bits, size_t n_bits, void *context);
 
-		if (n_bits == 0) n_bits = blength;
+	static int stream(const char *filename, chunk_consumer consumer, void *context, size_t chunk_bytes = DEFAULT_LOAD_CHUNK);
 
-		size_t len = bit_count_to_byte_count(n_bits);
-		byte *bytes = (byte *)malloc(len);
-		to_bytes(bytes);
+	static fast_bitstring *run_length_decode(const byte *rle_bytes, const size_t num_bytes, size_t n_bits = 0);
 
-		unlink(filename);
-		int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0666);
-		if (fd < 1) return errno;
+	// Decode into a caller provided fast_bitstring or byte per bit buffer.
+	static size_t run_length_decode_into(const byte *rle_bytes, const size_t num_bytes, fast_bitstring &dst, const size_t offset = 0);
+	static size_t run_length_decode_into(const byte *rle_bytes, const size_t num_bytes, byte *bits, const size_t max_bits);
 
-		if (header) n += write(fd, header->bytes, header->length);
+	// Number of bits an RLE encoding decodes to.
+	static size_t run_length_decoded_length(const byte *rle_bytes, const size_t num_bytes);
 
-		n += write(fd, bytes, len);
+	// Multi-threaded RLE decode, see run_length_encode_parallel().
+	static fast_bitstring *run_length_decode_parallel(const byte *rle_bytes, const size_t num_bytes, size_t n_threads = 0);
 
-		close(fd);
-		free(bytes);
+	// Write the first n bits of "bits", all of them if n == 0, over this
+	// starting at this[offset], growing as need be.  offset may be at most
+	// length() and bits may be a view of this bitstring.
+	size_t append(size_t offset, const fast_bitstring_view &bits, size_t n = 0) {
 
-		return n;
-	}
+		if (n == 0 || n > bits.length()) n = bits.length();
 
-	size_t run_length_encode(byte **encoding, size_t n_bits = 0) const;
+		if (offset > blength) throw "Invalid append offset: offset > length.";
 
-	static fast_bitstring *run_length_decode(const byte *rle_bytes, const size_t num_bytes);
+		// Growing moves the bits out from under a view of them.
+		const byte *src = bits.data();
+		const size_t src_at = (uintptr_t)src - (uintptr_t)barray;
 
-	// Append n bits from FBS "bits" onto this, starting at this[offset].
-	//
-	// TODO: add an offset into bits.
-	// TODO: needs unit test
-	//
-	size_t append(size_t offset, fast_bitstring &bits, size_t n = 0) {
+		const bool own = src_at < bcapacity;
 
-		// If n == 0 then append all bits from "bits".
-		if (n == 0) n = bits.length();
+		grow(offset + n);
+		if (own) src = barray + src_at;
 
-		// Check that we have capacity
-		if (offset + n > this->blength) {
-			// TODO: nice to have: expand to accommodate extra bits?
-			assert(offset + n <= this->blength);
-			throw "Insufficient room to append bits.";
-		}
+		if (n) memmove(&barray[offset], src, n);
+		if (offset + n > blength) blength = offset + n;
 
-		size_t i = 0, j = offset;
-		for (i = 0, j = offset; i < n; ) {
-			barray[j++] = bits[i++];
-		}
+		++gen;
 
-		return i;
+		return n;
 	}
 
-
-/*
-	For future use (untested)
-
-	class iter {
-		private:
-			iter() {}
-			fast_bitstring *f;
-			size_t i;
-
-		public:
-			iter(fast_bitstring &bs, size_t starting_index) {
-				f = &bs;
-				i = starting_index;
-			}
-
-			iter& operator += (const bool b) {
-				(*f)[i++] = b ? 1 : 0;
-				return *this;
-			}
-
-			byte operator ()() {
-				return (*f)[i++];
-			}
-
-			iter& next(byte &bit) {
-				bit = (*f)[i++];
-				return *this;
-			}
-	};
- */
-
 protected:
 
+	// Replace the contents with the bits of the given file; see the constructor.
+	void load(const char *filename, size_t chunk_bytes);
+
 	/*
 	 * Given a byte array containing a packed string of bits, explode the bits
 	 * into an array of bytes, one bit per byte.  Yes, this is an 8x increase
@@ -326,33 +449,69 @@ protected:
 	 */
 	void explode(const byte byte_array[], const size_t offset_in_bits, const size_t length_in_bits) {
 
-		register byte b, mask, *ba;
-		register size_t len = length_in_bits;
-		size_t i, o;
-
 		blength = length_in_bits;
-		barray = (byte *)calloc(length_in_bits, 1);
-
-		for (i = 0, o = offset_in_bits, ba = barray; len; ) {
-			b = byte_array[i++];
-			for (mask = 0x80; mask && len; mask >>= 1) {
-				// Skip first "offset" bits.
-				// TODO: double check this offset skip logic, it may be defective.
-				if (o > 0) { --o; continue; }
-				if (b & mask) *ba = 0x1;
-				++ba;
-				--len;
-			}
-		}
+		bcapacity = length_in_bits;
+		// No zero fill needed: the kernels write every byte.
+		barray = allocate_bits(length_in_bits);
+
+		explode_bits(barray, byte_array, offset_in_bits, length_in_bits);
+	}
+
+	// Take a copy of bits[0, n).
+	void copy(const byte *bits, const size_t n) {
+		blength = n;
+		bcapacity = n;
+		barray = allocate_bits(n);
+		if (n) memcpy(barray, bits, n);
+	}
+
+	// Make room for at least n bits: double the capacity, or more if need be.
+	void grow(size_t n) {
+		if (n <= bcapacity) return;
+		size_t c = 2 * bcapacity;
+		if (c < n) c = n;
+		if (c < MIN_CAPACITY) c = MIN_CAPACITY;
+		barray = reallocate_bits(barray, bcapacity, c);
+		bcapacity = c;
+	}
+
+	inline void check_length(const fast_bitstring_view &that) const {
+		if (that.length() != blength) throw "Bitstring lengths differ.";
+	}
+
+	// Bit array storage from the allocator, counted in fbs_stats.
+	inline byte *allocate_bits(size_t n, bool zeroed = false) {
+		fbs_stats::counters *stats = fbs_stats::local();
+		fbs_stats::add(stats->allocations, 1);
+		fbs_stats::add(stats->allocated_bytes, n);
+		return (byte *)(zeroed ? allocator->allocate_zeroed(n) : allocator->allocate(n));
+	}
+
+	inline byte *reallocate_bits(byte *bits, size_t old_n, size_t n) {
+		fbs_stats::add(fbs_stats::local()->reallocations, 1);
+		return (byte *)allocator->reallocate(bits, old_n, n);
+	}
+
+	inline void release_bits(byte *bits, size_t n) {
+		if (bits) fbs_stats::add(fbs_stats::local()->releases, 1);
+		allocator->release(bits, n);
 	}
 
 private:
 	const size_t BITS_PER_BYTE;
 
-	size_t blength;	// length of bit array, one byte per bit.
-	byte *barray;   // Array of bits, one byte per bit.
+	size_t gen;	// Mutation count, see generation().
+
+	fbs_allocator *allocator;	// Storage policy for barray.
+
+	size_t bcapacity;	// Bytes allocated for barray, at least blength.
+
+	// Smallest capacity grow() allocates: a cache line.
+	static const size_t MIN_CAPACITY = 64;
 
 };
 
+#include "fast_bitstring_expr.h"
+
 #endif
 
@@ -0,0 +1,288 @@
+/*
+ * fast_bitstring_expr.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FAST_BITSTRING_EXPR_H
+#define _FAST_BITSTRING_EXPR_H
+
+#include <stdint.h>
+
+#include <type_traits>
+#include <utility>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * Boolean algebra over fast_bitstrings and views of them.
+ *
+ * &, |, ^ and ~ on bitstrings build a small expression tree rather than a
+ * result; nothing is computed until the tree is assigned to a bitstring, at
+ * which point the whole expression is evaluated in one pass, a vector at a
+ * time, with no intermediate bitstrings:
+ *
+ *	fast_bitstring r = (a & b) | ~c;	// one pass over a, b and c
+ *	r &= a ^ b;				// likewise, in place
+ *
+ * Any non-zero byte counts as a 1 on input; results are always 0 or 1.  All
+ * operands must be the same length.  Trees hold pointers to the operands'
+ * bits, so evaluate them before the operands go away.
+ *
+ * The vectors are GCC vector extensions, so each node is written once and the
+ * evaluation loop is instantiated per SIMD level with the matching target.
+ */
+namespace fbs_expr {
+
+typedef fast_bitstring::byte byte;
+
+#define FBS_EXPR_INLINE inline __attribute__((always_inline))
+
+// Lanes hold 0x00 or 0xFF masks while an expression is evaluated.
+typedef byte v16 __attribute__((vector_size(16)));
+typedef byte v32 __attribute__((vector_size(32)));
+typedef byte v64 __attribute__((vector_size(64)));
+
+// Vectors are passed by reference throughout: passing those wider than the
+// default target by value has a different ABI under each target.
+template <class V> FBS_EXPR_INLINE void load_mask(const byte *p, V &v) {
+	memcpy(&v, p, sizeof(V));
+	v = (V)(v != 0);
+}
+
+template <class E> struct expr {
+	FBS_EXPR_INLINE const E &self() const { return static_cast<const E &>(*this); }
+};
+
+// Leaf: n bits, one byte per bit.
+struct bits : expr<bits> {
+	const byte *p;
+	size_t n;
+
+	bits(const byte *p, size_t n) : p(p), n(n) {}
+
+	inline size_t length() const { return n; }
+	FBS_EXPR_INLINE bool at(size_t i) const { return p[i] != 0; }
+	template <class V> FBS_EXPR_INLINE void load(size_t i, V &v) const { load_mask(p + i, v); }
+};
+
+struct and_op {
+	static FBS_EXPR_INLINE bool bit(bool a, bool b) { return a && b; }
+	template <class V> static FBS_EXPR_INLINE void vec(V &a, const V &b) { a &= b; }
+};
+
+struct or_op {
+	static FBS_EXPR_INLINE bool bit(bool a, bool b) { return a || b; }
+	template <class V> static FBS_EXPR_INLINE void vec(V &a, const V &b) { a |= b; }
+};
+
+struct xor_op {
+	static FBS_EXPR_INLINE bool bit(bool a, bool b) { return a != b; }
+	template <class V> static FBS_EXPR_INLINE void vec(V &a, const V &b) { a ^= b; }
+};
+
+struct and_not_op {
+	static FBS_EXPR_INLINE bool bit(bool a, bool b) { return a && !b; }
+	template <class V> static FBS_EXPR_INLINE void vec(V &a, const V &b) { a &= ~b; }
+};
+
+// Operands are held by value: they are only a few pointers each and the
+// trees are built from temporaries.
+template <class OP, class L, class R> struct binary : expr<binary<OP, L, R> > {
+	L l;
+	R r;
+
+	binary(const L &l, const R &r) : l(l), r(r) {
+		if (l.length() != r.length()) throw "Bitstring lengths differ.";
+	}
+
+	inline size_t length() const { return l.length(); }
+	FBS_EXPR_INLINE bool at(size_t i) const { return OP::bit(l.at(i), r.at(i)); }
+	template <class V> FBS_EXPR_INLINE void load(size_t i, V &v) const {
+		V w;
+		l.load(i, v);
+		r.load(i, w);
+		OP::vec(v, w);
+	}
+};
+
+template <class E> struct inverted : expr<inverted<E> > {
+	E e;
+
+	inverted(const E &e) : e(e) {}
+
+	inline size_t length() const { return e.length(); }
+	FBS_EXPR_INLINE bool at(size_t i) const { return !e.at(i); }
+	template <class V> FBS_EXPR_INLINE void load(size_t i, V &v) const { e.load(i, v); v = ~v; }
+};
+
+inline bits as_expr(const fast_bitstring_view &f) { return bits(f.data(), f.length()); }
+template <class E> inline const E &as_expr(const expr<E> &e) { return e.self(); }
+
+// Expression type for an operand, or no type at all for anything that is
+// neither a bitstring nor an expression, so the operators below stay out of
+// unrelated overload sets.
+template <class T> struct operand {
+	typedef typename std::decay<decltype(as_expr(std::declval<const T &>()))>::type type;
+};
+
+
+//
+// Evaluation.
+//
+
+template <class E> void eval_scalar(const E &e, byte *dst, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = e.at(i);
+}
+
+template <class V, class E> FBS_EXPR_INLINE void eval_vectors(const E &e, byte *dst, size_t n) {
+
+	size_t i = 0;
+
+	for (; i + sizeof(V) <= n; i += sizeof(V)) {
+		V v;
+		e.load(i, v);
+		v &= 1;
+		memcpy(dst + i, &v, sizeof(V));
+	}
+	for (; i < n; ++i)
+		dst[i] = e.at(i);
+}
+
+template <class E> void eval_sse2(const E &e, byte *dst, size_t n) {
+	eval_vectors<v16>(e, dst, n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <class E> __attribute__((target("avx2"))) void eval_avx2(const E &e, byte *dst, size_t n) {
+	eval_vectors<v32>(e, dst, n);
+}
+
+template <class E> __attribute__((target("avx512f,avx512bw"))) void eval_avx512(const E &e, byte *dst, size_t n) {
+	eval_vectors<v64>(e, dst, n);
+}
+#endif
+
+// Write the first n bits of e to dst, which may be one of e's operands.
+template <class E> void evaluate(const E &e, byte *dst, size_t n) {
+
+	switch (fast_bitstring::simd_level()) {
+	case fast_bitstring::SIMD_SCALAR:
+		eval_scalar(e, dst, n);
+		break;
+#if defined(__x86_64__) || defined(__i386__)
+	case fast_bitstring::SIMD_AVX2:
+		eval_avx2(e, dst, n);
+		break;
+	case fast_bitstring::SIMD_AVX512:
+		eval_avx512(e, dst, n);
+		break;
+#endif
+	default:
+		eval_sse2(e, dst, n);
+		break;
+	}
+}
+
+
+//
+// Operators.  Found by argument dependent lookup whenever one side is an
+// expression; bitstring op bitstring is handled in the global namespace below.
+//
+
+template <class L, class R>
+inline binary<and_op, typename operand<L>::type, typename operand<R>::type> operator &(const L &l, const R &r) {
+	return binary<and_op, typename operand<L>::type, typename operand<R>::type>(as_expr(l), as_expr(r));
+}
+
+template <class L, class R>
+inline binary<or_op, typename operand<L>::type, typename operand<R>::type> operator |(const L &l, const R &r) {
+	return binary<or_op, typename operand<L>::type, typename operand<R>::type>(as_expr(l), as_expr(r));
+}
+
+template <class L, class R>
+inline binary<xor_op, typename operand<L>::type, typename operand<R>::type> operator ^(const L &l, const R &r) {
+	return binary<xor_op, typename operand<L>::type, typename operand<R>::type>(as_expr(l), as_expr(r));
+}
+
+template <class E> inline inverted<E> operator ~(const expr<E> &e) {
+	return inverted<E>(e.self());
+}
+
+// l & ~r in one operation.
+template <class L, class R>
+inline binary<and_not_op, typename operand<L>::type, typename operand<R>::type> and_not(const L &l, const R &r) {
+	return binary<and_not_op, typename operand<L>::type, typename operand<R>::type>(as_expr(l), as_expr(r));
+}
+
+}
+
+inline fbs_expr::binary<fbs_expr::and_op, fbs_expr::bits, fbs_expr::bits> operator &(const fast_bitstring_view &l, const fast_bitstring_view &r) {
+	return fbs_expr::operator &(l, r);
+}
+
+inline fbs_expr::binary<fbs_expr::or_op, fbs_expr::bits, fbs_expr::bits> operator |(const fast_bitstring_view &l, const fast_bitstring_view &r) {
+	return fbs_expr::operator |(l, r);
+}
+
+inline fbs_expr::binary<fbs_expr::xor_op, fbs_expr::bits, fbs_expr::bits> operator ^(const fast_bitstring_view &l, const fast_bitstring_view &r) {
+	return fbs_expr::operator ^(l, r);
+}
+
+inline fbs_expr::inverted<fbs_expr::bits> operator ~(const fast_bitstring_view &f) {
+	return fbs_expr::inverted<fbs_expr::bits>(fbs_expr::as_expr(f));
+}
+
+
+//
+// fast_bitstring members taking expressions.
+//
+
+template <class E> fast_bitstring::fast_bitstring(const fbs_expr::expr<E> &e) : BITS_PER_BYTE(8), gen(0), allocator(fbs_allocator::get_default()), bcapacity(0) {
+	blength = e.self().length();
+	barray = allocate_bits(blength);
+	bcapacity = blength;
+	fbs_expr::evaluate(e.self(), barray, blength);
+}
+
+template <class E> fast_bitstring &fast_bitstring::operator =(const fbs_expr::expr<E> &e) {
+
+	const size_t n = e.self().length();
+
+	// The expression may read this bitstring, so it must not move first.
+	if (n != blength) {
+		byte *bits = allocate_bits(n);
+		fbs_expr::evaluate(e.self(), bits, n);
+		release_bits(barray, bcapacity);
+		barray = bits;
+		blength = n;
+		bcapacity = n;
+	} else {
+		fbs_expr::evaluate(e.self(), barray, n);
+	}
+	++gen;
+
+	return *this;
+}
+
+template <class E> fast_bitstring &fast_bitstring::operator &=(const fbs_expr::expr<E> &e) {
+	return *this = fbs_expr::operator &(*this, e.self());
+}
+
+template <class E> fast_bitstring &fast_bitstring::operator |=(const fbs_expr::expr<E> &e) {
+	return *this = fbs_expr::operator |(*this, e.self());
+}
+
+template <class E> fast_bitstring &fast_bitstring::operator ^=(const fbs_expr::expr<E> &e) {
+	return *this = fbs_expr::operator ^(*this, e.self());
+}
+
+#endif
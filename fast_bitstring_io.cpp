@@ -0,0 +1,284 @@
+//
+// fast_bitstring_io.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "fast_bitstring.h"
+
+typedef fast_bitstring::byte byte;
+
+
+//
+// Pipelined file reader.
+//
+// A background thread pread()s the file chunk by chunk into a small ring of
+// buffers while the caller explodes chunks it has already been handed, so
+// reading chunk k + 1 overlaps exploding chunk k.
+//
+// Chunks are handed over strictly in file order.  Any read error stops the
+// reader and is reported to the caller as an errno value.
+//
+
+#define PIPELINE_DEPTH 3
+
+typedef void (*chunk_handler)(const byte *bytes, size_t offset_in_bytes, size_t n_bytes, void *context);
+
+class chunk_pipeline {
+
+public:
+	chunk_pipeline(int fd, size_t size, size_t chunk_bytes)
+		: fd(fd), size(size), chunk_bytes(chunk_bytes), error(0), cancelled(false), n_read(0), n_done(0) {
+		// A failed allocation is reported by run() as ENOMEM.
+		for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+			slots[i] = (byte *)malloc(chunk_bytes);
+			if (!slots[i]) error = ENOMEM;
+		}
+	}
+
+	~chunk_pipeline() {
+		for (int i = 0; i < PIPELINE_DEPTH; ++i)
+			free(slots[i]);
+	}
+
+	// Run the reader in the background and hand each chunk, in order, to the
+	// handler until the file is consumed, a read fails or the handler asks to
+	// stop by returning non-zero from should_stop.
+	int run(chunk_handler handler, void *context, int (*should_stop)(void *) = NULL) {
+
+		if (error) return error;
+
+		const size_t n_chunks = (size + chunk_bytes - 1) / chunk_bytes;
+		int rc = 0;
+
+		std::thread reader(&chunk_pipeline::read_all, this, n_chunks);
+
+		// The reader must be stopped however the handler leaves, throwing
+		// included, or its thread is destroyed still running.
+		try {
+			for (size_t k = 0; k < n_chunks; ++k) {
+				{
+					std::unique_lock<std::mutex> lock(m);
+					cv.wait(lock, [&] { return n_read > k || error; });
+					if (n_read <= k) {
+						rc = error;
+						break;
+					}
+				}
+
+				const size_t offset = k * chunk_bytes;
+				const size_t n = offset + chunk_bytes > size ? size - offset : chunk_bytes;
+				handler(slots[k % PIPELINE_DEPTH], offset, n, context);
+
+				{
+					std::lock_guard<std::mutex> lock(m);
+					n_done = k + 1;
+				}
+				cv.notify_all();
+
+				if (should_stop && (rc = should_stop(context)) != 0)
+					break;
+			}
+		} catch (...) {
+			stop(reader);
+			throw;
+		}
+
+		stop(reader);
+
+		return rc;
+	}
+
+private:
+	// Cancel the reader, should it still be going, and wait for it.
+	void stop(std::thread &reader) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			cancelled = true;
+		}
+		cv.notify_all();
+		reader.join();
+	}
+
+	void read_all(size_t n_chunks) {
+
+		for (size_t k = 0; k < n_chunks; ++k) {
+			{
+				// Wait for the slot to be released by the consumer.
+				std::unique_lock<std::mutex> lock(m);
+				cv.wait(lock, [&] { return k < n_done + PIPELINE_DEPTH || cancelled; });
+				if (cancelled) return;
+			}
+
+			const size_t offset = k * chunk_bytes;
+			const size_t n = offset + chunk_bytes > size ? size - offset : chunk_bytes;
+			byte *dst = slots[k % PIPELINE_DEPTH];
+			size_t got = 0;
+
+			while (got < n) {
+				ssize_t r = pread(fd, dst + got, n - got, offset + got);
+				if (r < 0 && errno == EINTR) continue;
+				if (r <= 0) {
+					std::lock_guard<std::mutex> lock(m);
+					error = r < 0 ? errno : EIO;
+					cv.notify_all();
+					return;
+				}
+				got += r;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m);
+				n_read = k + 1;
+			}
+			cv.notify_all();
+		}
+	}
+
+	int fd;
+	size_t size;
+	size_t chunk_bytes;
+	byte *slots[PIPELINE_DEPTH];
+
+	std::mutex m;
+	std::condition_variable cv;
+	int error;
+	bool cancelled;
+	size_t n_read;		// Chunks read so far.
+	size_t n_done;		// Chunks consumed so far.
+};
+
+static int open_for_streaming(const char *filename, size_t *size) {
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return fd;
+}
+
+
+//
+// Whole file load: each chunk explodes straight into its place in barray.
+//
+
+static void explode_into(const byte *bytes, size_t offset_in_bytes, size_t n_bytes, void *context) {
+	fast_bitstring::explode_bits((byte *)context + offset_in_bytes * 8, bytes, 0, n_bytes * 8);
+}
+
+void fast_bitstring::load(const char *filename, size_t chunk_bytes) {
+
+	size_t size;
+
+	if (chunk_bytes == 0) chunk_bytes = DEFAULT_LOAD_CHUNK;
+
+	int fd = open_for_streaming(filename, &size);
+	if (fd < 0) throw "Failed to open file for fast bitstring";
+
+	byte *bits = NULL;
+	int rc;
+
+	// Allocating and starting the reader may throw.
+	try {
+		bits = allocate_bits(size * BITS_PER_BYTE);
+		chunk_pipeline pipeline(fd, size, chunk_bytes);
+		rc = pipeline.run(explode_into, bits);
+	} catch (...) {
+		close(fd);
+		release_bits(bits, size * BITS_PER_BYTE);
+		throw;
+	}
+
+	close(fd);
+
+	if (rc) {
+		release_bits(bits, size * BITS_PER_BYTE);
+		if (rc == ENOMEM) throw "Out of memory for fast bitstring.";
+		throw "Failed to read bytes for fast bitstring";
+	}
+
+	release_bits(barray, bcapacity);
+	barray = bits;
+	blength = size * BITS_PER_BYTE;
+	bcapacity = blength;
+	++gen;
+}
+
+
+//
+// Streaming: each chunk is exploded into a scratch buffer and handed to the
+// consumer, so memory use is bounded by the chunk size whatever the file size.
+//
+
+typedef struct {
+	fast_bitstring::chunk_consumer consumer;
+	void *context;
+	byte *scratch;
+	int rc;
+} stream_state;
+
+static void explode_and_consume(const byte *bytes, size_t offset_in_bytes, size_t n_bytes, void *context) {
+
+	stream_state *s = (stream_state *)context;
+
+	fast_bitstring::explode_bits(s->scratch, bytes, 0, n_bytes * 8);
+	s->rc = s->consumer(s->scratch, offset_in_bytes * 8, n_bytes * 8, s->context);
+}
+
+static int consumer_stopped(void *context) {
+	return ((stream_state *)context)->rc;
+}
+
+int fast_bitstring::stream(const char *filename, chunk_consumer consumer, void *context, size_t chunk_bytes) {
+
+	size_t size;
+
+	if (chunk_bytes == 0) chunk_bytes = DEFAULT_LOAD_CHUNK;
+	if (chunk_bytes > ~(size_t)0 / 8) return ENOMEM;
+
+	int fd = open_for_streaming(filename, &size);
+	if (fd < 0) return errno;
+
+	stream_state s = { consumer, context, (byte *)malloc(chunk_bytes * 8), 0 };
+	if (!s.scratch) {
+		close(fd);
+		return ENOMEM;
+	}
+
+	chunk_pipeline pipeline(fd, size, chunk_bytes);
+	int rc;
+
+	// Consumers may throw.
+	try {
+		rc = pipeline.run(explode_and_consume, &s, consumer_stopped);
+	} catch (...) {
+		close(fd);
+		free(s.scratch);
+		throw;
+	}
+
+	close(fd);
+	free(s.scratch);
+
+	return rc;
+}
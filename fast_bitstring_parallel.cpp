@@ -0,0 +1,271 @@
+//
+// fast_bitstring_parallel.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <stdint.h>
+
+#include <thread>
+#include <vector>
+
+#include "fast_bitstring.h"
+#include "rle_stream.h"
+
+typedef fast_bitstring::byte byte;
+
+
+// Below this many bits per thread the threads cost more than they save.
+#define MIN_BITS_PER_THREAD (1 << 20)
+
+// Exploding and packing run at memory speed, so need more to be worth a thread.
+#define MIN_BITS_PER_COPY_THREAD (1 << 23)
+
+#define PAGE_BYTES 4096
+
+// Number of threads to split n_bits across: n_threads if given, else one per
+// core, but never so many that a thread gets less than min_bits.
+static size_t thread_count(size_t n_threads, size_t n_bits, size_t min_bits) {
+
+	if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+	if (n_threads == 0) n_threads = 1;
+
+	const size_t most = n_bits / min_bits;
+	if (n_threads > most) n_threads = most ? most : 1;
+
+	return n_threads;
+}
+
+// Run fn(0) ... fn(n - 1) on n threads, the last on the calling thread.
+template <typename FN>
+static void run_threads(size_t n, FN fn) {
+
+	std::vector<std::thread> threads;
+
+	for (size_t k = 0; k + 1 < n; ++k)
+		threads.push_back(std::thread(fn, k));
+	fn(n - 1);
+
+	for (size_t k = 0; k < threads.size(); ++k)
+		threads[k].join();
+}
+
+// Run fn(0) ... fn(n - 1) with exec, or on threads of their own without one.
+template <typename FN>
+static void run_tasks(size_t n, fast_bitstring::executor exec, void *exec_context, FN fn) {
+
+	if (n == 1) {
+		fn(0);
+	} else if (!exec) {
+		run_threads(n, fn);
+	} else {
+		exec(n, [](size_t k, void *context) { (*(FN *)context)(k); }, &fn, exec_context);
+	}
+}
+
+
+//
+// Parallel RLE encode.
+//
+// The bitstring is cut into one segment per thread and each is encoded on its
+// own.  The adaptive RLE format has no header or cross block state, so the
+// segment encodings simply concatenate into a valid stream.  It decodes to the
+// same bits as the serial encoding though it may differ from it by a few bytes
+// at each cut, where a run or verbatim block is split in two.
+//
+size_t fast_bitstring_view::run_length_encode_parallel(byte **encoding, size_t n_threads) const {
+
+	n_threads = thread_count(n_threads, blength, MIN_BITS_PER_THREAD);
+
+	if (n_threads <= 1 || !encoding) return run_length_encode(encoding);
+
+	const size_t segment = (blength + n_threads - 1) / n_threads;
+	std::vector<byte *> outs(n_threads);
+	std::vector<size_t> sizes(n_threads);
+
+	run_threads(n_threads, [&](size_t k) {
+		const size_t first = k * segment;
+		const size_t n = first + segment > blength ? blength - first : segment;
+		rle_encoder enc;
+
+		outs[k] = (byte *)malloc(rle_encoder::max_encoded_length(n) + rle_encoder::MAX_FINISH_LENGTH);
+		sizes[k] = enc.encode(&barray[first], n, outs[k]);
+		sizes[k] += enc.finish(&outs[k][sizes[k]]);
+	});
+
+	size_t total = 0;
+	for (size_t k = 0; k < n_threads; ++k)
+		total += sizes[k];
+
+	byte *rle_bytes = (byte *)malloc(total);
+	for (size_t k = 0, b = 0; k < n_threads; b += sizes[k], ++k) {
+		memcpy(&rle_bytes[b], outs[k], sizes[k]);
+		free(outs[k]);
+	}
+
+	*encoding = rle_bytes;
+
+	return total;
+}
+
+
+//
+// Parallel RLE decode.
+//
+// A sizing prescan, as run_length_decoded_length() does, walks the guide bytes
+// and notes a cut every num_bytes / n_threads bytes: the guide byte it falls on
+// and the running total of bits before it, which is the output offset of that
+// segment.  The segments are then decoded in parallel, each straight into its
+// own part of the result.
+//
+fast_bitstring *fast_bitstring::run_length_decode_parallel(const byte *rle_bytes, const size_t num_bytes, size_t n_threads) {
+
+	// Roughly 1 encoded byte per 8 decoded bits for incompressible data.
+	n_threads = thread_count(n_threads, num_bytes * 8, MIN_BITS_PER_THREAD);
+
+	if (n_threads <= 1) return run_length_decode(rle_bytes, num_bytes);
+
+	std::vector<size_t> cut_byte(1, 0), cut_bit(1, 0);
+	const size_t stride = num_bytes / n_threads;
+	size_t next_cut = stride, bits = 0, b;
+
+	for (b = 0; b < num_bytes; ) {
+		if (b >= next_cut && cut_byte.size() < n_threads) {
+			cut_byte.push_back(b);
+			cut_bit.push_back(bits);
+			next_cut += stride;
+		}
+		if (rle_bytes[b] == 128) {
+			if (b + 1 >= num_bytes) throw "Truncated RLE encoding.";
+			const size_t nvb = rle_bytes[b + 1] + 1;
+			bits += nvb;
+			b += 2 + bit_count_to_byte_count(nvb);
+		} else {
+			bits += rle_bytes[b] & 0x7F;
+			b += 1;
+		}
+	}
+	if (b != num_bytes) throw "Truncated RLE encoding.";
+
+	cut_byte.push_back(num_bytes);
+	cut_bit.push_back(bits);
+
+	fbs *decoded_fbs = new fbs(bits, FROM_BITS, NO_FILL);
+	const size_t n_segments = cut_byte.size() - 1;
+	std::vector<size_t> decoded(n_segments);
+
+	run_threads(n_segments, [&](size_t k) {
+		decoded[k] = run_length_decode_into(&rle_bytes[cut_byte[k]], cut_byte[k + 1] - cut_byte[k],
+						    &decoded_fbs->barray[cut_bit[k]], cut_bit[k + 1] - cut_bit[k]);
+	});
+
+	for (size_t k = 0; k < n_segments; ++k)
+		assert(decoded[k] == cut_bit[k + 1] - cut_bit[k]);
+
+	return decoded_fbs;
+}
+
+
+//
+// Parallel explode and pack.
+//
+// Both write one output byte per 1 or 8 input bits, so the output is cut into
+// n_pieces pieces of whole pages: cut k is the first page boundary of dst at or
+// after k / n_pieces of the way through it.  The pieces then share no page, so
+// each page is first touched by the one thread that writes it.  Pack cuts are
+// whole bytes of dst, leaving any part byte in the last piece.
+//
+// Outputs large enough to get huge pages from fbs_allocator::automatic(), or
+// from transparent huge pages, are placed a huge page at a time, so those are
+// cut on huge page boundaries instead.
+//
+// Returns the n_pieces + 1 cuts, or fewer should pieces be under a page, in
+// bytes of dst from dst.
+//
+static std::vector<size_t> page_cuts(const byte *dst, size_t n_bytes, size_t n_pieces) {
+
+	const uintptr_t base = (uintptr_t)dst;
+	const uintptr_t page = n_bytes >= fbs_allocator::HUGE_PAGE_MIN_BYTES ? fbs_allocator::HUGE_PAGE_BYTES : PAGE_BYTES;
+	const size_t stride = n_bytes / n_pieces;
+	std::vector<size_t> cuts(1, 0);
+
+	for (size_t k = 1; k < n_pieces; ++k) {
+		const size_t cut = ((base + k * stride + page - 1) & ~(page - 1)) - base;
+		if (cut > cuts.back() && cut < n_bytes)
+			cuts.push_back(cut);
+	}
+	cuts.push_back(n_bytes);
+
+	return cuts;
+}
+
+void fast_bitstring::explode_bits_parallel(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits, size_t n_threads, executor exec, void *exec_context) {
+
+	n_threads = thread_count(n_threads, n_bits, MIN_BITS_PER_COPY_THREAD);
+
+	if (n_threads <= 1) {
+		explode_bits(dst, src, offset_in_bits, n_bits);
+		return;
+	}
+
+	const std::vector<size_t> cuts = page_cuts(dst, n_bits, n_threads);
+
+	run_tasks(cuts.size() - 1, exec, exec_context, [&](size_t k) {
+		explode_bits(dst + cuts[k], src, offset_in_bits + cuts[k], cuts[k + 1] - cuts[k]);
+	});
+}
+
+size_t fast_bitstring::pack_bits_parallel(byte *dst, const byte *src, size_t n_bits, size_t n_threads, executor exec, void *exec_context) {
+
+	n_threads = thread_count(n_threads, n_bits, MIN_BITS_PER_COPY_THREAD);
+
+	if (n_threads <= 1) return pack_bits(dst, src, n_bits);
+
+	std::vector<size_t> cuts = page_cuts(dst, n_bits / 8, n_threads);
+	for (size_t k = 0; k < cuts.size(); ++k)
+		cuts[k] *= 8;
+	cuts.back() = n_bits;
+
+	std::vector<size_t> packed(cuts.size() - 1);
+
+	run_tasks(cuts.size() - 1, exec, exec_context, [&](size_t k) {
+		packed[k] = pack_bits(dst + cuts[k] / 8, src + cuts[k], cuts[k + 1] - cuts[k]);
+	});
+
+	size_t n_bytes = 0;
+	for (size_t k = 0; k < packed.size(); ++k)
+		n_bytes += packed[k];
+
+	return n_bytes;
+}
+
+fast_bitstring *fast_bitstring::explode_parallel(const byte *byte_array, size_t offset_in_bits, size_t length_in_bits, size_t n_threads, executor exec, void *exec_context, fbs_allocator *allocator) {
+
+	// Left unfilled so that the exploding threads are the first to touch it.
+	fbs *exploded = new fbs(length_in_bits, FROM_BITS, NO_FILL, allocator);
+
+	explode_bits_parallel(exploded->barray, byte_array, offset_in_bits, length_in_bits, n_threads, exec, exec_context);
+
+	return exploded;
+}
+
+size_t fast_bitstring_view::to_bytes_parallel(byte *bytes, size_t offset, size_t num_bits, size_t n_threads, executor exec, void *exec_context) const {
+
+	if (offset > blength)
+		offset = blength;
+
+	if (num_bits == 0 || num_bits > blength - offset)
+		num_bits = blength - offset;
+
+	if (!bytes) {
+		return (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
+	}
+
+	return fast_bitstring::pack_bits_parallel(bytes, barray + offset, num_bits, n_threads, exec, exec_context);
+}
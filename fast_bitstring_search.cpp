@@ -0,0 +1,149 @@
+//
+// fast_bitstring_search.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "fast_bitstring.h"
+
+typedef fast_bitstring::byte byte;
+
+
+//
+// Bit pattern search.
+//
+// The text is gathered a block at a time into 64 bit words with mask_bits(),
+// one bit per position, and each word is then tested at all 64 positions at
+// once, shift-and style: the word of candidate starts is ANDed with the text
+// shifted by j and compared against pattern bit j, for j up to the filter
+// length.  On most data the candidates are gone after a handful of shifts.
+//
+// Patterns longer than the filter are verified past it with the vectorized
+// first_difference_bits(), so a candidate costs one bounded compare.
+//
+
+#define FILTER_BITS 32			// Pattern bits tested bit-parallel.
+#define BLOCK_WORDS 64			// Words of text gathered per block.
+#define BLOCK_BITS (BLOCK_WORDS * 64)
+
+static inline uint64_t shifted(const uint64_t *w, unsigned int j) {
+	return j ? (w[0] >> j) | (w[1] << (64 - j)) : w[0];
+}
+
+size_t fast_bitstring::search_bits(const byte *bits, size_t n, const byte *pattern, size_t m, match_handler handler, void *context) {
+
+	if (m == 0 || m > n) return 0;
+
+	const size_t k = m < FILTER_BITS ? m : FILTER_BITS;
+	const size_t last = n - m;		// Last possible start.
+	uint64_t want[FILTER_BITS];		// ~0 where the pattern bit is 0, so text ^ want is 1 on a match.
+	uint64_t words[BLOCK_WORDS + 1];
+	size_t found = 0;
+
+	for (size_t j = 0; j < k; ++j)
+		want[j] = pattern[j] ? 0 : ~(uint64_t)0;
+
+	for (size_t base = 0; base <= last; base += BLOCK_BITS) {
+
+		// Gather the block plus the bits the last start in it may look at.
+		size_t n_bits = BLOCK_BITS + 64;
+		if (n_bits > n - base) n_bits = n - base;
+		mask_bits(words, &bits[base], n_bits);
+		if (n_bits <= BLOCK_BITS) words[(n_bits + 63) / 64] = 0;
+
+		size_t n_starts = last - base + 1;
+		if (n_starts > BLOCK_BITS) n_starts = BLOCK_BITS;
+
+		for (size_t w = 0; w * 64 < n_starts; ++w) {
+
+			uint64_t starts = ~(uint64_t)0;
+			if (n_starts - w * 64 < 64)
+				starts = ((uint64_t)1 << (n_starts - w * 64)) - 1;
+
+			for (size_t j = 0; j < k && starts; ++j)
+				starts &= shifted(&words[w], j) ^ want[j];
+
+			for (; starts; starts &= starts - 1) {
+				const size_t i = base + w * 64 + __builtin_ctzll(starts);
+				if (m > k && first_difference_bits(&bits[i + k], &pattern[k], m - k) != m - k)
+					continue;
+				++found;
+				if (handler(i, context))
+					return found;
+			}
+		}
+	}
+
+	return found;
+}
+
+
+//
+// fast_bitstring_view wrappers.
+//
+
+static int stop_at_first(size_t position, void *context) {
+	*(size_t *)context = position;
+	return 1;
+}
+
+// Search from "from" on by searching the tail of the bitstring.
+size_t fast_bitstring_view::find(const fast_bitstring_view &pattern, size_t from) const {
+
+	size_t position;
+
+	if (from >= blength) return blength;
+
+	if (!fast_bitstring::search_bits(&barray[from], blength - from, pattern.barray, pattern.blength, stop_at_first, &position))
+		return blength;
+
+	return from + position;
+}
+
+typedef struct {
+	std::vector<size_t> *positions;
+	size_t offset;		// Added to each position.
+	size_t next;		// First position a non-overlapping match may start at.
+	size_t m;
+	bool overlapping;
+	size_t count;
+} all_matches;
+
+static int collect(size_t position, void *context) {
+
+	all_matches *a = (all_matches *)context;
+
+	if (!a->overlapping) {
+		if (position < a->next) return 0;
+		a->next = position + a->m;
+	}
+
+	if (a->positions) a->positions->push_back(a->offset + position);
+	++a->count;
+
+	return 0;
+}
+
+size_t fast_bitstring_view::find_all(const fast_bitstring_view &pattern, std::vector<size_t> &positions, bool overlapping, size_t from) const {
+
+	if (from >= blength) return 0;
+
+	all_matches a = { &positions, from, 0, pattern.blength, overlapping, 0 };
+	fast_bitstring::search_bits(&barray[from], blength - from, pattern.barray, pattern.blength, collect, &a);
+
+	return a.count;
+}
+
+size_t fast_bitstring_view::count_occurrences(const fast_bitstring_view &pattern, bool overlapping) const {
+
+	all_matches a = { NULL, 0, 0, pattern.blength, overlapping, 0 };
+	fast_bitstring::search_bits(barray, blength, pattern.barray, pattern.blength, collect, &a);
+
+	return a.count;
+}
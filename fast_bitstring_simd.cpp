@@ -0,0 +1,881 @@
+//
+// fast_bitstring_simd.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <stdint.h>
+
+#include "fast_bitstring.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FBS_X86 1
+#include <immintrin.h>
+#else
+#define FBS_X86 0
+#endif
+
+typedef fast_bitstring::byte byte;
+
+
+//
+// Explode kernels.
+//
+// Every kernel explodes n whole source bytes into 8 * n destination bytes, one
+// byte per bit, most significant bit first.  Bit offsets and partial tail bytes
+// are handled by explode_bits() so the kernels only ever see aligned input.
+//
+
+static void explode_scalar(byte *dst, const byte *src, size_t n) {
+
+	for (size_t i = 0; i < n; ++i) {
+		const byte b = src[i];
+		for (byte mask = 0x80; mask; mask >>= 1)
+			*dst++ = (b & mask) ? 1 : 0;
+	}
+}
+
+#if FBS_X86
+
+// PDEP deposits the 8 source bits into the low bit of 8 consecutive bytes, LSB
+// first, so a byte swap puts the MSB into the first (lowest addressed) byte.
+__attribute__((target("bmi2")))
+static void explode_bmi2(byte *dst, const byte *src, size_t n) {
+
+	for (size_t i = 0; i < n; ++i, dst += 8) {
+		uint64_t w = __builtin_bswap64(_pdep_u64(src[i], 0x0101010101010101ULL));
+		memcpy(dst, &w, 8);
+	}
+}
+
+// Replicate each source byte 8 times with a shuffle, isolate one bit per byte
+// with a mask and normalize to 0/1.  16 source bytes per iteration.
+__attribute__((target("ssse3")))
+static void explode_ssse3(byte *dst, const byte *src, size_t n) {
+
+	const __m128i bitsel = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+					     (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m128i shuf = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+	const __m128i two = _mm_set1_epi8(2);
+	const __m128i one = _mm_set1_epi8(1);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i s = shuf;
+		for (int k = 0; k < 8; ++k, dst += 16, s = _mm_add_epi8(s, two)) {
+			__m128i x = _mm_and_si128(_mm_shuffle_epi8(v, s), bitsel);
+			x = _mm_and_si128(_mm_cmpeq_epi8(x, bitsel), one);
+			_mm_storeu_si128((__m128i *)dst, x);
+		}
+	}
+
+	explode_scalar(dst, &src[i], n - i);
+}
+
+// As for SSSE3 but 32 output bytes per shuffle.  The shuffle is per 128 bit lane
+// so the source is broadcast to both lanes and each lane picks its own 2 bytes.
+__attribute__((target("avx2")))
+static void explode_avx2(byte *dst, const byte *src, size_t n) {
+
+	const __m256i bitsel = _mm256_setr_epi8(
+		(char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+		(char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i shuf = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+		2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i four = _mm256_set1_epi8(4);
+	const __m256i one = _mm256_set1_epi8(1);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		const __m256i v = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&src[i]));
+		__m256i s = shuf;
+		for (int k = 0; k < 4; ++k, dst += 32, s = _mm256_add_epi8(s, four)) {
+			__m256i x = _mm256_and_si256(_mm256_shuffle_epi8(v, s), bitsel);
+			x = _mm256_and_si256(_mm256_cmpeq_epi8(x, bitsel), one);
+			_mm256_storeu_si256((__m256i *)dst, x);
+		}
+	}
+
+	explode_scalar(dst, &src[i], n - i);
+}
+
+// 64 output bytes per shuffle; the bit test produces a mask register that is
+// expanded straight into 0/1 bytes.
+__attribute__((target("avx512f,avx512bw")))
+static void explode_avx512(byte *dst, const byte *src, size_t n) {
+
+	// Output byte 8e + j tests bit (7 - j) of source byte e.
+	const __m512i bitsel = _mm512_set1_epi64(0x0102040810204080ULL);
+	const __m512i eight = _mm512_set1_epi8(8);
+	size_t i = 0;
+
+	// The source is broadcast to all four lanes, lane L picking source bytes 2L
+	// and 2L+1 on the first shuffle and 2L+8, 2L+9 on the second.
+	const __m512i idx = _mm512_set_epi64(
+		0x0707070707070707ULL, 0x0606060606060606ULL, 0x0505050505050505ULL, 0x0404040404040404ULL,
+		0x0303030303030303ULL, 0x0202020202020202ULL, 0x0101010101010101ULL, 0x0000000000000000ULL);
+
+	for (; i + 16 <= n; i += 16) {
+		const __m512i v = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)&src[i]));
+		__m512i s = idx;
+		for (int k = 0; k < 2; ++k, dst += 64, s = _mm512_add_epi8(s, eight)) {
+			const __mmask64 m = _mm512_test_epi8_mask(_mm512_shuffle_epi8(v, s), bitsel);
+			_mm512_storeu_si512((void *)dst, _mm512_maskz_set1_epi8(m, 1));
+		}
+	}
+
+	explode_scalar(dst, &src[i], n - i);
+}
+
+#endif
+
+
+//
+// Pack kernels.
+//
+// The inverse of the explode kernels: pack 8 * n source bytes, one bit per byte,
+// into n destination bytes, most significant bit first.  Only the low bit of
+// each source byte is used, matching the original to_bytes() loop.
+//
+
+static void pack_scalar(byte *dst, const byte *src, size_t n) {
+
+	for (size_t i = 0; i < n; ++i, src += 8) {
+		dst[i] = ((src[0] & 1) << 7) | ((src[1] & 1) << 6) | ((src[2] & 1) << 5) | ((src[3] & 1) << 4) |
+			 ((src[4] & 1) << 3) | ((src[5] & 1) << 2) | ((src[6] & 1) << 1) | ((src[7] & 1) << 0);
+	}
+}
+
+#if FBS_X86
+
+// The byte swap puts the first source byte in the top byte, so PEXT gathers it
+// into bit 7 of the result.
+__attribute__((target("bmi2")))
+static void pack_bmi2(byte *dst, const byte *src, size_t n) {
+
+	uint64_t w;
+
+	for (size_t i = 0; i < n; ++i, src += 8) {
+		memcpy(&w, src, 8);
+		dst[i] = (byte)_pext_u64(__builtin_bswap64(w), 0x0101010101010101ULL);
+	}
+}
+
+// Reverse each group of 8 source bytes so the first lands in the highest bit,
+// shift each byte's low bit up to its sign bit and gather the sign bits.
+__attribute__((target("ssse3")))
+static void pack_ssse3(byte *dst, const byte *src, size_t n) {
+
+	const __m128i rev = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2, src += 16) {
+		__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), rev);
+		const uint16_t m = (uint16_t)_mm_movemask_epi8(_mm_slli_epi64(x, 7));
+		memcpy(&dst[i], &m, 2);
+	}
+
+	pack_scalar(&dst[i], src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void pack_avx2(byte *dst, const byte *src, size_t n) {
+
+	const __m256i rev = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4, src += 32) {
+		__m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), rev);
+		const uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(x, 7));
+		memcpy(&dst[i], &m, 4);
+	}
+
+	pack_scalar(&dst[i], src, n - i);
+}
+
+// The byte test against 1 yields the 64 bit mask directly, no shift needed.
+__attribute__((target("avx512f,avx512bw")))
+static void pack_avx512(byte *dst, const byte *src, size_t n) {
+
+	const __m512i rev = _mm512_set_epi64(
+		0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+		0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL);
+	const __m512i one = _mm512_set1_epi8(1);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8, src += 64) {
+		__m512i x = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)src), rev);
+		const uint64_t m = _mm512_test_epi8_mask(x, one);
+		memcpy(&dst[i], &m, 8);
+	}
+
+	pack_scalar(&dst[i], src, n - i);
+}
+
+#endif
+
+
+//
+// Count kernels.
+//
+// Count the non-zero bytes, i.e., the 1 bits, of n exploded bits.  Any non-zero
+// byte counts as 1, the same as compare() treats it.
+//
+
+static size_t count_scalar(const byte *bits, size_t n) {
+
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+	size_t count = 0, i = 0;
+	uint64_t w;
+
+	// The high bit of each byte of ((w & 0x7F) + 0x7F) | w is set iff the byte is non-zero.
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, &bits[i], 8);
+		count += __builtin_popcountll((((w & low7) + low7) | w) & ~low7);
+	}
+
+	for (; i < n; ++i)
+		count += bits[i] != 0;
+
+	return count;
+}
+
+#if FBS_X86
+
+// SSE2 is in every x86-64, so this serves the SSSE3 and BMI2 levels too.
+static size_t count_sse2(const byte *bits, size_t n) {
+
+	const __m128i zero = _mm_setzero_si128();
+	size_t zeros = 0, i = 0;
+
+	for (; i + 16 <= n; i += 16)
+		zeros += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&bits[i]), zero)));
+
+	return (i - zeros) + count_scalar(&bits[i], n - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_avx2(const byte *bits, size_t n) {
+
+	const __m256i zero = _mm256_setzero_si256();
+	size_t zeros = 0, i = 0;
+
+	for (; i + 32 <= n; i += 32)
+		zeros += _mm_popcnt_u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&bits[i]), zero)));
+
+	return (i - zeros) + count_scalar(&bits[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static size_t count_avx512(const byte *bits, size_t n) {
+
+	size_t count = 0, i = 0;
+
+	for (; i + 64 <= n; i += 64) {
+		const __m512i x = _mm512_loadu_si512((const void *)&bits[i]);
+		count += _mm_popcnt_u64(_mm512_test_epi8_mask(x, x));
+	}
+
+	return count + count_scalar(&bits[i], n - i);
+}
+
+#endif
+
+
+//
+// Difference kernels.
+//
+// Compare two runs of n exploded bits where, again, any non-zero byte is a 1:
+// diff kernels return the index of the first bit that differs, or n, and
+// hamming kernels the number of bits that differ.
+//
+
+// High bit of each byte set iff the byte is non-zero, as in count_scalar().
+static inline uint64_t nonzero_bytes(uint64_t w) {
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+	return (((w & low7) + low7) | w) & ~low7;
+}
+
+static size_t diff_scalar(const byte *a, const byte *b, size_t n) {
+
+	size_t i = 0;
+	uint64_t x, y;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&x, &a[i], 8);
+		memcpy(&y, &b[i], 8);
+		if (nonzero_bytes(x) != nonzero_bytes(y))
+			break;
+	}
+
+	for (; i < n; ++i) {
+		if (!a[i] != !b[i])
+			break;
+	}
+
+	return i;
+}
+
+static size_t hamming_scalar(const byte *a, const byte *b, size_t n) {
+
+	size_t count = 0, i = 0;
+	uint64_t x, y;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&x, &a[i], 8);
+		memcpy(&y, &b[i], 8);
+		count += __builtin_popcountll(nonzero_bytes(x) ^ nonzero_bytes(y));
+	}
+
+	for (; i < n; ++i)
+		count += !a[i] != !b[i];
+
+	return count;
+}
+
+#if FBS_X86
+
+// Bit k of the result is set iff byte k of a and b differ as bits.
+static inline unsigned int diff_mask_sse2(const byte *a, const byte *b) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i za = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), zero);
+	const __m128i zb = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)b), zero);
+	return _mm_movemask_epi8(_mm_xor_si128(za, zb));
+}
+
+static size_t diff_sse2(const byte *a, const byte *b, size_t n) {
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		const unsigned int m = diff_mask_sse2(&a[i], &b[i]);
+		if (m) return i + __builtin_ctz(m);
+	}
+
+	return i + diff_scalar(&a[i], &b[i], n - i);
+}
+
+static size_t hamming_sse2(const byte *a, const byte *b, size_t n) {
+
+	size_t count = 0, i = 0;
+
+	for (; i + 16 <= n; i += 16)
+		count += __builtin_popcount(diff_mask_sse2(&a[i], &b[i]));
+
+	return count + hamming_scalar(&a[i], &b[i], n - i);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int diff_mask_avx2(const byte *a, const byte *b) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i za = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a), zero);
+	const __m256i zb = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)b), zero);
+	return _mm256_movemask_epi8(_mm256_xor_si256(za, zb));
+}
+
+__attribute__((target("avx2")))
+static size_t diff_avx2(const byte *a, const byte *b, size_t n) {
+
+	size_t i = 0;
+
+	// Two vectors per test keeps the loop branch off the critical path.
+	for (; i + 64 <= n; i += 64) {
+		const uint64_t m = diff_mask_avx2(&a[i], &b[i]) | (uint64_t)diff_mask_avx2(&a[i + 32], &b[i + 32]) << 32;
+		if (m) return i + __builtin_ctzll(m);
+	}
+
+	return i + diff_sse2(&a[i], &b[i], n - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t hamming_avx2(const byte *a, const byte *b, size_t n) {
+
+	size_t count = 0, i = 0;
+
+	for (; i + 32 <= n; i += 32)
+		count += _mm_popcnt_u32(diff_mask_avx2(&a[i], &b[i]));
+
+	return count + hamming_sse2(&a[i], &b[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint64_t diff_mask_avx512(const byte *a, const byte *b) {
+	const __m512i x = _mm512_loadu_si512((const void *)a);
+	const __m512i y = _mm512_loadu_si512((const void *)b);
+	return _mm512_test_epi8_mask(x, x) ^ _mm512_test_epi8_mask(y, y);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t diff_avx512(const byte *a, const byte *b, size_t n) {
+
+	size_t i = 0;
+
+	for (; i + 64 <= n; i += 64) {
+		const uint64_t m = diff_mask_avx512(&a[i], &b[i]);
+		if (m) return i + __builtin_ctzll(m);
+	}
+
+	return i + diff_sse2(&a[i], &b[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static size_t hamming_avx512(const byte *a, const byte *b, size_t n) {
+
+	size_t count = 0, i = 0;
+
+	for (; i + 64 <= n; i += 64)
+		count += _mm_popcnt_u64(diff_mask_avx512(&a[i], &b[i]));
+
+	return count + hamming_sse2(&a[i], &b[i], n - i);
+}
+
+#endif
+
+
+//
+// Mask kernels.
+//
+// Gather n words' worth of exploded bits, 64 per word, into words whose bit k
+// is set iff byte k is non-zero: the least significant bit comes first, which
+// is the order movemask produces and the natural one for shifting.
+//
+
+static void mask_scalar(uint64_t *dst, const byte *bits, size_t n) {
+
+	for (size_t w = 0; w < n; ++w, bits += 64) {
+		uint64_t m = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		// Multiplying the high bits down collects byte k's at bit 56 + k.
+		for (int k = 0; k < 8; ++k) {
+			uint64_t x;
+			memcpy(&x, &bits[k * 8], 8);
+			m |= ((nonzero_bytes(x) >> 7) * 0x0102040810204080ULL >> 56) << (k * 8);
+		}
+#else
+		for (int k = 0; k < 64; ++k)
+			m |= (uint64_t)(bits[k] != 0) << k;
+#endif
+		dst[w] = m;
+	}
+}
+
+#if FBS_X86
+
+static void mask_sse2(uint64_t *dst, const byte *bits, size_t n) {
+
+	const __m128i zero = _mm_setzero_si128();
+
+	for (size_t w = 0; w < n; ++w, bits += 64) {
+		uint64_t z = 0;
+		for (int k = 0; k < 4; ++k)
+			z |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&bits[k * 16]), zero)) << (k * 16);
+		dst[w] = ~z;
+	}
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(uint64_t *dst, const byte *bits, size_t n) {
+
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (size_t w = 0; w < n; ++w, bits += 64) {
+		const uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)bits), zero));
+		const uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&bits[32]), zero));
+		dst[w] = ~((uint64_t)hi << 32 | lo);
+	}
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void mask_avx512(uint64_t *dst, const byte *bits, size_t n) {
+
+	for (size_t w = 0; w < n; ++w, bits += 64) {
+		const __m512i x = _mm512_loadu_si512((const void *)bits);
+		dst[w] = _mm512_test_epi8_mask(x, x);
+	}
+}
+
+#endif
+
+
+//
+// Runtime dispatch.
+//
+
+typedef void (*explode_kernel)(byte *dst, const byte *src, size_t n);
+typedef void (*pack_kernel)(byte *dst, const byte *src, size_t n);
+typedef size_t (*count_kernel)(const byte *bits, size_t n);
+typedef size_t (*diff_kernel)(const byte *a, const byte *b, size_t n);
+typedef void (*mask_kernel)(uint64_t *dst, const byte *bits, size_t n);
+
+static bool level_supported(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+	case fast_bitstring::SIMD_SCALAR:
+		return true;
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:
+		return __builtin_cpu_supports("ssse3");
+	case fast_bitstring::SIMD_BMI2:
+		return __builtin_cpu_supports("bmi2");
+	case fast_bitstring::SIMD_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case fast_bitstring::SIMD_AVX512:
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	default:
+		return false;
+	}
+}
+
+static fast_bitstring::SIMD_LEVEL detect_simd_level() {
+
+	for (int level = fast_bitstring::SIMD_AVX512; level > fast_bitstring::SIMD_SCALAR; --level) {
+		if (level_supported((fast_bitstring::SIMD_LEVEL)level))
+			return (fast_bitstring::SIMD_LEVEL)level;
+	}
+
+	return fast_bitstring::SIMD_SCALAR;
+}
+
+static explode_kernel explode_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return explode_ssse3;
+	case fast_bitstring::SIMD_BMI2:		return explode_bmi2;
+	case fast_bitstring::SIMD_AVX2:		return explode_avx2;
+	case fast_bitstring::SIMD_AVX512:	return explode_avx512;
+#endif
+	default:				return explode_scalar;
+	}
+}
+
+static pack_kernel pack_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return pack_ssse3;
+	case fast_bitstring::SIMD_BMI2:		return pack_bmi2;
+	case fast_bitstring::SIMD_AVX2:		return pack_avx2;
+	case fast_bitstring::SIMD_AVX512:	return pack_avx512;
+#endif
+	default:				return pack_scalar;
+	}
+}
+
+static count_kernel count_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return count_sse2;
+	case fast_bitstring::SIMD_BMI2:		return count_sse2;
+	case fast_bitstring::SIMD_AVX2:		return count_avx2;
+	case fast_bitstring::SIMD_AVX512:	return count_avx512;
+#endif
+	default:				return count_scalar;
+	}
+}
+
+static diff_kernel diff_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return diff_sse2;
+	case fast_bitstring::SIMD_BMI2:		return diff_sse2;
+	case fast_bitstring::SIMD_AVX2:		return diff_avx2;
+	case fast_bitstring::SIMD_AVX512:	return diff_avx512;
+#endif
+	default:				return diff_scalar;
+	}
+}
+
+static diff_kernel hamming_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return hamming_sse2;
+	case fast_bitstring::SIMD_BMI2:		return hamming_sse2;
+	case fast_bitstring::SIMD_AVX2:		return hamming_avx2;
+	case fast_bitstring::SIMD_AVX512:	return hamming_avx512;
+#endif
+	default:				return hamming_scalar;
+	}
+}
+
+static mask_kernel mask_kernel_for(fast_bitstring::SIMD_LEVEL level) {
+
+	switch (level) {
+#if FBS_X86
+	case fast_bitstring::SIMD_SSSE3:	return mask_sse2;
+	case fast_bitstring::SIMD_BMI2:		return mask_sse2;
+	case fast_bitstring::SIMD_AVX2:		return mask_avx2;
+	case fast_bitstring::SIMD_AVX512:	return mask_avx512;
+#endif
+	default:				return mask_scalar;
+	}
+}
+
+typedef struct {
+	fast_bitstring::SIMD_LEVEL level;
+	explode_kernel explode;
+	pack_kernel pack;
+	count_kernel count;
+	diff_kernel diff;
+	diff_kernel hamming;
+	mask_kernel mask;
+} kernel_table;
+
+static kernel_table kernel_table_for(fast_bitstring::SIMD_LEVEL level) {
+
+	kernel_table k;
+
+	k.level = level;
+	k.explode = explode_kernel_for(level);
+	k.pack = pack_kernel_for(level);
+	k.count = count_kernel_for(level);
+	k.diff = diff_kernel_for(level);
+	k.hamming = hamming_kernel_for(level);
+	k.mask = mask_kernel_for(level);
+
+	return k;
+}
+
+static kernel_table detect_kernels() {
+
+#if FBS_X86
+	__builtin_cpu_init();
+#endif
+	return kernel_table_for(detect_simd_level());
+}
+
+// Resolved on first use rather than by a static initializer so bitstrings built
+// from other translation units' static constructors still get a kernel.  The
+// function-local static is initialized exactly once, whichever thread first
+// gets here, and every thread sees it complete.
+static kernel_table &kernels() {
+
+	static kernel_table k = detect_kernels();
+
+	return k;
+}
+
+fast_bitstring::SIMD_LEVEL fast_bitstring::simd_level() {
+	return kernels().level;
+}
+
+// Force a kernel level, e.g. to test or benchmark the fallbacks.  Levels the
+// CPU does not support are ignored.  Returns the level now in effect.  Not
+// thread safe: no kernel may be running on another thread meanwhile.
+fast_bitstring::SIMD_LEVEL fast_bitstring::set_simd_level(SIMD_LEVEL level) {
+
+	kernel_table &k = kernels();
+
+	if (level_supported(level))
+		k = kernel_table_for(level);
+
+	return k.level;
+}
+
+const char *fast_bitstring::simd_level_name(SIMD_LEVEL level) {
+
+	switch (level) {
+	case SIMD_SCALAR:	return "scalar";
+	case SIMD_SSSE3:	return "ssse3";
+	case SIMD_BMI2:		return "bmi2";
+	case SIMD_AVX2:		return "avx2";
+	case SIMD_AVX512:	return "avx512";
+	default:		return "unknown";
+	}
+}
+
+//
+// Explode n_bits packed bits, starting offset_in_bits into src, into dst one
+// byte per bit.  A non byte aligned offset is handled by exploding the remainder
+// of the first byte, after which the bulk of the input is aligned for the kernel.
+//
+void fast_bitstring::explode_bits(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits) {
+
+	byte b, mask;
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->explode_calls, 1);
+	fbs_stats::add(stats->explode_bits, n_bits);
+
+	src += offset_in_bits / 8;
+	offset_in_bits %= 8;
+
+	if (offset_in_bits && n_bits) {
+		b = *src++;
+		for (mask = 0x80 >> offset_in_bits; mask && n_bits; mask >>= 1, --n_bits)
+			*dst++ = (b & mask) ? 1 : 0;
+	}
+
+	const size_t n_bytes = n_bits / 8;
+	kernels().explode(dst, src, n_bytes);
+	dst += n_bytes * 8;
+	src += n_bytes;
+	n_bits %= 8;
+
+	if (n_bits) {
+		b = *src;
+		for (mask = 0x80; n_bits; mask >>= 1, --n_bits)
+			*dst++ = (b & mask) ? 1 : 0;
+	}
+}
+
+//
+// Pack n_bits bits held one per byte in src into dst, most significant bit
+// first.  A partial final byte is zero filled in its low bits.  Returns the
+// number of bytes written.
+//
+size_t fast_bitstring::pack_bits(byte *dst, const byte *src, size_t n_bits) {
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->pack_calls, 1);
+	fbs_stats::add(stats->pack_bits, n_bits);
+
+	const size_t n_bytes = n_bits / 8;
+	kernels().pack(dst, src, n_bytes);
+	src += n_bytes * 8;
+	n_bits %= 8;
+
+	if (n_bits) {
+		byte b = 0;
+		for (size_t i = 0; i < n_bits; ++i)
+			b |= (src[i] & 1) << (7 - i);
+		dst[n_bytes] = b;
+		return n_bytes + 1;
+	}
+
+	return n_bytes;
+}
+
+size_t fast_bitstring::count_bits(const byte *bits, size_t n) {
+	return kernels().count(bits, n);
+}
+
+size_t fast_bitstring::first_difference_bits(const byte *a, const byte *b, size_t n) {
+	return kernels().diff(a, b, n);
+}
+
+size_t fast_bitstring::hamming_bits(const byte *a, const byte *b, size_t n) {
+	return kernels().hamming(a, b, n);
+}
+
+//
+// Gather n exploded bits into ceil(n / 64) words, bit k of word w set iff
+// bits[64 * w + k] is non-zero.  The unused high bits of a partial final word
+// are zero.
+//
+void fast_bitstring::mask_bits(uint64_t *dst, const byte *bits, size_t n) {
+
+	const size_t n_words = n / 64;
+	kernels().mask(dst, bits, n_words);
+
+	if (n % 64) {
+		uint64_t m = 0;
+		bits += n_words * 64;
+		for (size_t k = 0; k < n % 64; ++k)
+			m |= (uint64_t)(bits[k] != 0) << k;
+		dst[n_words] = m;
+	}
+}
+
+//
+// Bulk boolean operations, by way of the same vector evaluation as fused
+// expressions; see fast_bitstring_expr.h.
+//
+void fast_bitstring::bitwise(BIT_OP op, byte *dst, const byte *a, const byte *b, size_t n) {
+
+	using namespace fbs_expr;
+
+	switch (op) {
+	case BIT_AND:		evaluate(bits(a, n) & bits(b, n), dst, n); break;
+	case BIT_OR:		evaluate(bits(a, n) | bits(b, n), dst, n); break;
+	case BIT_XOR:		evaluate(bits(a, n) ^ bits(b, n), dst, n); break;
+	case BIT_AND_NOT:	evaluate(fbs_expr::and_not(bits(a, n), bits(b, n)), dst, n); break;
+	case BIT_NOT:		evaluate(~bits(a, n), dst, n); break;
+	}
+}
+
+//
+// Copy n_bits packed bits, starting offset_in_bits into src, to the start of
+// dst, zero filling the low bits of a partial final byte as pack_bits() does.
+// Returns the number of bytes written.
+//
+size_t fast_bitstring::copy_bits(byte *dst, const byte *src, size_t offset_in_bits, size_t n_bits) {
+
+	if (n_bits == 0) return 0;
+
+	src += offset_in_bits / 8;
+
+	const size_t shift = offset_in_bits % 8;
+	const size_t n_out = (n_bits + 7) / 8;
+
+	if (shift == 0) {
+		memcpy(dst, src, n_out);
+	} else {
+		// Each output byte straddles two source bytes; the last may not exist.
+		const size_t n_src = (shift + n_bits + 7) / 8;
+		for (size_t i = 0; i < n_out; ++i) {
+			byte b = src[i] << shift;
+			if (i + 1 < n_src) b |= src[i + 1] >> (8 - shift);
+			dst[i] = b;
+		}
+	}
+
+	if (n_bits % 8)
+		dst[n_out - 1] &= (byte)(0xFF << (8 - n_bits % 8));
+
+	return n_out;
+}
+
+//
+// Return the number of leading bytes of bits[0, n) equal to bits[0], i.e., the
+// length of the run starting at bits[0], for n >= 1.  16 bytes per step with
+// SSE2, which every x86-64 has, so no dispatch is needed; 8 per step elsewhere.
+//
+size_t fast_bitstring::scan_run(const byte *bits, size_t n) {
+
+	const byte value = bits[0];
+	size_t i = 1;
+
+#if defined(__SSE2__)
+	const __m128i v = _mm_set1_epi8((char)value);
+	for (; i + 16 <= n; i += 16) {
+		const unsigned int ne = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&bits[i]), v)) & 0xFFFF;
+		if (ne) return i + __builtin_ctz(ne);
+	}
+#endif
+
+	const uint64_t pattern = value * 0x0101010101010101ULL;
+	uint64_t w;
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, &bits[i], 8);
+		w ^= pattern;
+		// The first differing byte is the lowest addressed one; on big endian
+		// machines that is the most significant.
+		if (w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + __builtin_ctzll(w) / 8;
+#else
+			return i + __builtin_clzll(w) / 8;
+#endif
+		}
+	}
+
+	for (; i < n && bits[i] == value; ++i)
+		;
+
+	return i;
+}
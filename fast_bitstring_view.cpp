@@ -0,0 +1,114 @@
+//
+// fast_bitstring_view.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "fast_bitstring.h"
+
+typedef fast_bitstring::byte byte;
+
+
+size_t fast_bitstring_view::count(size_t offset, size_t n) const {
+	if (offset > blength) offset = blength;
+	if (n > blength - offset) n = blength - offset;
+	return fast_bitstring::count_bits(&barray[offset], n);
+}
+
+int fast_bitstring_view::compare(const fast_bitstring_view &that) const {
+
+	if (this->blength < that.blength)
+		return -1;
+	if (this->blength > that.blength)
+		return 1;
+
+	const size_t i = fast_bitstring::first_difference_bits(this->barray, that.barray, blength);
+	if (i == blength)
+		return 0;
+
+	return this->barray[i] ? 1 : -1;
+}
+
+size_t fast_bitstring_view::first_difference(const fast_bitstring_view &that, size_t offset) const {
+	const size_t n = blength < that.blength ? blength : that.blength;
+	if (offset >= n) return n;
+	return offset + fast_bitstring::first_difference_bits(&barray[offset], &that.barray[offset], n - offset);
+}
+
+bool fast_bitstring_view::equal_range(const fast_bitstring_view &that, size_t offset, size_t that_offset, size_t n) const {
+	if (offset > blength || n > blength - offset) return false;
+	if (that_offset > that.blength || n > that.blength - that_offset) return false;
+	return fast_bitstring::first_difference_bits(&barray[offset], &that.barray[that_offset], n) == n;
+}
+
+size_t fast_bitstring_view::hamming_distance(const fast_bitstring_view &that, size_t offset, size_t n) const {
+	const size_t len = blength < that.blength ? blength : that.blength;
+	if (offset > len) offset = len;
+	if (n > len - offset) n = len - offset;
+	return fast_bitstring::hamming_bits(&barray[offset], &that.barray[offset], n);
+}
+
+size_t fast_bitstring_view::to_bytes(byte *bytes, size_t offset, size_t num_bits) const {
+
+	if (offset > blength)
+		offset = blength;
+
+	if (num_bits == 0 || num_bits > blength - offset)
+		num_bits = blength - offset;
+
+	if (!bytes) {
+		return (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
+	}
+
+	return fast_bitstring::pack_bits(bytes, barray + offset, num_bits);
+}
+
+size_t fast_bitstring_view::to_ascii(FILE *f, size_t n, bool csv) const {
+
+	if (!f) f = stdout;
+
+	if (n == ~0 || n > blength) n = blength;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (csv) {
+			fprintf (f, "%u", (unsigned int)barray[i]);
+			if (i < (n - 1)) fputc(',', f);
+		} else
+			fprintf (f, "%u ", (unsigned int)barray[i]);
+	}
+	fprintf(f, "\n");
+
+	fflush(f);
+
+	return n;
+}
+
+int fast_bitstring_view::save(const char *filename, size_t n_bits, save_header *header) const {
+
+	size_t n = 0;
+
+	if (n_bits == 0) n_bits = blength;
+
+	size_t len = fast_bitstring::bit_count_to_byte_count(n_bits);
+	byte *bytes = (byte *)malloc(len);
+	to_bytes(bytes, 0, n_bits);
+
+	unlink(filename);
+	int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0666);
+	if (fd < 1) return errno;
+
+	if (header) n += write(fd, header->bytes, header->length);
+
+	n += write(fd, bytes, len);
+
+	close(fd);
+	free(bytes);
+
+	return n;
+}
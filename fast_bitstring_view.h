@@ -0,0 +1,226 @@
+/*
+ * fast_bitstring_view.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FAST_BITSTRING_VIEW_H
+#define _FAST_BITSTRING_VIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+
+/*
+ * A read-only, non-owning window on bits held one byte per bit elsewhere: a
+ * pointer and a length, so slicing and passing one around costs nothing.
+ *
+ * fast_bitstring is a view that owns its bits, so every read-only method
+ * below works on both and every function taking a view takes a fast_bitstring
+ * as well:
+ *
+ *	fast_bitstring_view header = fbs.slice(0, 64);	// no copy
+ *	if (header.compare(magic) == 0) ...
+ *
+ * A view does not keep its bits alive and is left dangling by anything that
+ * frees or moves them, e.g. resizing or destroying the bitstring it came from.
+ */
+class fast_bitstring_view {
+
+public:
+	typedef unsigned char byte;
+
+	// Bit field orders, see get_uint().
+	typedef enum { MSB_FIRST, LSB_FIRST } BIT_ORDER;
+
+	typedef	struct {
+		size_t length;
+		byte *bytes;
+	} save_header;
+
+	fast_bitstring_view() : blength(0), barray(NULL) {}
+
+	// n bits at bits[0, n), one byte per bit.
+	fast_bitstring_view(const byte *bits, size_t n) : blength(n), barray((byte *)bits) {}
+
+	// bit[offset, offset + n) of v, clipped to v.
+	fast_bitstring_view(const fast_bitstring_view &v, size_t offset, size_t n = ~(size_t)0) {
+		if (offset > v.blength) offset = v.blength;
+		if (n > v.blength - offset) n = v.blength - offset;
+		blength = n;
+		barray = v.barray + offset;
+	}
+
+	inline fast_bitstring_view slice(size_t offset, size_t n = ~(size_t)0) const {
+		return fast_bitstring_view(*this, offset, n);
+	}
+
+	// Length of bit string in bits.
+	inline size_t length() const { return blength; }
+
+	// The bits, one byte per bit.
+	inline const byte *data() const { return barray; }
+
+	inline const byte &operator [](const size_t i) const {
+		return barray[i];
+	}
+
+	// Number of 1 (non-zero) bits in bit[offset, offset + n).
+	size_t count(size_t offset = 0, size_t n = ~(size_t)0) const;
+
+	/*
+	 * Bit pattern search, see fast_bitstring_search.cpp.  Positions are the
+	 * index of the first bit of a match; find() returns length() if there is
+	 * none.  An empty pattern never matches.  Non-overlapping matches are
+	 * taken greedily from the left.
+	 */
+	size_t find(const fast_bitstring_view &pattern, size_t from = 0) const;
+	inline size_t find_next(const fast_bitstring_view &pattern, size_t previous) const { return find(pattern, previous + 1); }
+	size_t find_all(const fast_bitstring_view &pattern, std::vector<size_t> &positions, bool overlapping = true, size_t from = 0) const;
+	size_t count_occurrences(const fast_bitstring_view &pattern, bool overlapping = true) const;
+
+	// Shorter bitstrings order first, then the first differing bit decides.
+	int compare(const fast_bitstring_view &that) const;
+
+	// Index of the first bit at or after offset that differs from that, or the
+	// shorter length if there is none.
+	size_t first_difference(const fast_bitstring_view &that, size_t offset = 0) const;
+
+	// True if this[offset, offset + n) equals that[that_offset, that_offset + n),
+	// false as well if either range runs off the end.
+	bool equal_range(const fast_bitstring_view &that, size_t offset, size_t that_offset, size_t n) const;
+
+	// Number of bits in [offset, offset + n) that differ from that, over the
+	// bits both have.
+	size_t hamming_distance(const fast_bitstring_view &that, size_t offset = 0, size_t n = ~(size_t)0) const;
+
+	// The 8 bits from bit[i] packed into a byte, first bit most significant,
+	// zero filled past the end.
+	byte to_byte(size_t i) const {
+
+		if (i >= blength) return 0;
+
+		const size_t width = blength - i < 8 ? blength - i : 8;
+
+		return get_uint(i, width) << (8 - width);
+	}
+
+	/*
+	 * Bit fields.  A field of width 1 to 64 bits at bit[offset] read as an
+	 * unsigned integer, first bit most significant (MSB_FIRST, the order bits
+	 * are packed in) or least significant (LSB_FIRST).  Any non-zero byte is a
+	 * 1.  Fields must lie within the bitstring.
+	 */
+	inline uint64_t get_uint(size_t offset, size_t width, BIT_ORDER order = MSB_FIRST) const {
+
+		check_field(offset, width);
+
+		const byte *p = &barray[offset];
+		uint64_t v = 0;
+		size_t j = 0;
+
+		// 8 bits at a time, least significant first.
+		for (; j + 8 <= width; j += 8)
+			v |= gather8(&p[j]) << j;
+		if (j < width)
+			v |= gather8_partial(&p[j], width - j) << j;
+
+		return order == LSB_FIRST ? v : bit_reverse(v) >> (64 - width);
+	}
+
+	// count consecutive fields of the same width from bit[offset] into
+	// values[0, count).  See fast_bitstring.cpp.
+	void get_uints(uint64_t *values, size_t offset, size_t width, size_t count, BIT_ORDER order = MSB_FIRST) const;
+
+	// Convert internal byte per bit representation back to bits packed into
+	// the given byte array, starting at bit[offset].
+	size_t to_bytes(byte *bytes, size_t offset=0, size_t num_bits=0) const;
+
+	size_t to_ascii(FILE *f = NULL, size_t n = ~0, bool csv=false) const;
+
+	int save(const char *filename, size_t n_bits = 0, save_header *header=NULL) const;
+
+	size_t run_length_encode(byte **encoding, size_t n_bits = 0) const;
+
+	// Multi-threaded RLE, n_threads = 0 for one thread per core.  Small inputs
+	// are handled on the calling thread.
+	size_t run_length_encode_parallel(byte **encoding, size_t n_threads = 0) const;
+
+	/*
+	 * Executors for the multi-threaded operations.  An executor runs
+	 * fn(0, context) ... fn(n_tasks - 1, context), in any order on any
+	 * threads, and returns once they have all finished; exec_context is its
+	 * own, e.g., a thread pool.  Without one each task gets a thread.
+	 */
+	typedef void (*task_fn)(size_t k, void *context);
+	typedef void (*executor)(size_t n_tasks, task_fn fn, void *context, void *exec_context);
+
+	// Multi-threaded to_bytes(), see fast_bitstring::pack_bits_parallel().
+	size_t to_bytes_parallel(byte *bytes, size_t offset = 0, size_t num_bits = 0, size_t n_threads = 0, executor exec = NULL, void *exec_context = NULL) const;
+
+protected:
+
+	inline void check_field(size_t offset, size_t width) const {
+		if (width == 0 || width > 64 || offset > blength || width > blength - offset)
+			throw "Invalid bit field parameters: width not 1..64 or field past end of bitstring.";
+	}
+
+	static inline uint64_t bit_reverse(uint64_t w) {
+		w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+		w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+		w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+		return __builtin_bswap64(w);
+	}
+
+	// 0x01 in each non-zero byte of w, 0x00 in the others.
+	static inline uint64_t nonzero_bytes(uint64_t w) {
+		const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+		return ((((w & low7) + low7) | w) & ~low7) >> 7;
+	}
+
+	// Bit k set iff p[k] is non-zero, for k < 8: the multiply collects byte k's
+	// 0x01 at bit 56 + k.
+	static inline uint64_t gather8(const byte *p) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		uint64_t w;
+		memcpy(&w, p, 8);
+		return nonzero_bytes(w) * 0x0102040810204080ULL >> 56;
+#else
+		return gather8_partial(p, 8);
+#endif
+	}
+
+	static inline uint64_t gather8_partial(const byte *p, size_t n) {
+		uint64_t v = 0;
+		for (size_t k = 0; k < n; ++k)
+			v |= (uint64_t)(p[k] != 0) << k;
+		return v;
+	}
+
+	// p[k] = bit k of v, for k < n <= 8.  Byte k of v * 0x0101.. is the low byte
+	// of v, masked down to its bit k.
+	static inline void scatter8(byte *p, uint64_t v, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		const uint64_t w = nonzero_bytes(((v & 0xFF) * 0x0101010101010101ULL) & 0x8040201008040201ULL);
+		memcpy(p, &w, n);
+#else
+		for (size_t k = 0; k < n; ++k)
+			p[k] = (v >> k) & 1;
+#endif
+	}
+
+	size_t blength;	// length of bit array, one byte per bit.
+	byte *barray;   // Array of bits, one byte per bit; only a fast_bitstring writes through it.
+};
+
+#endif
@@ -0,0 +1,199 @@
+//
+// fast_packed_bitstring.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "fast_packed_bitstring.h"
+#include "rle_stream.h"
+
+typedef fast_packed_bitstring::word word;
+
+
+// Words are stored in packed byte order, so the first bit of a word is the
+// most significant bit of its first byte.  Loading through big_endian() gives a
+// value whose most significant bit is the word's first bit.
+static inline word big_endian(word w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap64(w);
+#else
+	return w;
+#endif
+}
+
+static inline word bit_reverse(word w) {
+	w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+	w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+	w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	return __builtin_bswap64(w);
+}
+
+
+fast_packed_bitstring::fast_packed_bitstring(const byte *byte_array, const size_t offset_in_bits, const size_t length_in_bits) {
+	allocate(length_in_bits);
+	fast_bitstring::copy_bits(bytes(), byte_array, offset_in_bits, length_in_bits);
+}
+
+fast_packed_bitstring::fast_packed_bitstring(const fast_bitstring_view &f) {
+	allocate(f.length());
+	if (blength) fast_bitstring::pack_bits(bytes(), f.data(), blength);
+}
+
+void fast_packed_bitstring::clear_tail() {
+	if (blength % 64)
+		warray[blength / 64] &= big_endian(~(word)0 << (64 - blength % 64));
+}
+
+void fast_packed_bitstring::set_all(byte val) {
+	memset(warray, val ? 0xFF : 0, n_words() * sizeof(word));
+	clear_tail();
+}
+
+int fast_packed_bitstring::compare(const fast_packed_bitstring &that) const {
+
+	if (this->blength < that.blength)
+		return -1;
+	if (this->blength > that.blength)
+		return 1;
+
+	// Packed bytes in order compare as unsigned bytes exactly as the bits do
+	// one at a time, and the tails past the end are both 0.
+	int c = memcmp(this->warray, that.warray, n_words() * sizeof(word));
+
+	return c < 0 ? -1 : (c > 0 ? 1 : 0);
+}
+
+// Reverse the words end for end and the bits within each, then slide
+// everything back by the padding that has moved from the tail to the head.
+void fast_packed_bitstring::reverse() {
+
+	const size_t n = n_words();
+	size_t i, j;
+
+	if (n == 0) return;
+
+	for (i = 0, j = n - 1; i < j; ++i, --j) {
+		const word a = warray[i];
+		warray[i] = big_endian(bit_reverse(big_endian(warray[j])));
+		warray[j] = big_endian(bit_reverse(big_endian(a)));
+	}
+	if (i == j)
+		warray[i] = big_endian(bit_reverse(big_endian(warray[i])));
+
+	const size_t pad = n * 64 - blength;
+	if (pad) {
+		for (i = 0; i < n; ++i) {
+			word w = big_endian(warray[i]) << pad;
+			if (i + 1 < n) w |= big_endian(warray[i + 1]) >> (64 - pad);
+			warray[i] = big_endian(w);
+		}
+	}
+}
+
+size_t fast_packed_bitstring::to_bytes(byte *bytes, size_t offset, size_t num_bits) const {
+
+	if (offset > blength)
+		offset = blength;
+
+	if (num_bits == 0 || num_bits > blength - offset)
+		num_bits = blength - offset;
+
+	if (!bytes) {
+		return (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
+	}
+
+	return fast_bitstring::copy_bits(bytes, this->bytes(), offset, num_bits);
+}
+
+int fast_packed_bitstring::save(const char *filename, size_t n_bits, fast_bitstring::save_header *header) const {
+
+	size_t n = 0;
+
+	if (n_bits == 0 || n_bits > blength) n_bits = blength;
+
+	const size_t len = fast_bitstring::bit_count_to_byte_count(n_bits);
+
+	// The stored bytes can be written as they are unless the last is partial.
+	byte *b = bytes();
+	if (n_bits < blength) {
+		b = (byte *)malloc(len);
+		to_bytes(b, 0, n_bits);
+	}
+
+	unlink(filename);
+	int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0666);
+	if (fd < 0) {
+		if (b != bytes()) free(b);
+		return errno;
+	}
+
+	if (header) n += write(fd, header->bytes, header->length);
+
+	n += write(fd, b, len);
+
+	close(fd);
+	if (b != bytes()) free(b);
+
+	return n;
+}
+
+size_t fast_packed_bitstring::run_length_encode(byte **encoding, size_t n_bits) const {
+
+	if (blength == 0) {
+		if (encoding) *encoding = NULL;
+		return 0;
+	}
+
+	if (n_bits == 0 || n_bits > blength) n_bits = blength;
+
+	// Same bound as fast_bitstring::run_length_encode().
+	if (!encoding) return 3 + (2 * blength + 4) / 5;
+
+	rle_encoder enc;
+	byte *rle_bytes = (byte *)malloc(rle_encoder::max_encoded_length(n_bits) + rle_encoder::MAX_FINISH_LENGTH);
+
+	size_t b = enc.encode_packed(bytes(), 0, n_bits, rle_bytes);
+	b += enc.finish(&rle_bytes[b]);
+
+	*encoding = rle_bytes;
+
+	return b;
+}
+
+// Pack each decoded chunk into place.  Chunks need not start on a byte
+// boundary, so the head of a chunk is set a bit at a time up to the next one.
+static int pack_chunk(const fast_bitstring::byte *bits, size_t offset_in_bits, size_t n_bits, void *context) {
+
+	fast_packed_bitstring &dst = *(fast_packed_bitstring *)context;
+	size_t i = 0;
+
+	for (; i < n_bits && (offset_in_bits + i) % 8; ++i)
+		dst[offset_in_bits + i] = bits[i];
+
+	fast_bitstring::pack_bits(&dst.bytes()[(offset_in_bits + i) / 8], &bits[i], n_bits - i);
+
+	return 0;
+}
+
+fast_packed_bitstring *fast_packed_bitstring::run_length_decode(const byte *rle_bytes, const size_t num_bytes) {
+
+	const size_t n_bits = fast_bitstring::run_length_decoded_length(rle_bytes, num_bytes);
+	fast_packed_bitstring *decoded = new fast_packed_bitstring(n_bits, fast_bitstring::FROM_BITS);
+
+	try {
+		rle_decoder dec(pack_chunk, decoded);
+		dec.decode(rle_bytes, num_bytes);
+		dec.finish();
+	} catch (...) {
+		delete decoded;
+		throw;
+	}
+
+	return decoded;
+}
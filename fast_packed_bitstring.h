@@ -0,0 +1,146 @@
+/*
+ * fast_packed_bitstring.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FAST_PACKED_BITSTRING_H
+#define _FAST_PACKED_BITSTRING_H
+
+#include <stdint.h>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * The packed sibling of fast_bitstring: 1 bit per bit rather than 1 byte per
+ * bit, for when the 8x memory of the exploded form does not fit.
+ *
+ * Storage is whole 64 bit words holding the bits in the same order as the
+ * packed byte arrays fast_bitstring is built from and saved to, i.e., bit i is
+ * bit (7 - i % 8) of byte i / 8.  So to_bytes(), save(), RLE and conversion
+ * to and from the exploded form are straight copies or a single explode/pack
+ * pass, while bulk operations run a word at a time.  Bits past the end of the
+ * string are kept 0.
+ */
+class fast_packed_bitstring {
+
+public:
+	typedef fast_bitstring::byte byte;
+	typedef uint64_t word;
+
+	// operator[] for a non-const string returns a reference to one bit.
+	class bit_reference {
+		friend class fast_packed_bitstring;
+
+		byte *p;
+		byte mask;
+
+		bit_reference(byte *p, byte mask) : p(p), mask(mask) {}
+
+	public:
+		inline operator byte() const { return (*p & mask) ? 1 : 0; }
+
+		inline bit_reference &operator =(const byte b) {
+			if (b) *p |= mask; else *p &= ~mask;
+			return *this;
+		}
+
+		inline bit_reference &operator =(const bit_reference &b) {
+			return *this = (byte)b;
+		}
+	};
+
+	// Construct bit array of all zero bits.
+	fast_packed_bitstring(const size_t length, const fast_bitstring::BIT_SOURCE bit_source = fast_bitstring::FROM_BYTES) {
+		allocate(bit_source == fast_bitstring::FROM_BYTES ? length * 8 : length);
+	}
+
+	// Construct bit array from given bit string packed in byte_array.
+	fast_packed_bitstring(const byte *byte_array, const size_t length_in_bytes) {
+		allocate(length_in_bytes * 8);
+		memcpy(warray, byte_array, length_in_bytes);
+	}
+
+	// Construct bit array from given bit string packed in byte_array, skipping the first "offset_in_bits" bits.
+	fast_packed_bitstring(const byte *byte_array, const size_t offset_in_bits, const size_t length_in_bits);
+
+	// Pack an exploded fast_bitstring or view.
+	explicit fast_packed_bitstring(const fast_bitstring_view &f);
+
+	fast_packed_bitstring(const fast_packed_bitstring &f) {
+		allocate(f.blength);
+		memcpy(warray, f.warray, n_words() * sizeof(word));
+	}
+
+	~fast_packed_bitstring() {
+		free(warray);
+		warray = NULL;
+		blength = 0;
+	}
+
+	// Explode into a new fast_bitstring owned by the caller.
+	fast_bitstring *to_fast_bitstring() const {
+		return new fast_bitstring(bytes(), 0, blength);
+	}
+
+	// Length of bit string in bits.
+	inline size_t length() const { return blength; }
+
+	inline void clear() { memset(warray, 0, n_words() * sizeof(word)); }
+
+	void set_all(byte val = 1);
+
+	// Array opperator to access bit[i].
+	inline bit_reference operator [](const size_t i) {
+		return bit_reference(&bytes()[i / 8], 0x80 >> (i % 8));
+	}
+
+	inline byte operator [](const size_t i) const {
+		return (bytes()[i / 8] >> (7 - i % 8)) & 1;
+	}
+
+	// Same ordering as fast_bitstring::compare(): by length, then bit by bit.
+	int compare(const fast_packed_bitstring &that) const;
+
+	void reverse();
+
+	// Copy bits [offset, offset + num_bits) packed into bytes.  Returns the
+	// number of bytes, as fast_bitstring::to_bytes() does.
+	size_t to_bytes(byte *bytes, size_t offset = 0, size_t num_bits = 0) const;
+
+	int save(const char *filename, size_t n_bits = 0, fast_bitstring::save_header *header = NULL) const;
+
+	// The same adaptive RLE as fast_bitstring, byte for byte.
+	size_t run_length_encode(byte **encoding, size_t n_bits = 0) const;
+
+	static fast_packed_bitstring *run_length_decode(const byte *rle_bytes, const size_t num_bytes);
+
+	// The bits as packed bytes, and as words.
+	inline byte *bytes() const { return (byte *)warray; }
+	inline word *words() const { return warray; }
+	inline size_t n_words() const { return (blength + 63) / 64; }
+
+private:
+	fast_packed_bitstring &operator =(const fast_packed_bitstring &);
+
+	void allocate(size_t n_bits) {
+		blength = n_bits;
+		// Always at least one word so bytes() is never NULL.
+		warray = (word *)calloc(n_words() ? n_words() : 1, sizeof(word));
+	}
+
+	// Zero the bits past the end of the string in the last word.
+	void clear_tail();
+
+	size_t blength;		// length of bit array in bits.
+	word *warray;		// Array of bits, 64 per word.
+};
+
+#endif
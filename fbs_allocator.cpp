@@ -0,0 +1,313 @@
+//
+// fbs_allocator.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "fbs_allocator.h"
+
+
+void *fbs_allocator::allocate_zeroed(size_t n) {
+
+	void *p = allocate(n);
+	if (p) memset(p, 0, n);
+
+	return p;
+}
+
+void *fbs_allocator::reallocate(void *p, size_t old_n, size_t new_n) {
+
+	void *q = allocate(new_n);
+	if (p && q) memcpy(q, p, old_n < new_n ? old_n : new_n);
+	release(p, old_n);
+
+	return q;
+}
+
+
+//
+// malloc()
+//
+
+class standard_allocator : public fbs_allocator {
+
+public:
+	void *allocate(size_t n) {
+		if (n == 0) return NULL;
+		void *p = malloc(n);
+		if (!p) throw "Out of memory for fast bitstring.";
+		return p;
+	}
+
+	void *allocate_zeroed(size_t n) {
+		if (n == 0) return NULL;
+		void *p = calloc(n, 1);
+		if (!p) throw "Out of memory for fast bitstring.";
+		return p;
+	}
+
+	void *reallocate(void *p, size_t old_n, size_t new_n) {
+		if (new_n == 0) {
+			free(p);
+			return NULL;
+		}
+		void *q = realloc(p, new_n);
+		if (!q) throw "Out of memory for fast bitstring.";
+		return q;
+	}
+
+	void release(void *p, size_t n) {
+		free(p);
+	}
+};
+
+
+//
+// Cache line alignment.
+//
+
+class aligned_allocator : public fbs_allocator {
+
+public:
+	void *allocate(size_t n) {
+		void *p;
+		if (n == 0) return NULL;
+		if (posix_memalign(&p, ALIGNMENT, n) != 0) throw "Out of memory for fast bitstring.";
+		return p;
+	}
+
+	void release(void *p, size_t n) {
+		free(p);
+	}
+};
+
+
+//
+// Transparent huge pages.
+//
+
+static inline size_t huge_page_round(size_t n) {
+	return (n + fbs_allocator::HUGE_PAGE_BYTES - 1) & ~(fbs_allocator::HUGE_PAGE_BYTES - 1);
+}
+
+class huge_page_allocator : public fbs_allocator {
+
+public:
+	// Map a huge page more than needed and trim both ends to a huge page
+	// boundary so the whole range can be backed by huge pages.
+	void *allocate(size_t n) {
+
+		if (n == 0) return NULL;
+
+		// Past this the rounding and the extra huge page wrap around.
+		if (n > ~(size_t)0 - 2 * HUGE_PAGE_BYTES) throw "Out of memory for fast bitstring.";
+
+		const size_t len = huge_page_round(n);
+		void *m = mmap(NULL, len + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m == MAP_FAILED) throw "Out of memory for fast bitstring.";
+
+		char *p = (char *)(((size_t)m + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1));
+		if (p > (char *)m) munmap(m, p - (char *)m);
+		munmap(p + len, (char *)m + HUGE_PAGE_BYTES - p);
+
+#ifdef MADV_HUGEPAGE
+		madvise(p, len, MADV_HUGEPAGE);
+#endif
+
+		return p;
+	}
+
+	// Fresh anonymous pages are already zero.
+	void *allocate_zeroed(size_t n) {
+		return allocate(n);
+	}
+
+	void *reallocate(void *p, size_t old_n, size_t new_n) {
+		// The rounding leaves room to grow in place.
+		if (p && new_n && huge_page_round(new_n) == huge_page_round(old_n))
+			return p;
+		return fbs_allocator::reallocate(p, old_n, new_n);
+	}
+
+	void release(void *p, size_t n) {
+		if (p) munmap(p, huge_page_round(n));
+	}
+};
+
+
+//
+// Per thread pools.
+//
+// Each thread keeps a short free list per power of 2 size class, linked
+// through the first word of each free block.  Blocks are plain aligned
+// allocations, so one freed on another thread simply joins that thread's
+// pool.  A thread's pools are emptied when it exits; anything released after
+// that is freed directly.
+//
+
+#define ARENA_MIN_SHIFT 6		// 64 byte smallest class.
+#define ARENA_MAX_SHIFT 16		// ARENA_MAX_BYTES.
+#define ARENA_CLASSES (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+#define ARENA_MAX_FREE 32		// Blocks kept per class.
+
+typedef struct {
+	void *head[ARENA_CLASSES];
+	size_t n_free[ARENA_CLASSES];
+	bool closed;
+} arena_pools;
+
+static __thread arena_pools pools;
+
+class arena_cleaner {
+public:
+	~arena_cleaner() {
+		for (int c = 0; c < ARENA_CLASSES; ++c) {
+			while (pools.head[c]) {
+				void *p = pools.head[c];
+				pools.head[c] = *(void **)p;
+				free(p);
+			}
+			pools.n_free[c] = 0;
+		}
+		pools.closed = true;
+	}
+};
+
+static thread_local arena_cleaner cleaner;
+
+static inline int size_class(size_t n) {
+	int c = 0;
+	while (((size_t)1 << (c + ARENA_MIN_SHIFT)) < n) ++c;
+	return c;
+}
+
+class arena_allocator : public fbs_allocator {
+
+public:
+	void *allocate(size_t n) {
+
+		if (n == 0) return NULL;
+		if (n > ARENA_MAX_BYTES) return fbs_allocator::aligned()->allocate(n);
+
+		const int c = size_class(n);
+		if (pools.head[c]) {
+			void *p = pools.head[c];
+			pools.head[c] = *(void **)p;
+			--pools.n_free[c];
+			return p;
+		}
+
+		// Touch the cleaner so it is constructed, and so destroyed, with the thread.
+		if (!pools.closed) (void)&cleaner;
+
+		return fbs_allocator::aligned()->allocate((size_t)1 << (c + ARENA_MIN_SHIFT));
+	}
+
+	void *reallocate(void *p, size_t old_n, size_t new_n) {
+		if (p && new_n && old_n <= ARENA_MAX_BYTES && new_n <= ARENA_MAX_BYTES && size_class(old_n) == size_class(new_n))
+			return p;
+		return fbs_allocator::reallocate(p, old_n, new_n);
+	}
+
+	void release(void *p, size_t n) {
+
+		if (!p) return;
+
+		if (n <= ARENA_MAX_BYTES && !pools.closed) {
+			const int c = size_class(n);
+			if (pools.n_free[c] < ARENA_MAX_FREE) {
+				// This thread may never have allocated, so may not have a
+				// cleaner yet to empty the pool when it exits.
+				(void)&cleaner;
+				*(void **)p = pools.head[c];
+				pools.head[c] = p;
+				++pools.n_free[c];
+				return;
+			}
+		}
+
+		free(p);
+	}
+};
+
+
+//
+// By size.
+//
+
+class automatic_allocator : public fbs_allocator {
+
+public:
+	void *allocate(size_t n) {
+		return choose(n)->allocate(n);
+	}
+
+	void *allocate_zeroed(size_t n) {
+		return choose(n)->allocate_zeroed(n);
+	}
+
+	void *reallocate(void *p, size_t old_n, size_t new_n) {
+		if (choose(old_n) == choose(new_n))
+			return choose(new_n)->reallocate(p, old_n, new_n);
+		return fbs_allocator::reallocate(p, old_n, new_n);
+	}
+
+	void release(void *p, size_t n) {
+		choose(n)->release(p, n);
+	}
+
+private:
+	static fbs_allocator *choose(size_t n) {
+		if (n <= ARENA_MAX_BYTES) return thread_arena();
+		if (n >= HUGE_PAGE_MIN_BYTES) return huge_pages();
+		return aligned();
+	}
+};
+
+
+// Made on first use and never destroyed, so bitstrings constructed or
+// destroyed by other translation units' static objects are safe.
+fbs_allocator *fbs_allocator::standard() {
+	static fbs_allocator *a = new standard_allocator;
+	return a;
+}
+
+fbs_allocator *fbs_allocator::aligned() {
+	static fbs_allocator *a = new aligned_allocator;
+	return a;
+}
+
+fbs_allocator *fbs_allocator::huge_pages() {
+	static fbs_allocator *a = new huge_page_allocator;
+	return a;
+}
+
+fbs_allocator *fbs_allocator::thread_arena() {
+	static fbs_allocator *a = new arena_allocator;
+	return a;
+}
+
+fbs_allocator *fbs_allocator::automatic() {
+	static fbs_allocator *a = new automatic_allocator;
+	return a;
+}
+
+static fbs_allocator *default_allocator = NULL;
+
+fbs_allocator *fbs_allocator::get_default() {
+	return default_allocator ? default_allocator : automatic();
+}
+
+void fbs_allocator::set_default(fbs_allocator *allocator) {
+	default_allocator = allocator;
+}
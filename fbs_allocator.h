@@ -0,0 +1,71 @@
+/*
+ * fbs_allocator.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FBS_ALLOCATOR_H
+#define _FBS_ALLOCATOR_H
+
+#include <stddef.h>
+
+/*
+ * Storage policy for the bit arrays of fast_bitstrings.
+ *
+ * Every bitstring allocates, grows and frees its array through one of these,
+ * given at construction or else the process wide default.  Sizes are passed
+ * back on release so pools need no headers.  Ready made policies:
+ *
+ *	standard()	malloc(), realloc() and free(), as bitstrings always used.
+ *	aligned()	64 byte, i.e. cache line and AVX-512, aligned arrays.
+ *	huge_pages()	2MB aligned anonymous mappings advised MADV_HUGEPAGE, so
+ *			large arrays are covered by transparent huge pages and
+ *			start out zero without being touched.
+ *	thread_arena()	Per thread pools of power of 2 size classes up to
+ *			ARENA_MAX_BYTES for small and short lived bitstrings;
+ *			anything larger is passed on to aligned().  Arrays may be
+ *			freed on any thread.
+ *	automatic()	thread_arena() up to ARENA_MAX_BYTES, huge_pages() from
+ *			HUGE_PAGE_MIN_BYTES and aligned() in between.  The default.
+ */
+class fbs_allocator {
+
+public:
+	static const size_t ALIGNMENT = 64;
+	static const size_t ARENA_MAX_BYTES = 1 << 16;
+	static const size_t HUGE_PAGE_MIN_BYTES = 1 << 22;
+	static const size_t HUGE_PAGE_BYTES = 1 << 21;
+
+	virtual ~fbs_allocator() {}
+
+	// n bytes of uninitialized memory, or NULL for n == 0.  Throws on failure.
+	virtual void *allocate(size_t n) = 0;
+
+	// As allocate() but zero filled.
+	virtual void *allocate_zeroed(size_t n);
+
+	// Grow or shrink p from old_n to new_n bytes, keeping the contents up to
+	// the smaller of the two.
+	virtual void *reallocate(void *p, size_t old_n, size_t new_n);
+
+	// Free p, which was allocated with n bytes.  NULL is ignored.
+	virtual void release(void *p, size_t n) = 0;
+
+	static fbs_allocator *standard();
+	static fbs_allocator *aligned();
+	static fbs_allocator *huge_pages();
+	static fbs_allocator *thread_arena();
+	static fbs_allocator *automatic();
+
+	// Policy used by bitstrings constructed without one.
+	static fbs_allocator *get_default();
+	static void set_default(fbs_allocator *allocator);
+};
+
+#endif
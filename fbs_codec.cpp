@@ -0,0 +1,492 @@
+//
+// fbs_codec.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "fbs_codec.h"
+
+typedef fbs_codec::byte byte;
+
+// Longest varint of a 64 bit value.
+#define MAX_VARINT 10
+
+// Codec selection samples this many windows of SAMPLE_BITS bits per block.
+#define SAMPLES 16
+#define SAMPLE_BITS 1024
+
+// Rough decode cost, in ns, of a packed RAW byte, an RLE byte and a SPARSE
+// position, over and above writing the bits out, for the FASTEST goal.
+// Measured on an AVX-512 x86: RLE guide bytes and sparse gaps are branchy.
+#define RAW_BYTE_COST 0.25
+#define RLE_BYTE_COST 8.0
+#define SPARSE_BIT_COST 5.0
+
+
+static inline size_t put_varint(byte *out, uint64_t v) {
+	size_t b = 0;
+	while (v >= 0x80) {
+		out[b++] = (byte)(v | 0x80);
+		v >>= 7;
+	}
+	out[b++] = (byte)v;
+	return b;
+}
+
+// Read a varint from in[*b], in being n bytes long, and step *b past it.
+static inline uint64_t get_varint(const byte *in, size_t n, size_t *b) {
+	uint64_t v = 0;
+	for (unsigned int shift = 0; shift < 7 * MAX_VARINT; shift += 7) {
+		if (*b >= n) throw "Truncated fbs_codec encoding.";
+		const byte c = in[(*b)++];
+		v |= (uint64_t)(c & 0x7F) << shift;
+		if (!(c & 0x80)) return v;
+	}
+	throw "Corrupt fbs_codec encoding: varint too long.";
+}
+
+static inline size_t varint_length(uint64_t v) {
+	size_t n = 1;
+	while (v >= 0x80) {
+		v >>= 7;
+		++n;
+	}
+	return n;
+}
+
+static inline size_t raw_length(size_t n_bits) {
+	return (n_bits + 7) / 8;
+}
+
+
+//
+// Block codecs.
+//
+
+// Extended RLE: runs of 9 to 127 bits and verbatim blocks as in
+// run_length_encode(), longer runs as guide byte 0 and a varint.
+static size_t rle_encode(const byte *bits, size_t n, byte *out, size_t limit) {
+
+	size_t b = 0;		// Bytes written.
+	size_t v = 0;		// Number of pending verbatim bits...
+	size_t vs = 0;		// ...starting at bits[vs].
+
+	for (size_t i = 0, run; i < n; i += run) {
+
+		run = fast_bitstring::scan_run(&bits[i], n - i);
+
+		if (run > 8) {
+			if (v) {
+				out[b++] = 128;
+				out[b++] = (byte)(v - 1);
+				b += fast_bitstring::pack_bits(&out[b], &bits[vs], v);
+				v = 0;
+			}
+			if (run < 128) {
+				out[b++] = (byte)(run + (bits[i] ? 128 : 0));
+			} else {
+				out[b++] = 0;
+				b += put_varint(&out[b], (uint64_t)run << 1 | (bits[i] != 0));
+			}
+		} else {
+			if (v == 0) vs = i;
+			v += run;
+			if (v >= 256) {
+				out[b++] = 128;
+				out[b++] = 255;
+				b += fast_bitstring::pack_bits(&out[b], &bits[vs], 256);
+				vs += 256;
+				v -= 256;
+			}
+		}
+
+		if (b > limit) return ~(size_t)0;
+	}
+
+	if (v) {
+		out[b++] = 128;
+		out[b++] = (byte)(v - 1);
+		b += fast_bitstring::pack_bits(&out[b], &bits[vs], v);
+	}
+
+	return b > limit ? ~(size_t)0 : b;
+}
+
+static void rle_decode(const byte *in, size_t num_bytes, byte *bits, size_t n) {
+
+	size_t b = 0, v = 0, nvb;
+
+	while (b < num_bytes) {
+		const byte g = in[b++];
+		if (g == 128) {
+			if (b >= num_bytes) throw "Truncated fbs_codec encoding.";
+			nvb = in[b++] + 1;
+			const size_t stride = raw_length(nvb);
+			if (num_bytes - b < stride) throw "Truncated fbs_codec encoding.";
+			if (nvb > n - v) throw "Corrupt fbs_codec encoding: block overruns its length.";
+			fast_bitstring::explode_bits(&bits[v], &in[b], 0, nvb);
+			b += stride;
+		} else if (g == 0) {
+			const uint64_t w = get_varint(in, num_bytes, &b);
+			nvb = w >> 1;
+			if (nvb > n - v) throw "Corrupt fbs_codec encoding: block overruns its length.";
+			memset(&bits[v], w & 1, nvb);
+		} else {
+			nvb = g & 0x7F;
+			if (nvb > n - v) throw "Corrupt fbs_codec encoding: block overruns its length.";
+			memset(&bits[v], g >> 7, nvb);
+		}
+		v += nvb;
+	}
+
+	if (v != n) throw "Corrupt fbs_codec encoding: block short of its length.";
+}
+
+// Index of the first bit at or after from with the given value, any non-zero
+// byte being a 1, or n if there is none.
+static size_t next_bit(const byte *bits, size_t from, size_t n, byte value) {
+
+	if (!value) {
+		const byte *p = (const byte *)memchr(&bits[from], 0, n - from);
+		return p ? p - bits : n;
+	}
+
+	uint64_t w;
+	for (; from + 8 <= n; from += 8) {
+		memcpy(&w, &bits[from], 8);
+		if (w) break;
+	}
+	while (from < n && !bits[from])
+		++from;
+
+	return from;
+}
+
+// Sparse: the minority bit value, how many of it there are and the gap before each.
+static size_t sparse_encode(const byte *bits, size_t n, byte *out, size_t limit) {
+
+	const size_t ones = fast_bitstring::count_bits(bits, n);
+	const byte value = ones <= n - ones ? 1 : 0;
+	const size_t m = value ? ones : n - ones;
+
+	size_t b = 0;
+	out[b++] = value;
+	b += put_varint(&out[b], m);
+
+	for (size_t k = 0, next = 0; k < m; ++k) {
+		if (b > limit) return ~(size_t)0;
+		const size_t pos = next_bit(bits, next, n, value);
+		assert(pos < n);
+		b += put_varint(&out[b], pos - next);
+		next = pos + 1;
+	}
+
+	return b > limit ? ~(size_t)0 : b;
+}
+
+static void sparse_decode(const byte *in, size_t num_bytes, byte *bits, size_t n) {
+
+	size_t b = 0;
+
+	if (num_bytes == 0) throw "Truncated fbs_codec encoding.";
+	const byte value = in[b++];
+	if (value > 1) throw "Corrupt fbs_codec encoding: bad sparse bit value.";
+
+	const uint64_t m = get_varint(in, num_bytes, &b);
+	if (m > n) throw "Corrupt fbs_codec encoding: block overruns its length.";
+
+	memset(bits, !value, n);
+
+	for (size_t k = 0, next = 0; k < m; ++k) {
+		const uint64_t gap = get_varint(in, num_bytes, &b);
+		if (gap >= n - next) throw "Corrupt fbs_codec encoding: block overruns its length.";
+		bits[next + gap] = value;
+		next += gap + 1;
+	}
+
+	if (b != num_bytes) throw "Corrupt fbs_codec encoding: trailing sparse bytes.";
+}
+
+size_t fbs_codec::encode_block(CODEC codec, const byte *bits, size_t n, byte *out, size_t limit) {
+
+	switch (codec) {
+	case RAW:
+		if (raw_length(n) > limit) return ~(size_t)0;
+		return n ? fast_bitstring::pack_bits(out, bits, n) : 0;
+	case RLE:
+		return rle_encode(bits, n, out, limit);
+	case SPARSE:
+		return sparse_encode(bits, n, out, limit);
+	default:
+		throw "Unknown fbs_codec codec.";
+	}
+}
+
+void fbs_codec::decode_block(CODEC codec, const byte *payload, size_t num_bytes, byte *bits, size_t n) {
+
+	switch (codec) {
+	case RAW:
+		if (num_bytes != raw_length(n)) throw "Corrupt fbs_codec encoding: bad raw block length.";
+		fast_bitstring::explode_bits(bits, payload, 0, n);
+		break;
+	case RLE:
+		rle_decode(payload, num_bytes, bits, n);
+		break;
+	case SPARSE:
+		sparse_decode(payload, num_bytes, bits, n);
+		break;
+	default:
+		throw "Unknown fbs_codec codec.";
+	}
+}
+
+
+//
+// Codec selection.
+//
+// SPARSE is costed from an exact count of the minority bit value, assuming
+// evenly spread gaps.  RLE is costed by encoding SAMPLES evenly spaced
+// windows of the block and scaling up; any window that RLE would not shrink
+// rules it out.  Small blocks are encoded whole.
+//
+fbs_codec::CODEC fbs_codec::choose(const byte *bits, size_t n, GOAL goal) {
+
+	if (n == 0) return RAW;
+
+	const size_t raw = raw_length(n);
+
+	const size_t ones = fast_bitstring::count_bits(bits, n);
+	const size_t m = ones < n - ones ? ones : n - ones;
+	const size_t sparse = 1 + varint_length(m) + m * varint_length(m ? n / m : 0);
+
+	byte scratch[SAMPLES * SAMPLE_BITS / 8 + SLACK];
+	size_t rle;
+
+	if (n <= SAMPLES * SAMPLE_BITS) {
+		rle = rle_encode(bits, n, scratch, raw);
+	} else {
+		size_t sampled = 0;
+		for (size_t k = 0; k < SAMPLES && sampled != ~(size_t)0; ++k) {
+			const size_t first = k * (n - SAMPLE_BITS) / (SAMPLES - 1);
+			const size_t b = rle_encode(&bits[first], SAMPLE_BITS, scratch, SAMPLE_BITS / 8);
+			sampled = b == ~(size_t)0 ? b : sampled + b;
+		}
+		rle = sampled == ~(size_t)0 ? sampled : (size_t)((double)sampled * n / (SAMPLES * SAMPLE_BITS));
+	}
+
+	if (goal == FASTEST) {
+		const double raw_cost = (double)raw * RAW_BYTE_COST;
+		const double rle_cost = rle < raw ? (double)rle * RLE_BYTE_COST : raw_cost;
+		const double sparse_cost = sparse < raw ? (double)m * SPARSE_BIT_COST : raw_cost;
+
+		if (sparse_cost < raw_cost && sparse_cost <= rle_cost) return SPARSE;
+		if (rle_cost < raw_cost) return RLE;
+		return RAW;
+	}
+
+	if (sparse < raw && sparse < rle) return SPARSE;
+	if (rle < raw) return RLE;
+	return RAW;
+}
+
+const char *fbs_codec::codec_name(CODEC codec) {
+
+	switch (codec) {
+	case RAW:	return "raw";
+	case RLE:	return "rle";
+	case SPARSE:	return "sparse";
+	default:	return "unknown";
+	}
+}
+
+
+//
+// Container.
+//
+
+// True if every byte of bits[0, n) is 0 or 1.
+static bool canonical(const byte *bits, size_t n) {
+
+	uint64_t w, high = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, &bits[i], 8);
+		high |= w;
+	}
+	for (; i < n; ++i)
+		high |= bits[i];
+
+	return (high & 0xFEFEFEFEFEFEFEFEULL) == 0;
+}
+
+size_t fbs_codec::encode_blocks(const fast_bitstring_view &bits, byte **encoding, CODEC codec, GOAL goal, size_t block_bits) {
+
+	if (block_bits == 0) throw "Invalid fbs_codec block size: 0 bits.";
+
+	const size_t n = bits.length();
+	const size_t n_blocks = (n + block_bits - 1) / block_bits;
+
+	// Room for every block stored RAW, the last one being encoded just past
+	// its header and overshooting by up to SLACK.
+	const size_t capacity = 2 + 2 * MAX_VARINT + n_blocks * (2 + MAX_VARINT) + raw_length(n) + SLACK;
+
+	byte *out = (byte *)malloc(capacity);
+	size_t b = 0;
+
+	out[b++] = MAGIC;
+	out[b++] = VERSION;
+	b += put_varint(&out[b], n);
+	b += put_varint(&out[b], block_bits);
+
+	std::vector<byte> scratch;
+
+	for (size_t first = 0; first < n; first += block_bits) {
+
+		const byte *block = bits.data() + first;
+		const size_t nb = n - first < block_bits ? n - first : block_bits;
+		const size_t raw = raw_length(nb);
+
+		// Any non-zero byte is a 1, but pack_bits() takes the low bit of each
+		// byte, so blocks with other bytes are encoded from a copy of 0's and 1's.
+		if (!canonical(block, nb)) {
+			scratch.resize(nb);
+			for (size_t i = 0; i < nb; ++i)
+				scratch[i] = block[i] != 0;
+			block = &scratch[0];
+		}
+
+		CODEC c = codec == N_CODECS ? choose(block, nb, goal) : codec;
+
+		// Encode after the largest possible block header, then close up the gap.
+		byte *payload = &out[b + 1 + MAX_VARINT];
+		size_t len = c == RAW ? ~(size_t)0 : encode_block(c, block, nb, payload, raw);
+		if (len == ~(size_t)0) {
+			c = RAW;
+			len = encode_block(c, block, nb, payload, raw);
+		}
+
+		out[b++] = (byte)c;
+		const size_t h = put_varint(&out[b], len);
+		memmove(&out[b + h], payload, len);
+		b += h + len;
+	}
+
+	assert(b <= capacity);
+
+	*encoding = (byte *)realloc(out, b);
+
+	return b;
+}
+
+size_t fbs_codec::encode(const fast_bitstring_view &bits, byte **encoding, GOAL goal, size_t block_bits) {
+	return encode_blocks(bits, encoding, N_CODECS, goal, block_bits);
+}
+
+size_t fbs_codec::encode_with(const fast_bitstring_view &bits, byte **encoding, CODEC codec, size_t block_bits) {
+	if (codec >= N_CODECS) throw "Unknown fbs_codec codec.";
+	return encode_blocks(bits, encoding, codec, SMALLEST, block_bits);
+}
+
+// Check the header and step *b past it, returning the number of bits and
+// setting *block_bits.
+static size_t read_header(const byte *encoding, size_t num_bytes, size_t *b, size_t *block_bits) {
+
+	if (num_bytes < 2 || encoding[0] != fbs_codec::MAGIC) throw "Not an fbs_codec encoding.";
+	if (encoding[1] != fbs_codec::VERSION) throw "Unsupported fbs_codec version.";
+
+	*b = 2;
+	const size_t n = get_varint(encoding, num_bytes, b);
+	*block_bits = get_varint(encoding, num_bytes, b);
+	if (*block_bits == 0) throw "Corrupt fbs_codec encoding: 0 bit blocks.";
+
+	return n;
+}
+
+size_t fbs_codec::decoded_length(const byte *encoding, size_t num_bytes) {
+	size_t b, block_bits;
+	return read_header(encoding, num_bytes, &b, &block_bits);
+}
+
+// Walk the table of blocks for n bits from encoding[b], noting each codec in
+// codecs if given, and return the offset just past it.
+static size_t walk_blocks(const byte *encoding, size_t num_bytes, size_t b, size_t n, size_t block_bits, std::vector<fbs_codec::CODEC> *codecs) {
+
+	for (size_t first = 0; first < n; first += block_bits) {
+		if (b >= num_bytes) throw "Truncated fbs_codec encoding.";
+		if (codecs) codecs->push_back((fbs_codec::CODEC)encoding[b]);
+		++b;
+		const size_t len = get_varint(encoding, num_bytes, &b);
+		if (len > num_bytes - b) throw "Truncated fbs_codec encoding.";
+		b += len;
+		if (block_bits > n - first) break;
+	}
+
+	return b;
+}
+
+std::vector<fbs_codec::CODEC> fbs_codec::block_codecs(const byte *encoding, size_t num_bytes) {
+
+	size_t b, block_bits;
+	const size_t n = read_header(encoding, num_bytes, &b, &block_bits);
+	std::vector<CODEC> codecs;
+
+	walk_blocks(encoding, num_bytes, b, n, block_bits, &codecs);
+
+	return codecs;
+}
+
+size_t fbs_codec::decode_into(const byte *encoding, size_t num_bytes, byte *bits, size_t max_bits) {
+
+	size_t b, block_bits;
+	const size_t n = read_header(encoding, num_bytes, &b, &block_bits);
+
+	if (n > max_bits) throw "fbs_codec decoding overruns destination.";
+
+	for (size_t first = 0; first < n; first += block_bits) {
+
+		const size_t nb = n - first < block_bits ? n - first : block_bits;
+
+		if (b >= num_bytes) throw "Truncated fbs_codec encoding.";
+		const CODEC c = (CODEC)encoding[b++];
+		const size_t len = get_varint(encoding, num_bytes, &b);
+		if (len > num_bytes - b) throw "Truncated fbs_codec encoding.";
+
+		decode_block(c, &encoding[b], len, &bits[first], nb);
+		b += len;
+		if (block_bits > n - first) break;
+	}
+
+	if (b != num_bytes) throw "Corrupt fbs_codec encoding: trailing bytes.";
+
+	return n;
+}
+
+fast_bitstring *fbs_codec::decode(const byte *encoding, size_t num_bytes) {
+
+	size_t b, block_bits;
+	const size_t n = read_header(encoding, num_bytes, &b, &block_bits);
+
+	// The header is not to be trusted with the allocation until the block
+	// table it implies is found to fill the encoding exactly.
+	if (walk_blocks(encoding, num_bytes, b, n, block_bits, NULL) != num_bytes)
+		throw "Corrupt fbs_codec encoding: trailing bytes.";
+
+	// Every bit is written by the block decoders.
+	fast_bitstring *fbs = new fast_bitstring(n, fast_bitstring::FROM_BITS, fast_bitstring::NO_FILL);
+
+	try {
+		decode_into(encoding, num_bytes, n ? &(*fbs)[0] : NULL, n);
+	} catch (...) {
+		delete fbs;
+		throw;
+	}
+
+	return fbs;
+}
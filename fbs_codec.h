@@ -0,0 +1,106 @@
+/*
+ * fbs_codec.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FBS_CODEC_H
+#define _FBS_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * Versioned block codec container.
+ *
+ * The adaptive RLE format of run_length_encode() spends a byte per 127 bit
+ * run, so long runs cost far more than they need to, and does badly on data
+ * with isolated set bits.  This format cuts the bits into blocks and encodes
+ * each with whichever codec suits it, chosen from a cheap sampling pass:
+ *
+ *	RAW	The bits packed, 8 to a byte.
+ *	RLE	Adaptive RLE with run lengths extended by a varint, so any run
+ *		costs at most a few bytes.
+ *	SPARSE	The positions of the minority bit value, as varint gaps.
+ *
+ * Layout, varints being LEB128, 7 bits a byte, low bits first:
+ *
+ *	byte	MAGIC
+ *	byte	VERSION
+ *	varint	number of bits
+ *	varint	bits per block, the last block holding what is left
+ *	blocks	each a codec byte, a varint payload length in bytes and the payload
+ *
+ * RLE payloads are those of run_length_encode() but for guide byte 0, which
+ * is followed by a varint of (run length << 1 | bit value) for a run of any
+ * length.  SPARSE payloads are the listed bit value, a varint count and then
+ * a varint per listed bit of the gap since the one before.
+ *
+ * A block is never stored in more than RAW bytes plus its block header.
+ */
+class fbs_codec {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	typedef enum { RAW = 0, RLE = 1, SPARSE = 2, N_CODECS = 3 } CODEC;
+
+	// What to choose codecs for: the smallest encoding, or the fastest to
+	// decode that still saves space.
+	typedef enum { SMALLEST, FASTEST } GOAL;
+
+	static const byte MAGIC = 0xFB;
+	static const byte VERSION = 1;
+
+	static const size_t DEFAULT_BLOCK_BITS = 1 << 20;
+
+	// Encode bits[0, length()), codecs chosen per block for goal.  Returns
+	// the number of bytes; *encoding is malloc()ed and the caller's to free().
+	static size_t encode(const fast_bitstring_view &bits, byte **encoding, GOAL goal = SMALLEST, size_t block_bits = DEFAULT_BLOCK_BITS);
+
+	// Encode every block with the given codec, or RAW where it would not pay.
+	static size_t encode_with(const fast_bitstring_view &bits, byte **encoding, CODEC codec, size_t block_bits = DEFAULT_BLOCK_BITS);
+
+	static fast_bitstring *decode(const byte *encoding, size_t num_bytes);
+
+	// Decode into a caller provided byte per bit buffer.  Returns the number of
+	// bits decoded; throws if they would overrun max_bits.
+	static size_t decode_into(const byte *encoding, size_t num_bytes, byte *bits, size_t max_bits);
+
+	// Number of bits an encoding decodes to, from its header.
+	static size_t decoded_length(const byte *encoding, size_t num_bytes);
+
+	// Codec of each block of an encoding, in order.
+	static std::vector<CODEC> block_codecs(const byte *encoding, size_t num_bytes);
+
+	// The codec encode() would pick for n bits, from samples of them.
+	static CODEC choose(const byte *bits, size_t n, GOAL goal = SMALLEST);
+
+	static const char *codec_name(CODEC codec);
+
+private:
+	// Encode with the given codec for every block, or one chosen per block
+	// for goal when codec is N_CODECS.
+	static size_t encode_blocks(const fast_bitstring_view &bits, byte **encoding, CODEC codec, GOAL goal, size_t block_bits);
+
+	// Encode n bits as a block payload into out, stopping with ~0 should it
+	// need more than limit bytes.  out must have room for limit + SLACK.
+	static size_t encode_block(CODEC codec, const byte *bits, size_t n, byte *out, size_t limit);
+	static void decode_block(CODEC codec, const byte *payload, size_t num_bytes, byte *bits, size_t n);
+
+	// Most bytes a block encoder writes between checks against its limit.
+	static const size_t SLACK = 64;
+};
+
+#endif
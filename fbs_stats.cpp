@@ -0,0 +1,162 @@
+//
+// fbs_stats.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "fbs_stats.h"
+
+typedef fbs_stats::counters counters;
+
+#define N_COUNTERS (sizeof(counters) / sizeof(uint64_t))
+
+__thread counters *fbs_stats::mine;
+
+
+//
+// Every thread's counters are kept on a list until the thread exits, when
+// they are folded into the retired totals.  The registry is never destroyed,
+// so threads exiting after main() returns can still retire theirs.
+//
+
+typedef struct {
+	std::mutex m;
+	std::vector<counters *> live;
+	counters retired;
+	counters base;		// Totals as of the last reset().
+} registry;
+
+static registry &the_registry() {
+	static registry *r = new registry();
+	return *r;
+}
+
+// a += b, reading b with relaxed atomic loads as its thread may be counting.
+static void accumulate(counters &a, const counters &b) {
+	uint64_t *pa = (uint64_t *)&a;
+	const uint64_t *pb = (const uint64_t *)&b;
+	for (size_t i = 0; i < N_COUNTERS; ++i)
+		pa[i] += __atomic_load_n(&pb[i], __ATOMIC_RELAXED);
+}
+
+static counters totals(registry &r) {
+	counters t;
+	memset(&t, 0, sizeof(t));
+	accumulate(t, r.retired);
+	for (size_t i = 0; i < r.live.size(); ++i)
+		accumulate(t, *r.live[i]);
+	return t;
+}
+
+// Set once a thread's counters have been retired, since its retirer can not
+// be brought back.  Anything it counts after that is registered for good.
+static __thread bool thread_retired;
+
+class stats_retirer {
+public:
+	~stats_retirer() { fbs_stats::detach(); }
+};
+
+static thread_local stats_retirer retirer;
+
+counters *fbs_stats::attach() {
+
+	counters *c = new counters();
+	registry &r = the_registry();
+
+	{
+		std::lock_guard<std::mutex> lock(r.m);
+		r.live.push_back(c);
+	}
+
+	// Touching the retirer arranges for detach() at thread exit.
+	if (!thread_retired) (void)&retirer;
+
+	return mine = c;
+}
+
+void fbs_stats::detach() {
+
+	if (!mine) return;
+
+	registry &r = the_registry();
+	{
+		std::lock_guard<std::mutex> lock(r.m);
+		accumulate(r.retired, *mine);
+		r.live.erase(std::find(r.live.begin(), r.live.end(), mine));
+	}
+
+	delete mine;
+	mine = NULL;
+	thread_retired = true;
+}
+
+counters fbs_stats::collect() {
+
+	registry &r = the_registry();
+	std::lock_guard<std::mutex> lock(r.m);
+	counters t = totals(r);
+
+	uint64_t *pt = (uint64_t *)&t;
+	const uint64_t *pb = (const uint64_t *)&r.base;
+	for (size_t i = 0; i < N_COUNTERS; ++i)
+		pt[i] -= pb[i];
+
+	return t;
+}
+
+void fbs_stats::reset() {
+	registry &r = the_registry();
+	std::lock_guard<std::mutex> lock(r.m);
+	r.base = totals(r);
+}
+
+counters fbs_stats::collect_local() {
+	counters t;
+	memset(&t, 0, sizeof(t));
+	if (mine) accumulate(t, *mine);
+	return t;
+}
+
+static inline double per(uint64_t a, uint64_t b) {
+	return b ? (double)a / b : 0;
+}
+
+void fbs_stats::print(const counters &c, FILE *f) {
+
+	if (!f) f = stdout;
+
+	fprintf(f, "Explode:      %lu calls, %lu bits\n", c.explode_calls, c.explode_bits);
+	fprintf(f, "Pack:         %lu calls, %lu bits\n", c.pack_calls, c.pack_bits);
+	fprintf(f, "RLE encode:   %lu calls, %lu bits -> %lu bytes, %.1f ns/call, %.3f ns/bit\n",
+		c.rle_encode_calls, c.rle_encode_bits, c.rle_encode_bytes,
+		per(c.rle_encode_ns, c.rle_encode_calls), per(c.rle_encode_ns, c.rle_encode_bits));
+	fprintf(f, "RLE decode:   %lu calls, %lu bytes -> %lu bits, %.1f ns/call, %.3f ns/bit\n",
+		c.rle_decode_calls, c.rle_decode_bytes, c.rle_decode_bits,
+		per(c.rle_decode_ns, c.rle_decode_calls), per(c.rle_decode_ns, c.rle_decode_bits));
+	fprintf(f, "RLE content:  %lu runs of %lu bits, %lu verbatim blocks of %lu bits, %.1f%% verbatim\n",
+		c.rle_runs, c.rle_run_bits, c.rle_verbatim_blocks, c.rle_verbatim_bits,
+		100 * verbatim_ratio(c));
+	fprintf(f, "Storage:      %lu allocations of %lu bytes, %lu reallocations, %lu releases\n",
+		c.allocations, c.allocated_bytes, c.reallocations, c.releases);
+
+	if (c.rle_runs == 0) return;
+
+	fprintf(f, "Run lengths:\n");
+	for (int i = 0; i < RUN_LENGTHS; ++i) {
+		if (c.run_length[i])
+			fprintf(f, "\t%3d: %lu\n", i, c.run_length[i]);
+	}
+}
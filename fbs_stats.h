@@ -0,0 +1,104 @@
+/*
+ * fbs_stats.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _FBS_STATS_H
+#define _FBS_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+
+/*
+ * Always on statistics for the kernels, codecs and bit array storage.
+ *
+ * Each thread counts into its own block of counters, so the hot paths pay a
+ * thread local lookup and a few plain adds and never share a cache line.
+ * collect() sums every thread's counters, those of threads that have exited
+ * included, whenever asked:
+ *
+ *	fbs_stats::counters c = fbs_stats::collect();
+ *	printf("%.2f ns per RLE encode\n", (double)c.rle_encode_ns / c.rle_encode_calls);
+ *
+ * Counters only ever grow; reset() just moves the point collect() counts
+ * from.  Explode and pack counts include the work done inside the codecs.
+ */
+class fbs_stats {
+
+public:
+	// Encoded runs are 9 to 127 bits, counted by length.
+	static const int RUN_LENGTHS = 128;
+
+	typedef struct {
+		uint64_t explode_calls, explode_bits;
+		uint64_t pack_calls, pack_bits;
+
+		uint64_t rle_encode_calls, rle_encode_bits, rle_encode_bytes, rle_encode_ns;
+		uint64_t rle_decode_calls, rle_decode_bits, rle_decode_bytes, rle_decode_ns;
+
+		// What the encoder made of the bits.
+		uint64_t rle_runs, rle_run_bits;
+		uint64_t rle_verbatim_blocks, rle_verbatim_bits;
+		uint64_t run_length[RUN_LENGTHS];
+
+		// Bit array storage of fast_bitstrings.
+		uint64_t allocations, allocated_bytes, reallocations, releases;
+	} counters;
+
+	// Totals over all threads since the last reset().
+	static counters collect();
+	static void reset();
+
+	// This thread's counters, since the thread started.
+	static counters collect_local();
+
+	// Human readable summary, to stdout by default.
+	static void print(const counters &c, FILE *f = NULL);
+
+	// Share of encoded bits that went into verbatim blocks rather than runs.
+	static inline double verbatim_ratio(const counters &c) {
+		const uint64_t n = c.rle_run_bits + c.rle_verbatim_bits;
+		return n ? (double)c.rle_verbatim_bits / n : 0;
+	}
+
+	//
+	// Counting, for the library's own hot paths.
+	//
+
+	// This thread's counters, registered on first use.
+	static inline counters *local() {
+		return mine ? mine : attach();
+	}
+
+	// Only the owning thread adds, so a relaxed load and store will do, and
+	// collect() on another thread never sees a torn value.
+	static inline void add(uint64_t &counter, uint64_t n) {
+		__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+	}
+
+	static inline uint64_t now_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+private:
+	friend class stats_retirer;
+
+	static counters *attach();
+	static void detach();
+
+	static __thread counters *mine;
+};
+
+#endif
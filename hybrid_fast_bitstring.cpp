@@ -0,0 +1,735 @@
+//
+// hybrid_fast_bitstring.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <algorithm>
+
+#include "hybrid_fast_bitstring.h"
+#include "rle_stream.h"
+
+typedef hybrid_fast_bitstring::byte byte;
+
+#define DENSE_BYTES (hybrid_fast_bitstring::CHUNK_BITS / 8)
+
+
+//
+// Packed words.
+//
+// DENSE chunks hold their bits as fast_packed_bitstring does: bit j is bit
+// (7 - j % 8) of byte j / 8, so a word loaded through big_endian() has its
+// first bit most significant.  Bits past the end of a bitstring are kept 0.
+//
+
+static inline uint64_t big_endian(uint64_t w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap64(w);
+#else
+	return w;
+#endif
+}
+
+static inline byte get_bit(const uint64_t *w, size_t j) {
+	return (((const byte *)w)[j / 8] >> (7 - j % 8)) & 1;
+}
+
+static inline void set_bit(uint64_t *w, size_t j) {
+	((byte *)w)[j / 8] |= 0x80 >> (j % 8);
+}
+
+// Set bits [first, end).
+static void set_range(uint64_t *w, size_t first, size_t end) {
+
+	for (; first < end && first % 8; ++first)
+		set_bit(w, first);
+
+	if (end - first >= 8) {
+		memset(&((byte *)w)[first / 8], 0xFF, (end - first) / 8);
+		first += (end - first) / 8 * 8;
+	}
+
+	for (; first < end; ++first)
+		set_bit(w, first);
+}
+
+// Bits [lo, hi) of a big_endian() word, 0 <= lo < hi <= 64.
+static inline uint64_t span_mask(size_t lo, size_t hi) {
+	return (~(uint64_t)0 >> lo) & ~(hi == 64 ? 0 : ~(uint64_t)0 >> hi);
+}
+
+// Index of the first bit at or after from equal to value, or n_bits.
+static size_t next_bit(const uint64_t *w, size_t n_bits, size_t from, byte value) {
+
+	if (from >= n_bits) return n_bits;
+
+	const size_t n_words = (n_bits + 63) / 64;
+	const uint64_t flip = value ? 0 : ~(uint64_t)0;
+	size_t k = from / 64;
+	uint64_t v = (big_endian(w[k]) ^ flip) & span_mask(from % 64, 64);
+
+	while (!v) {
+		if (++k == n_words) return n_bits;
+		v = big_endian(w[k]) ^ flip;
+	}
+
+	const size_t i = k * 64 + __builtin_clzll(v);
+	return i < n_bits ? i : n_bits;
+}
+
+
+//
+// Containers.
+//
+
+// Find the last run starting at or before j, or runs.size() if there is none.
+template <class RUN> static inline size_t find_run(const std::vector<RUN> &runs, size_t j) {
+	size_t lo = 0, hi = runs.size();
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		if (runs[mid].start <= j) lo = mid + 1; else hi = mid;
+	}
+	return lo ? lo - 1 : runs.size();
+}
+
+// Empty the chunk, giving back its storage, and make it of the given type.
+template <class CHUNK> static inline void clear(CHUNK &c, hybrid_fast_bitstring::CONTAINER type) {
+	std::vector<uint16_t>().swap(c.array);
+	c.runs.clear();
+	c.runs.shrink_to_fit();
+	std::vector<uint64_t>().swap(c.dense);
+	c.type = type;
+	c.card = 0;
+}
+
+byte hybrid_fast_bitstring::get(const chunk &c, size_t j) {
+
+	switch (c.type) {
+	case ARRAY:
+		return std::binary_search(c.array.begin(), c.array.end(), (uint16_t)j) ? 1 : 0;
+	case RUNS: {
+		const size_t r = find_run(c.runs, j);
+		return r < c.runs.size() && j <= c.runs[r].last ? 1 : 0;
+	}
+	case DENSE:
+		return get_bit(c.dense.data(), j);
+	default:
+		return 0;
+	}
+}
+
+// Number of 1 bits in [first, end) of a chunk.
+size_t hybrid_fast_bitstring::count(const chunk &c, size_t first, size_t end) {
+
+	if (first == 0 && end >= CHUNK_BITS) return c.card;
+	if (first >= end) return 0;
+
+	switch (c.type) {
+	case ARRAY:
+		return std::lower_bound(c.array.begin(), c.array.end(), end) - std::lower_bound(c.array.begin(), c.array.end(), first);
+	case RUNS: {
+		size_t n = 0;
+		size_t r = find_run(c.runs, first);
+		if (r == c.runs.size()) r = 0;
+		for (; r < c.runs.size() && c.runs[r].start < end; ++r) {
+			const size_t s = c.runs[r].start > first ? c.runs[r].start : first;
+			const size_t e = (size_t)c.runs[r].last + 1 < end ? (size_t)c.runs[r].last + 1 : end;
+			if (s < e) n += e - s;
+		}
+		return n;
+	}
+	case DENSE: {
+		size_t n = 0;
+		for (size_t k = first / 64; k * 64 < end; ++k) {
+			const size_t lo = k == first / 64 ? first % 64 : 0;
+			const size_t hi = end - k * 64 < 64 ? end - k * 64 : 64;
+			n += __builtin_popcountll(big_endian(c.dense[k]) & span_mask(lo, hi));
+		}
+		return n;
+	}
+	default:
+		return 0;
+	}
+}
+
+// First 1 bit at or after j in a chunk, or CHUNK_BITS.
+size_t hybrid_fast_bitstring::next_set(const chunk &c, size_t j) {
+
+	switch (c.type) {
+	case ARRAY: {
+		std::vector<uint16_t>::const_iterator p = std::lower_bound(c.array.begin(), c.array.end(), j);
+		return p == c.array.end() ? CHUNK_BITS : *p;
+	}
+	case RUNS: {
+		const size_t r = find_run(c.runs, j);
+		if (r < c.runs.size() && j <= c.runs[r].last) return j;
+		const size_t next = r < c.runs.size() ? r + 1 : 0;
+		return next < c.runs.size() ? c.runs[next].start : CHUNK_BITS;
+	}
+	case DENSE:
+		return next_bit(c.dense.data(), CHUNK_BITS, j, 1);
+	default:
+		return CHUNK_BITS;
+	}
+}
+
+void hybrid_fast_bitstring::to_words(const chunk &c, uint64_t *w) {
+
+	if (c.type == DENSE) {
+		memcpy(w, c.dense.data(), DENSE_BYTES);
+		return;
+	}
+
+	memset(w, 0, DENSE_BYTES);
+
+	if (c.type == ARRAY) {
+		for (size_t i = 0; i < c.array.size(); ++i)
+			set_bit(w, c.array[i]);
+	} else if (c.type == RUNS) {
+		for (size_t r = 0; r < c.runs.size(); ++r)
+			set_range(w, c.runs[r].start, (size_t)c.runs[r].last + 1);
+	}
+}
+
+// Rebuild the chunk from packed words in its smallest container: the fewer
+// bytes of 2 per 1 bit for ARRAY (up to ARRAY_MAX), 4 per run for RUNS, or
+// DENSE_BYTES, RUNS only if strictly smaller.  w may be c.dense.
+void hybrid_fast_bitstring::from_words(chunk &c, const uint64_t *w) {
+
+	size_t card = 0, n_runs = 0;
+	uint64_t carry = 0;
+
+	for (size_t k = 0; k < DENSE_WORDS; ++k) {
+		const uint64_t v = big_endian(w[k]);
+		card += __builtin_popcountll(v);
+		// A run starts at each 1 following a 0.
+		n_runs += __builtin_popcountll(v & ~((v >> 1) | (carry << 63)));
+		carry = v & 1;
+	}
+
+	if (card == 0) {
+		clear(c, EMPTY);
+		return;
+	}
+
+	const size_t array_bytes = card <= ARRAY_MAX ? 2 * card : ~(size_t)0;
+	const size_t runs_bytes = 4 * n_runs;
+
+	if (runs_bytes < array_bytes && runs_bytes < DENSE_BYTES) {
+		std::vector<run> runs;
+		runs.reserve(n_runs);
+		for (size_t s = next_bit(w, CHUNK_BITS, 0, 1); s < CHUNK_BITS; ) {
+			const size_t e = next_bit(w, CHUNK_BITS, s, 0);
+			const run r = { (uint16_t)s, (uint16_t)(e - 1) };
+			runs.push_back(r);
+			s = next_bit(w, CHUNK_BITS, e, 1);
+		}
+		clear(c, RUNS);
+		c.runs.swap(runs);
+	} else if (array_bytes <= DENSE_BYTES) {
+		std::vector<uint16_t> array;
+		array.reserve(card);
+		for (size_t k = 0; k < DENSE_WORDS; ++k) {
+			uint64_t v = big_endian(w[k]);
+			while (v) {
+				const size_t lz = __builtin_clzll(v);
+				array.push_back((uint16_t)(k * 64 + lz));
+				v &= ~((uint64_t)1 << (63 - lz));
+			}
+		}
+		clear(c, ARRAY);
+		c.array.swap(array);
+	} else {
+		std::vector<uint64_t> dense(w, w + DENSE_WORDS);
+		clear(c, DENSE);
+		c.dense.swap(dense);
+	}
+
+	c.card = card;
+}
+
+void hybrid_fast_bitstring::explode(const chunk &c, size_t first, size_t n, byte *dst) {
+
+	const size_t end = first + n;
+
+	if (c.type == DENSE) {
+		fast_bitstring::explode_bits(dst, (const byte *)c.dense.data(), first, n);
+		return;
+	}
+
+	memset(dst, 0, n);
+
+	if (c.type == ARRAY) {
+		std::vector<uint16_t>::const_iterator p = std::lower_bound(c.array.begin(), c.array.end(), first);
+		for (; p != c.array.end() && *p < end; ++p)
+			dst[*p - first] = 1;
+	} else if (c.type == RUNS) {
+		size_t r = find_run(c.runs, first);
+		if (r == c.runs.size()) r = 0;
+		for (; r < c.runs.size() && c.runs[r].start < end; ++r) {
+			const size_t s = c.runs[r].start > first ? c.runs[r].start : first;
+			const size_t e = (size_t)c.runs[r].last + 1 < end ? (size_t)c.runs[r].last + 1 : end;
+			if (s < e) memset(&dst[s - first], 1, e - s);
+		}
+	}
+}
+
+// c = c op d, sorted arrays merged directly and anything else a word at a time.
+void hybrid_fast_bitstring::apply(OP op, chunk &c, const chunk &d) {
+
+	if (d.type == EMPTY) {
+		if (op == AND) clear(c, EMPTY);
+		return;
+	}
+
+	if (c.type == EMPTY) {
+		if (op == OR || op == XOR) c = d;
+		return;
+	}
+
+	if (c.type == ARRAY && d.type == ARRAY) {
+		std::vector<uint16_t> r;
+		std::back_insert_iterator<std::vector<uint16_t> > out(r);
+		const std::vector<uint16_t> &a = c.array, &b = d.array;
+
+		switch (op) {
+		case AND:	std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), out); break;
+		case OR:	std::set_union(a.begin(), a.end(), b.begin(), b.end(), out); break;
+		case XOR:	std::set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(), out); break;
+		case AND_NOT:	std::set_difference(a.begin(), a.end(), b.begin(), b.end(), out); break;
+		}
+
+		if (r.size() <= ARRAY_MAX) {
+			const size_t card = r.size();
+			clear(c, card ? ARRAY : EMPTY);
+			c.array.swap(r);
+			c.card = card;
+			return;
+		}
+	}
+
+	// Filtering an array keeps it an array.
+	if (c.type == ARRAY && (op == AND || op == AND_NOT)) {
+		const byte keep = op == AND ? 1 : 0;
+		size_t n = 0;
+		for (size_t i = 0; i < c.array.size(); ++i) {
+			if (get(d, c.array[i]) == keep)
+				c.array[n++] = c.array[i];
+		}
+		c.array.resize(n);
+		c.card = n;
+		if (n == 0) clear(c, EMPTY);
+		return;
+	}
+
+	uint64_t a[DENSE_WORDS], b[DENSE_WORDS];
+	to_words(c, a);
+	to_words(d, b);
+
+	switch (op) {
+	case AND:	for (size_t k = 0; k < DENSE_WORDS; ++k) a[k] &= b[k]; break;
+	case OR:	for (size_t k = 0; k < DENSE_WORDS; ++k) a[k] |= b[k]; break;
+	case XOR:	for (size_t k = 0; k < DENSE_WORDS; ++k) a[k] ^= b[k]; break;
+	case AND_NOT:	for (size_t k = 0; k < DENSE_WORDS; ++k) a[k] &= ~b[k]; break;
+	}
+
+	from_words(c, a);
+}
+
+
+//
+// Bitstring.
+//
+
+hybrid_fast_bitstring::hybrid_fast_bitstring(const size_t length, const fast_bitstring::BIT_SOURCE bit_source)
+	: blength(bit_source == fast_bitstring::FROM_BYTES ? length * 8 : length) {
+
+	chunks.resize((blength + CHUNK_BITS - 1) / CHUNK_BITS);
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		chunks[k].type = EMPTY;
+		chunks[k].card = 0;
+	}
+}
+
+hybrid_fast_bitstring::hybrid_fast_bitstring(const fast_bitstring_view &f) : hybrid_fast_bitstring(f.length(), fast_bitstring::FROM_BITS) {
+	assign(0, f);
+}
+
+void hybrid_fast_bitstring::assign(size_t offset, const fast_bitstring_view &bits) {
+
+	const size_t n = bits.length();
+
+	if (offset > blength || n > blength - offset) throw "Invalid assign parameters: offset + length > bitstring length.";
+
+	uint64_t w[DENSE_WORDS];
+	byte *scratch = NULL;
+
+	for (size_t done = 0; done < n; ) {
+
+		const size_t i = offset + done;
+		const size_t k = i / CHUNK_BITS, first = i % CHUNK_BITS;
+		const size_t m = n - done < chunk_bits(k) - first ? n - done : chunk_bits(k) - first;
+		const byte *src = bits.data() + done;
+		chunk &c = chunks[k];
+
+		if (first == 0 && m == chunk_bits(k)) {
+			// A whole chunk: zeros are skipped at SIMD speed, anything else packed.
+			if (fast_bitstring::count_bits(src, m) == 0) {
+				clear(c, EMPTY);
+			} else {
+				memset(w, 0, DENSE_BYTES);
+				fast_bitstring::pack_bits((byte *)w, src, m);
+				from_words(c, w);
+			}
+		} else {
+			// Part of one: explode it, overwrite and pack it back.
+			if (!scratch) scratch = (byte *)malloc(CHUNK_BITS);
+			const size_t cb = chunk_bits(k);
+			explode(c, 0, cb, scratch);
+			memcpy(&scratch[first], src, m);
+			memset(w, 0, DENSE_BYTES);
+			fast_bitstring::pack_bits((byte *)w, scratch, cb);
+			from_words(c, w);
+		}
+
+		done += m;
+	}
+
+	free(scratch);
+}
+
+fast_bitstring *hybrid_fast_bitstring::to_fast_bitstring(size_t offset, size_t n) const {
+
+	if (offset > blength) offset = blength;
+	if (n > blength - offset) n = blength - offset;
+
+	// Every bit is written by copy().
+	fast_bitstring *f = new fast_bitstring(n, fast_bitstring::FROM_BITS, fast_bitstring::NO_FILL);
+	if (n) copy(&(*f)[0], offset, n);
+
+	return f;
+}
+
+size_t hybrid_fast_bitstring::copy(byte *dst, size_t offset, size_t n) const {
+
+	if (offset > blength) offset = blength;
+	if (n > blength - offset) n = blength - offset;
+
+	for (size_t done = 0; done < n; ) {
+		const size_t i = offset + done;
+		const size_t k = i / CHUNK_BITS, first = i % CHUNK_BITS;
+		const size_t m = n - done < chunk_bits(k) - first ? n - done : chunk_bits(k) - first;
+		explode(chunks[k], first, m, &dst[done]);
+		done += m;
+	}
+
+	return n;
+}
+
+void hybrid_fast_bitstring::set(size_t i, byte bit) {
+
+	if (i >= blength) throw "Invalid bit index: past end of bitstring.";
+
+	chunk &c = chunks[i / CHUNK_BITS];
+	const size_t j = i % CHUNK_BITS;
+	uint64_t w[DENSE_WORDS];
+
+	bit = bit ? 1 : 0;
+
+	switch (c.type) {
+	case EMPTY:
+		if (!bit) return;
+		c.type = ARRAY;
+		c.array.push_back((uint16_t)j);
+		c.card = 1;
+		return;
+
+	case ARRAY: {
+		std::vector<uint16_t>::iterator p = std::lower_bound(c.array.begin(), c.array.end(), j);
+		const byte present = p != c.array.end() && *p == j;
+		if (present == bit) return;
+		if (bit) {
+			c.array.insert(p, (uint16_t)j);
+			if (++c.card > ARRAY_MAX) {
+				to_words(c, w);
+				const size_t card = c.card;
+				clear(c, DENSE);
+				c.dense.assign(w, w + DENSE_WORDS);
+				c.card = card;
+			}
+		} else {
+			c.array.erase(p);
+			if (--c.card == 0) clear(c, EMPTY);
+		}
+		return;
+	}
+
+	case DENSE: {
+		byte &b = ((byte *)c.dense.data())[j / 8];
+		const byte mask = 0x80 >> (j % 8);
+		if (((b & mask) != 0) == bit) return;
+		b ^= mask;
+		if (bit) {
+			++c.card;
+		} else if (--c.card <= ARRAY_MAX / 2) {
+			memcpy(w, c.dense.data(), DENSE_BYTES);
+			from_words(c, w);
+		}
+		return;
+	}
+
+	case RUNS: {
+		std::vector<run> &runs = c.runs;
+		const size_t r = find_run(runs, j);
+		const bool in = r < runs.size() && j <= runs[r].last;
+		if (in == (bit != 0)) return;
+
+		if (bit) {
+			// Extend the run before, the run after, both or neither.
+			const size_t after = r < runs.size() ? r + 1 : 0;
+			const bool joins_before = r < runs.size() && (size_t)runs[r].last + 1 == j;
+			const bool joins_after = after < runs.size() && runs[after].start == j + 1;
+			if (joins_before && joins_after) {
+				runs[r].last = runs[after].last;
+				runs.erase(runs.begin() + after);
+			} else if (joins_before) {
+				runs[r].last = (uint16_t)j;
+			} else if (joins_after) {
+				runs[after].start = (uint16_t)j;
+			} else {
+				const run n = { (uint16_t)j, (uint16_t)j };
+				runs.insert(runs.begin() + after, n);
+			}
+			++c.card;
+		} else {
+			// Trim or split the run holding j.
+			if (runs[r].start == runs[r].last) {
+				runs.erase(runs.begin() + r);
+			} else if (runs[r].start == j) {
+				++runs[r].start;
+			} else if (runs[r].last == j) {
+				--runs[r].last;
+			} else {
+				const run n = { (uint16_t)(j + 1), runs[r].last };
+				runs[r].last = (uint16_t)(j - 1);
+				runs.insert(runs.begin() + r + 1, n);
+			}
+			--c.card;
+		}
+
+		// Give up on runs once they cost more than the alternative.
+		const size_t other = c.card <= ARRAY_MAX ? 2 * c.card : DENSE_BYTES;
+		if (c.card == 0 || 4 * runs.size() > other) {
+			to_words(c, w);
+			from_words(c, w);
+		}
+		return;
+	}
+	}
+}
+
+size_t hybrid_fast_bitstring::count(size_t offset, size_t n) const {
+
+	if (offset > blength) offset = blength;
+	if (n > blength - offset) n = blength - offset;
+
+	size_t total = 0;
+
+	for (size_t done = 0; done < n; ) {
+		const size_t i = offset + done;
+		const size_t k = i / CHUNK_BITS, first = i % CHUNK_BITS;
+		const size_t m = n - done < chunk_bits(k) - first ? n - done : chunk_bits(k) - first;
+		// The whole of a short last chunk is its card.
+		const size_t end = first + m == chunk_bits(k) ? CHUNK_BITS : first + m;
+		total += count(chunks[k], first, end);
+		done += m;
+	}
+
+	return total;
+}
+
+size_t hybrid_fast_bitstring::next_set(size_t from) const {
+
+	for (size_t k = from / CHUNK_BITS; k < chunks.size(); ++k) {
+		const size_t j = k == from / CHUNK_BITS ? from % CHUNK_BITS : 0;
+		if (chunks[k].type == EMPTY) continue;
+		const size_t s = next_set(chunks[k], j);
+		if (s < CHUNK_BITS) return k * CHUNK_BITS + s;
+	}
+
+	return blength;
+}
+
+int hybrid_fast_bitstring::compare(const hybrid_fast_bitstring &that) const {
+
+	if (this->blength < that.blength)
+		return -1;
+	if (this->blength > that.blength)
+		return 1;
+
+	uint64_t a[DENSE_WORDS], b[DENSE_WORDS];
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+
+		const chunk &x = chunks[k], &y = that.chunks[k];
+
+		if (x.type == EMPTY && y.type == EMPTY) continue;
+		if (x.type == ARRAY && y.type == ARRAY && x.array == y.array) continue;
+
+		// Packed bytes in order compare as unsigned bytes exactly as the bits
+		// do one at a time.
+		to_words(x, a);
+		to_words(y, b);
+		const int c = memcmp(a, b, DENSE_BYTES);
+		if (c) return c < 0 ? -1 : 1;
+	}
+
+	return 0;
+}
+
+size_t hybrid_fast_bitstring::hamming_distance(const hybrid_fast_bitstring &that) const {
+
+	check_length(that);
+
+	uint64_t a[DENSE_WORDS], b[DENSE_WORDS];
+	size_t n = 0;
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+
+		const chunk &x = chunks[k], &y = that.chunks[k];
+
+		if (x.type == EMPTY || y.type == EMPTY) {
+			n += x.card + y.card;
+			continue;
+		}
+
+		to_words(x, a);
+		to_words(y, b);
+		for (size_t i = 0; i < DENSE_WORDS; ++i)
+			n += __builtin_popcountll(a[i] ^ b[i]);
+	}
+
+	return n;
+}
+
+uint64_t hybrid_fast_bitstring::get_uint(size_t offset, size_t width, fast_bitstring::BIT_ORDER order) const {
+
+	if (width == 0 || width > 64 || offset > blength || width > blength - offset)
+		throw "Invalid bit field parameters: width not 1..64 or field past end of bitstring.";
+
+	byte bits[64];
+	copy(bits, offset, width);
+
+	return fast_bitstring_view(bits, width).get_uint(0, width, order);
+}
+
+size_t hybrid_fast_bitstring::to_bytes(byte *bytes, size_t offset, size_t num_bits) const {
+
+	if (offset > blength)
+		offset = blength;
+
+	if (num_bits == 0 || num_bits > blength - offset)
+		num_bits = blength - offset;
+
+	if (!bytes) {
+		return (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
+	}
+
+	// Explode and pack a chunk's worth at a time, which keeps the output
+	// byte aligned.
+	std::vector<byte> scratch(num_bits < CHUNK_BITS ? num_bits : CHUNK_BITS);
+	size_t b = 0;
+
+	for (size_t done = 0; done < num_bits; done += scratch.size()) {
+		const size_t m = num_bits - done < scratch.size() ? num_bits - done : scratch.size();
+		copy(&scratch[0], offset + done, m);
+		b += fast_bitstring::pack_bits(&bytes[b], &scratch[0], m);
+	}
+
+	return b;
+}
+
+size_t hybrid_fast_bitstring::run_length_encode(byte **encoding) const {
+
+	if (blength == 0) {
+		if (encoding) *encoding = NULL;
+		return 0;
+	}
+
+	// Same bound as fast_bitstring::run_length_encode().
+	if (!encoding) return 3 + (2 * blength + 4) / 5;
+
+	rle_encoder enc;
+	byte *rle_bytes = (byte *)malloc(rle_encoder::max_encoded_length(blength) + rle_encoder::MAX_FINISH_LENGTH);
+	byte *scratch = (byte *)malloc(CHUNK_BITS);
+	size_t b = 0;
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		explode(chunks[k], 0, chunk_bits(k), scratch);
+		b += enc.encode(scratch, chunk_bits(k), &rle_bytes[b]);
+	}
+	b += enc.finish(&rle_bytes[b]);
+
+	free(scratch);
+
+	*encoding = rle_bytes;
+
+	return b;
+}
+
+hybrid_fast_bitstring &hybrid_fast_bitstring::operator &=(const hybrid_fast_bitstring &that) {
+	check_length(that);
+	for (size_t k = 0; k < chunks.size(); ++k)
+		apply(AND, chunks[k], that.chunks[k]);
+	return *this;
+}
+
+hybrid_fast_bitstring &hybrid_fast_bitstring::operator |=(const hybrid_fast_bitstring &that) {
+	check_length(that);
+	for (size_t k = 0; k < chunks.size(); ++k)
+		apply(OR, chunks[k], that.chunks[k]);
+	return *this;
+}
+
+hybrid_fast_bitstring &hybrid_fast_bitstring::operator ^=(const hybrid_fast_bitstring &that) {
+	check_length(that);
+	for (size_t k = 0; k < chunks.size(); ++k)
+		apply(XOR, chunks[k], that.chunks[k]);
+	return *this;
+}
+
+hybrid_fast_bitstring &hybrid_fast_bitstring::and_not(const hybrid_fast_bitstring &that) {
+	check_length(that);
+	for (size_t k = 0; k < chunks.size(); ++k)
+		apply(AND_NOT, chunks[k], that.chunks[k]);
+	return *this;
+}
+
+void hybrid_fast_bitstring::optimize() {
+
+	uint64_t w[DENSE_WORDS];
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		if (chunks[k].type == EMPTY) continue;
+		to_words(chunks[k], w);
+		from_words(chunks[k], w);
+	}
+}
+
+size_t hybrid_fast_bitstring::storage() const {
+
+	size_t n = 0;
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		const chunk &c = chunks[k];
+		n += c.array.capacity() * sizeof(uint16_t) + c.runs.capacity() * sizeof(run) + c.dense.capacity() * sizeof(uint64_t);
+	}
+
+	return n;
+}
@@ -0,0 +1,150 @@
+/*
+ * hybrid_fast_bitstring.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _HYBRID_FAST_BITSTRING_H
+#define _HYBRID_FAST_BITSTRING_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * A bitstring for mostly empty bitmaps, after Roaring bitmaps: the bits are
+ * cut into CHUNK_BITS chunks, each held in whichever container suits it:
+ *
+ *	EMPTY	No 1 bits, and no storage.
+ *	ARRAY	The sorted positions of the 1 bits, 2 bytes each, for at most
+ *		ARRAY_MAX of them.
+ *	RUNS	The runs of 1 bits, 4 bytes each.
+ *	DENSE	The bits packed, 8KB, in the byte order of fast_packed_bitstring.
+ *
+ * Chunks built in bulk, from a fast_bitstring or by the set operations, take
+ * the smallest container.  set() keeps the container but for moving between
+ * ARRAY and DENSE at ARRAY_MAX bits, back at half that to avoid thrashing, and
+ * giving up RUNS once they no longer save space; optimize() re-picks the
+ * smallest for every chunk.
+ *
+ * Counting, the set operations and skipping zeros cost in proportion to the
+ * containers rather than to length().  Hot regions can be exploded into a
+ * fast_bitstring with to_fast_bitstring() or copy(), worked on at full speed
+ * and written back with assign().
+ */
+class hybrid_fast_bitstring {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	typedef enum { EMPTY, ARRAY, RUNS, DENSE } CONTAINER;
+
+	static const size_t CHUNK_BITS = 1 << 16;
+	static const size_t ARRAY_MAX = 4096;
+
+	// Construct bit array of all zero bits.
+	hybrid_fast_bitstring(const size_t length = 0, const fast_bitstring::BIT_SOURCE bit_source = fast_bitstring::FROM_BYTES);
+
+	// Convert an exploded fast_bitstring or view.
+	explicit hybrid_fast_bitstring(const fast_bitstring_view &f);
+
+	// Explode bits [offset, offset + n) into a new fast_bitstring owned by the caller.
+	fast_bitstring *to_fast_bitstring(size_t offset = 0, size_t n = ~(size_t)0) const;
+
+	// Explode n bits starting at bit[offset] into dst, one byte per bit.
+	// Returns the number of bits copied, fewer than n at the end.
+	size_t copy(byte *dst, size_t offset, size_t n) const;
+
+	// Overwrite bits [offset, offset + bits.length()) with bits.
+	void assign(size_t offset, const fast_bitstring_view &bits);
+
+	// Length of bit string in bits.
+	inline size_t length() const { return blength; }
+
+	inline byte operator [](const size_t i) const { return get(chunks[i / CHUNK_BITS], i % CHUNK_BITS); }
+
+	void set(size_t i, byte bit = 1);
+
+	// Number of 1 bits in bit[offset, offset + n).
+	size_t count(size_t offset = 0, size_t n = ~(size_t)0) const;
+
+	// Index of the first 1 bit at or after from, or length() if there is none.
+	size_t next_set(size_t from = 0) const;
+
+	// As for fast_bitstring, but the Hamming distance is only defined for
+	// bitstrings of the same length.
+	int compare(const hybrid_fast_bitstring &that) const;
+	size_t hamming_distance(const hybrid_fast_bitstring &that) const;
+	uint64_t get_uint(size_t offset, size_t width, fast_bitstring::BIT_ORDER order = fast_bitstring::MSB_FIRST) const;
+	size_t to_bytes(byte *bytes, size_t offset = 0, size_t num_bits = 0) const;
+
+	// The same adaptive RLE as fast_bitstring, byte for byte.
+	size_t run_length_encode(byte **encoding) const;
+
+	// Set operations with a bitstring of the same length.
+	hybrid_fast_bitstring &operator &=(const hybrid_fast_bitstring &that);
+	hybrid_fast_bitstring &operator |=(const hybrid_fast_bitstring &that);
+	hybrid_fast_bitstring &operator ^=(const hybrid_fast_bitstring &that);
+	hybrid_fast_bitstring &and_not(const hybrid_fast_bitstring &that);
+
+	// Move every chunk to its smallest container.
+	void optimize();
+
+	inline size_t n_chunks() const { return chunks.size(); }
+	inline CONTAINER container(size_t chunk) const { return chunks[chunk].type; }
+
+	// Bytes of container storage, the chunk table not included.
+	size_t storage() const;
+
+private:
+	typedef struct {
+		uint16_t start, last;
+	} run;
+
+	typedef struct {
+		CONTAINER type;
+		uint32_t card;			// Number of 1 bits.
+		std::vector<uint16_t> array;
+		std::vector<run> runs;
+		std::vector<uint64_t> dense;
+	} chunk;
+
+	typedef enum { AND, OR, XOR, AND_NOT } OP;
+
+	static const size_t DENSE_WORDS = CHUNK_BITS / 64;
+
+	inline size_t chunk_bits(size_t k) const {
+		return blength - k * CHUNK_BITS < CHUNK_BITS ? blength - k * CHUNK_BITS : CHUNK_BITS;
+	}
+
+	static byte get(const chunk &c, size_t j);
+	static size_t count(const chunk &c, size_t first, size_t end);
+	static size_t next_set(const chunk &c, size_t j);
+
+	// The container as packed words, and the smallest container for packed words.
+	static void to_words(const chunk &c, uint64_t *w);
+	static void from_words(chunk &c, const uint64_t *w);
+
+	// Explode bits [first, first + n) of a chunk into dst.
+	static void explode(const chunk &c, size_t first, size_t n, byte *dst);
+
+	static void apply(OP op, chunk &c, const chunk &d);
+
+	void check_length(const hybrid_fast_bitstring &that) const {
+		if (that.blength != blength) throw "Bitstring lengths differ.";
+	}
+
+	size_t blength;			// length of bit array in bits.
+	std::vector<chunk> chunks;
+};
+
+#endif
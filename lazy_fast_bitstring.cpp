@@ -0,0 +1,151 @@
+//
+// lazy_fast_bitstring.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lazy_fast_bitstring.h"
+
+
+lazy_fast_bitstring::lazy_fast_bitstring(const char *filename, size_t block_bits, size_t max_resident_blocks) {
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) throw "Failed to open file for lazy fast bitstring";
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw "Failed to stat file for lazy fast bitstring";
+	}
+
+	packed_length = st.st_size;
+	blength = packed_length * 8;
+	packed = NULL;
+	barray = NULL;
+
+	if (packed_length) {
+		void *p = mmap(NULL, packed_length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw "Failed to map file for lazy fast bitstring";
+		}
+		packed = (const byte *)p;
+	}
+	close(fd);
+
+	// Blocks are a power of 2 bits and at least a page of exploded bytes so
+	// they can be released with madvise() and located with a shift.
+	const size_t page = sysconf(_SC_PAGESIZE);
+	for (block_shift = 0; ((size_t)1 << block_shift) < block_bits || ((size_t)1 << block_shift) < page; ++block_shift)
+		;
+
+	n_blocks = (blength >> block_shift) + 1;
+	resident = (byte *)calloc(n_blocks, 1);
+
+	max_resident = max_resident_blocks && max_resident_blocks < n_blocks ? max_resident_blocks : n_blocks;
+	fifo = (size_t *)malloc(max_resident * sizeof(size_t));
+	fifo_head = 0;
+	n_resident = 0;
+
+	// Reserve address space only; pages are committed as blocks are exploded.
+	if (blength) {
+		void *p = mmap(NULL, blength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			munmap((void *)packed, packed_length);
+			free(resident);
+			free(fifo);
+			throw "Failed to reserve memory for lazy fast bitstring";
+		}
+		barray = (byte *)p;
+	}
+}
+
+lazy_fast_bitstring::~lazy_fast_bitstring() {
+
+	if (barray) munmap(barray, blength);
+	if (packed) munmap((void *)packed, packed_length);
+	free(resident);
+	free(fifo);
+}
+
+void lazy_fast_bitstring::fault_in(size_t blk) const {
+
+	assert(blk < n_blocks);
+
+	if (n_resident == max_resident) evict_oldest();
+
+	const size_t first = blk << block_shift;
+	size_t n = (size_t)1 << block_shift;
+	if (first + n > blength) n = blength - first;
+
+	fast_bitstring::explode_bits(&barray[first], packed, first, n);
+
+	resident[blk] = 1;
+	fifo[(fifo_head + n_resident) % max_resident] = blk;
+	++n_resident;
+}
+
+void lazy_fast_bitstring::evict_oldest() const {
+
+	assert(n_resident > 0);
+
+	const size_t blk = fifo[fifo_head];
+	fifo_head = (fifo_head + 1) % max_resident;
+	--n_resident;
+
+	const size_t first = blk << block_shift;
+	size_t n = (size_t)1 << block_shift;
+	if (first + n > blength) n = blength - first;
+
+	// Drop the pages; they read back as zero if touched before the next explode.
+	madvise(&barray[first], n, MADV_DONTNEED);
+	resident[blk] = 0;
+}
+
+void lazy_fast_bitstring::evict(size_t keep) const {
+
+	while (n_resident > keep)
+		evict_oldest();
+}
+
+size_t lazy_fast_bitstring::copy(byte *dst, size_t offset, size_t n) const {
+
+	if (offset > blength) offset = blength;
+	if (n > blength - offset) n = blength - offset;
+
+	fast_bitstring::explode_bits(dst, packed, offset, n);
+
+	return n;
+}
+
+size_t lazy_fast_bitstring::to_bytes(byte *bytes, size_t offset, size_t num_bits) const {
+
+	if (offset > blength)
+		offset = blength;
+
+	if (num_bits == 0 || num_bits > blength - offset)
+		num_bits = blength - offset;
+
+	const size_t n = (num_bits / 8) + ((num_bits < 8 || num_bits % 8) ? 1 : 0);
+
+	if (!bytes) return n;
+	if (num_bits == 0) return 0;
+
+	return fast_bitstring::copy_bits(bytes, packed, offset, num_bits);
+}
+
+fast_bitstring *lazy_fast_bitstring::slice(size_t offset, size_t n) const {
+
+	if (offset + n > blength) throw "Invalid slice parameters: offset + length > lazy bitstring length.";
+
+	return new fast_bitstring(packed, offset, n);
+}
@@ -0,0 +1,93 @@
+/*
+ * lazy_fast_bitstring.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _LAZY_FAST_BITSTRING_H
+#define _LAZY_FAST_BITSTRING_H
+
+#include "fast_bitstring.h"
+
+
+/*
+ * A read only fast bitstring over a memory mapped file of packed bits.
+ *
+ * Nothing is exploded up front.  The exploded byte per bit array is a virtual
+ * reservation the size of the whole bitstring, and it is filled in one fixed
+ * size block at a time the first time operator[] touches a bit in that block.
+ * Exploded blocks can be handed back to the OS, either explicitly via evict()
+ * or automatically, oldest first, once max_resident_blocks are resident.
+ *
+ * Not thread safe: concurrent readers must serialize access.
+ */
+class lazy_fast_bitstring {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	// 1M bits per block, i.e., 1MB exploded and 128KB of the packed file.
+	static const size_t DEFAULT_BLOCK_BITS = 1 << 20;
+
+	// block_bits is rounded up to a power of 2 of at least a page.  A
+	// max_resident_blocks of 0 means no limit.
+	lazy_fast_bitstring(const char *filename, size_t block_bits = DEFAULT_BLOCK_BITS, size_t max_resident_blocks = 0);
+
+	~lazy_fast_bitstring();
+
+	// Length of bit string in bits.
+	inline size_t length() const { return blength; }
+
+	// Read bit[i], exploding its block first if needed.
+	inline byte operator [](const size_t i) const {
+		const size_t blk = i >> block_shift;
+		if (!resident[blk]) fault_in(blk);
+		return barray[i];
+	}
+
+	// Explode n bits starting at bit[offset] into dst, one byte per bit.  Bulk
+	// reads explode straight from the map and do not populate the block cache.
+	size_t copy(byte *dst, size_t offset, size_t n) const;
+
+	// Copy bits [offset, offset + num_bits) packed into bytes; as for
+	// fast_bitstring::to_bytes() but served from the map with no explode.
+	size_t to_bytes(byte *bytes, size_t offset = 0, size_t num_bits = 0) const;
+
+	// Explode the given range into a new fast_bitstring owned by the caller.
+	fast_bitstring *slice(size_t offset, size_t n) const;
+
+	// Release exploded blocks, oldest first, until at most "keep" remain.
+	void evict(size_t keep = 0) const;
+
+	inline size_t block_bits() const { return (size_t)1 << block_shift; }
+	inline size_t resident_blocks() const { return n_resident; }
+
+private:
+	lazy_fast_bitstring(const lazy_fast_bitstring &);
+	lazy_fast_bitstring &operator =(const lazy_fast_bitstring &);
+
+	void fault_in(size_t blk) const;
+	void evict_oldest() const;
+
+	size_t blength;		// length of bit string in bits.
+	byte *barray;		// Exploded bits, reserved not committed; one byte per bit.
+	const byte *packed;	// The mapped file.
+	size_t packed_length;	// Length of the mapped file in bytes.
+
+	size_t block_shift;	// log2 of bits per block.
+	size_t n_blocks;
+	byte *resident;		// One byte per block, non-zero when exploded.
+
+	size_t max_resident;	// Capacity of the FIFO below.
+	size_t *fifo;		// Resident blocks in the order they were exploded.
+	mutable size_t fifo_head;
+	mutable size_t n_resident;
+};
+
+#endif
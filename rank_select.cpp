@@ -0,0 +1,152 @@
+//
+// rank_select.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <algorithm>
+
+#include "rank_select.h"
+
+#define BLOCKS_PER_SUPERBLOCK (rank_select::SUPERBLOCK_BITS / rank_select::BLOCK_BITS)
+
+
+rank_select::rank_select(fast_bitstring &fbs) : fbs(fbs) {
+	build();
+}
+
+void rank_select::build() {
+
+	gen = fbs.generation();
+	blength = fbs.length();
+
+	const size_t n_super = blength / SUPERBLOCK_BITS + 1;
+	const size_t n_blocks = blength / BLOCK_BITS + 1;
+
+	super_count.assign(n_super, 0);
+	super_rank.assign(n_super + 1, 0);
+	block_rank.assign(n_blocks, 0);
+
+	rebuild_from(0);
+}
+
+// Recount every block from superblock "super" to the end.
+void rank_select::rebuild_from(size_t super) {
+
+	const size_t n_blocks = block_rank.size();
+
+	for (size_t s = super; s < super_count.size(); ++s) {
+		size_t in_super = 0;
+		for (size_t k = s * BLOCKS_PER_SUPERBLOCK; k < (s + 1) * BLOCKS_PER_SUPERBLOCK && k < n_blocks; ++k) {
+			block_rank[k] = in_super;
+			const size_t first = k * BLOCK_BITS;
+			if (first < blength)
+				in_super += fbs.count(first, BLOCK_BITS);
+		}
+		super_count[s] = in_super;
+	}
+
+	stale_from = super;
+}
+
+// Bring fbs's generation and the superblock prefix sums up to date.
+void rank_select::refresh() {
+
+	if (fbs.generation() != gen || fbs.length() != blength) {
+		build();
+	}
+
+	if (stale_from < super_count.size()) {
+		for (size_t s = stale_from; s < super_count.size(); ++s)
+			super_rank[s + 1] = super_rank[s] + super_count[s];
+		stale_from = super_count.size();
+	}
+}
+
+size_t rank_select::rank1(size_t i) {
+
+	refresh();
+
+	if (i > blength) i = blength;
+
+	const size_t k = i / BLOCK_BITS;
+	const size_t first = k * BLOCK_BITS;
+
+	return super_rank[i / SUPERBLOCK_BITS] + block_rank[k] + fbs.count(first, i - first);
+}
+
+size_t rank_select::count() {
+
+	refresh();
+
+	return super_rank[super_count.size()];
+}
+
+size_t rank_select::select1(size_t k) {
+
+	refresh();
+
+	if (k >= super_rank[super_count.size()]) return blength;
+
+	// Last superblock with fewer than k + 1 ones before it.
+	const size_t s = std::upper_bound(super_rank.begin(), super_rank.end(), k) - super_rank.begin() - 1;
+	k -= super_rank[s];
+
+	// Likewise for the blocks of that superblock.
+	const size_t first_block = s * BLOCKS_PER_SUPERBLOCK;
+	size_t last_block = first_block + BLOCKS_PER_SUPERBLOCK;
+	if (last_block > block_rank.size()) last_block = block_rank.size();
+	const size_t b = std::upper_bound(block_rank.begin() + first_block, block_rank.begin() + last_block, k) - block_rank.begin() - 1;
+	k -= block_rank[b];
+
+	// Scan the block.
+	size_t i = b * BLOCK_BITS;
+	for (; ; ++i) {
+		if (fbs[i] && k-- == 0) break;
+	}
+
+	return i;
+}
+
+void rank_select::set(size_t i, byte value) {
+
+	refresh();
+
+	if (i >= blength) throw "Bit index out of range.";
+
+	const bool was = fbs[i] != 0;
+	const bool is = value != 0;
+
+	fbs[i] = value;
+	if (was == is) return;
+
+	// Later blocks of the same superblock shift by one, and so do the ranks of
+	// all later superblocks, which are left to refresh() to recompute.
+	const size_t s = i / SUPERBLOCK_BITS;
+	size_t last_block = (s + 1) * BLOCKS_PER_SUPERBLOCK;
+	if (last_block > block_rank.size()) last_block = block_rank.size();
+
+	for (size_t k = i / BLOCK_BITS + 1; k < last_block; ++k)
+		block_rank[k] += is ? 1 : -1;
+
+	super_count[s] += is ? 1 : -1;
+	if (stale_from > s) stale_from = s;
+}
+
+void rank_select::invalidate(size_t from_bit) {
+
+	if (fbs.generation() != gen || fbs.length() != blength) {
+		build();
+		return;
+	}
+
+	if (from_bit > blength) from_bit = blength;
+
+	rebuild_from(from_bit / SUPERBLOCK_BITS);
+}
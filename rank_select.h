@@ -0,0 +1,83 @@
+/*
+ * rank_select.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _RANK_SELECT_H
+#define _RANK_SELECT_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * Rank/select directory over a fast_bitstring.
+ *
+ * Two levels of counts: a superblock count every 64K bits and a 16 bit
+ * count, relative to its superblock, every 512 bits.  That is 2 bytes per 512
+ * exploded bytes, well under 1% on top of the bitstring.
+ *
+ *	rank1(i)	number of 1's in bit[0, i): two lookups plus a vectorized
+ *			count of at most 511 bits, O(1).
+ *	select1(k)	index of the k'th 1, counting from 0: binary searches over
+ *			the superblocks then the blocks, then a scan of at most one
+ *			block, O(log n).
+ *
+ * The directory keeps track of the bitstring's generation() and rebuilds
+ * itself on the next query after any mutating method.  Single bits changed
+ * through set() update it in place instead; bits written through operator[]
+ * need a fast_bitstring::touch() or invalidate() to be noticed.
+ */
+class rank_select {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	static const size_t BLOCK_BITS = 512;
+	static const size_t SUPERBLOCK_BITS = 1 << 16;
+
+	rank_select(fast_bitstring &fbs);
+
+	// Number of 1's in bit[0, i).
+	size_t rank1(size_t i);
+	inline size_t rank0(size_t i) { return i - rank1(i); }
+
+	// Index of the k'th 1 (from 0), or length() if there are not that many.
+	size_t select1(size_t k);
+
+	// Total number of 1's.
+	size_t count();
+
+	// Set bit[i] to value, updating the directory in place.
+	void set(size_t i, byte value);
+
+	// Recount from the block holding bit i onward after writes through
+	// operator[].
+	void invalidate(size_t from_bit = 0);
+
+private:
+	void build();
+	void rebuild_from(size_t super);
+	void refresh();
+
+	fast_bitstring &fbs;
+	size_t gen;		// Generation of fbs the directory was built for.
+	size_t blength;		// Length of fbs the directory was built for.
+
+	std::vector<size_t> super_count;	// 1's in each superblock.
+	std::vector<size_t> super_rank;		// 1's before each superblock, valid below stale_from.
+	std::vector<uint16_t> block_rank;	// 1's before each block within its superblock.
+	size_t stale_from;	// First superblock whose super_rank needs recomputing.
+};
+
+#endif
@@ -0,0 +1,129 @@
+//
+// rle_index.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include <algorithm>
+
+#include "rle_index.h"
+
+
+// Decoded bits and encoded bytes of the block starting at rle_bytes[b].
+static inline size_t block_at(const fast_bitstring::byte *rle_bytes, size_t num_bytes, size_t b, size_t *n_bytes) {
+
+	if (rle_bytes[b] == 128) {
+		if (b + 1 >= num_bytes) throw "Truncated RLE encoding.";
+		const size_t nvb = rle_bytes[b + 1] + 1;
+		*n_bytes = 2 + fast_bitstring::bit_count_to_byte_count(nvb);
+		if (b + *n_bytes > num_bytes) throw "Truncated RLE encoding.";
+		return nvb;
+	}
+
+	*n_bytes = 1;
+	return rle_bytes[b] & 0x7F;
+}
+
+rle_index::rle_index(size_t interval)
+	: interval(interval ? interval : DEFAULT_INTERVAL), next_mark(0), rle_bytes(NULL), num_bytes(0), blength(0) {
+}
+
+rle_index::rle_index(const byte *rle_bytes, size_t num_bytes, size_t interval)
+	: interval(interval ? interval : DEFAULT_INTERVAL), next_mark(0), rle_bytes(NULL), num_bytes(0), blength(0) {
+
+	size_t b, bit, n;
+
+	for (b = bit = 0; b < num_bytes; b += n) {
+		note(bit, b);
+		bit += block_at(rle_bytes, num_bytes, b, &n);
+	}
+
+	this->rle_bytes = rle_bytes;
+	this->num_bytes = num_bytes;
+	blength = bit;
+}
+
+void rle_index::attach(const byte *rle_bytes, size_t num_bytes) {
+
+	size_t b = 0, bit = 0, n;
+
+	if (!bits.empty()) {
+		b = bytes.back();
+		bit = this->bits.back();
+	}
+
+	// Only the stretch after the last entry needs walking to find the length.
+	for (; b < num_bytes; b += n)
+		bit += block_at(rle_bytes, num_bytes, b, &n);
+
+	this->rle_bytes = rle_bytes;
+	this->num_bytes = num_bytes;
+	blength = bit;
+}
+
+// Return the offset of the guide byte of the block holding bit i, and the bit
+// offset that block starts at.
+size_t rle_index::seek(size_t i, size_t *bit_offset) const {
+
+	size_t b = 0, bit = 0, n, nb;
+
+	// Last entry at or before bit i.
+	std::vector<size_t>::const_iterator e = std::upper_bound(bits.begin(), bits.end(), i);
+	if (e != bits.begin()) {
+		--e;
+		bit = *e;
+		b = bytes[e - bits.begin()];
+	}
+
+	for (; b < num_bytes; b += n, bit += nb) {
+		nb = block_at(rle_bytes, num_bytes, b, &n);
+		if (bit + nb > i) break;
+	}
+
+	*bit_offset = bit;
+	return b;
+}
+
+rle_index::byte rle_index::get_bit(size_t i) const {
+
+	if (i >= blength) throw "Bit index out of range of RLE encoding.";
+
+	size_t bit;
+	const size_t b = seek(i, &bit);
+
+	if (rle_bytes[b] != 128)
+		return rle_bytes[b] >> 7;
+
+	i -= bit;
+	return (rle_bytes[b + 2 + i / 8] >> (7 - i % 8)) & 1;
+}
+
+size_t rle_index::decode_range(size_t first, size_t count, byte *dst) const {
+
+	if (first >= blength) return 0;
+	if (count > blength - first) count = blength - first;
+
+	size_t bit, n, nb, done = 0;
+	size_t b = seek(first, &bit);
+
+	// The first block may be entered part way through; after that whole blocks.
+	for (size_t skip = first - bit; done < count; b += n, skip = 0) {
+		nb = block_at(rle_bytes, num_bytes, b, &n) - skip;
+		if (nb > count - done) nb = count - done;
+
+		if (rle_bytes[b] == 128)
+			fast_bitstring::explode_bits(&dst[done], &rle_bytes[b + 2], skip, nb);
+		else
+			memset(&dst[done], rle_bytes[b] >> 7, nb);
+
+		done += nb;
+	}
+
+	return done;
+}
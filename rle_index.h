@@ -0,0 +1,85 @@
+/*
+ * rle_index.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _RLE_INDEX_H
+#define _RLE_INDEX_H
+
+#include <vector>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * Sparse random access index over an adaptive RLE encoding.
+ *
+ * Every "interval" bits or so the index notes the guide byte that starts the
+ * block holding that bit, so reading bit i only walks the guide bytes from the
+ * nearest preceding entry: O(interval) rather than O(n).  Entries are 2 words
+ * each, i.e., 16 bytes per 4096 bits at the default interval.
+ *
+ * The index either scans an existing encoding or is filled in by an
+ * rle_encoder as it encodes, then attached to the finished encoding.  It does
+ * not own the encoding, which must outlive it.
+ */
+class rle_index {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	static const size_t DEFAULT_INTERVAL = 4096;
+
+	// Empty index, to be filled in by an rle_encoder then attach()ed.
+	rle_index(size_t interval = DEFAULT_INTERVAL);
+
+	// Index an existing encoding with a single scan of its guide bytes.
+	rle_index(const byte *rle_bytes, size_t num_bytes, size_t interval = DEFAULT_INTERVAL);
+
+	// Note that the block starting at byte_offset of the encoding starts at
+	// bit_offset of the decoding.  Blocks must be noted in order.
+	inline void note(size_t bit_offset, size_t byte_offset) {
+		if (bit_offset >= next_mark) {
+			bits.push_back(bit_offset);
+			bytes.push_back(byte_offset);
+			next_mark = (bit_offset / interval + 1) * interval;
+		}
+	}
+
+	// Point the index at the encoding it describes.
+	void attach(const byte *rle_bytes, size_t num_bytes);
+
+	// Number of bits the encoding decodes to.
+	inline size_t length() const { return blength; }
+
+	// Number of index entries.
+	inline size_t size() const { return bits.size(); }
+
+	// Decode bit i alone.
+	byte get_bit(size_t i) const;
+
+	// Decode bits [first, first + count) into dst, one byte per bit.  Returns
+	// the number of bits decoded, which is less than count at the end.
+	size_t decode_range(size_t first, size_t count, byte *dst) const;
+
+private:
+	size_t seek(size_t i, size_t *bit_offset) const;
+
+	size_t interval;
+	size_t next_mark;
+	std::vector<size_t> bits;	// Decoded bit offset of each entry.
+	std::vector<size_t> bytes;	// Encoded byte offset of each entry.
+
+	const byte *rle_bytes;
+	size_t num_bytes;
+	size_t blength;
+};
+
+#endif
@@ -0,0 +1,253 @@
+//
+// rle_stream.cpp
+//
+// Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+//
+// The contents of this source code is protected by trade secret law and may not be viewed,
+// studied, compiled or otherwise utilized in any manner with out executing a binding non-
+// disclosure agreement including written permission of permissible use from Ken Hilton.
+// Furthermore, this source code contains both intellectual property and trade
+// secrets that are the exclusive propery of Ken Hilton.
+//
+
+#include "rle_index.h"
+#include "rle_stream.h"
+
+
+//
+// Encoder.
+//
+// The batch encoder is a greedy scan for runs of at most 127 equal bits: runs
+// longer than 8 are emitted as a run byte, shorter ones go into the pending
+// verbatim block, which is emitted when it would exceed 256 bits or a long
+// run follows it.  The only state that crosses a chunk boundary is therefore
+// the run being scanned and the pending verbatim block.
+//
+
+size_t rle_encoder::flush_verbatim(byte *out) {
+
+	assert(v > 0 && v <= 256);
+
+	const size_t n = fast_bitstring::bit_count_to_byte_count(v);
+
+	if (index) index->note(bits_out, bytes_out);
+	bits_out += v;
+	bytes_out += n + 2;
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->rle_verbatim_blocks, 1);
+	fbs_stats::add(stats->rle_verbatim_bits, v);
+
+	out[0] = 128;
+	out[1] = (byte)(v - 1);
+	memcpy(&out[2], verbatim, n);
+	memset(verbatim, 0, n);
+	v = 0;
+
+	return n + 2;
+}
+
+// The pending run is complete: emit it as a run, or add it to the verbatim bits.
+size_t rle_encoder::end_run(byte *out) {
+
+	size_t b = 0;
+
+	if (run_len > 8) {
+		if (v > 0) b += flush_verbatim(out);
+		if (index) index->note(bits_out, bytes_out);
+		bits_out += run_len;
+		bytes_out += 1;
+		out[b++] = (byte)(run_len + (run_value ? 128 : 0));
+
+		fbs_stats::counters *stats = fbs_stats::local();
+		fbs_stats::add(stats->rle_runs, 1);
+		fbs_stats::add(stats->rle_run_bits, run_len);
+		fbs_stats::add(stats->run_length[run_len], 1);
+	} else {
+		for (size_t k = 0; k < run_len; ++k) {
+			if (v == 256) b += flush_verbatim(&out[b]);
+			if (run_value & 1) verbatim[v / 8] |= 0x80 >> (v % 8);
+			++v;
+		}
+	}
+
+	run_len = 0;
+
+	return b;
+}
+
+size_t rle_encoder::encode(const byte *bits, size_t n_bits, byte *out) {
+
+	size_t b = 0, i = 0, k;
+	const uint64_t t0 = fbs_stats::now_ns();
+
+	while (i < n_bits) {
+		if (run_len == 0) {
+			run_value = bits[i];
+			run_len = 1;
+			++i;
+		} else if (bits[i] != run_value) {
+			b += end_run(&out[b]);
+			continue;
+		}
+
+		// Extend the pending run as far as this chunk and the 127 bit cap allow.
+		const size_t room = 127 - run_len;
+		const size_t avail = n_bits - i < room ? n_bits - i : room;
+		if (avail && bits[i] == run_value) {
+			k = fast_bitstring::scan_run(&bits[i], avail);
+			run_len += k;
+			i += k;
+		}
+
+		if (run_len == 127) b += end_run(&out[b]);
+	}
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->rle_encode_calls, 1);
+	fbs_stats::add(stats->rle_encode_bits, n_bits);
+	fbs_stats::add(stats->rle_encode_bytes, b);
+	fbs_stats::add(stats->rle_encode_ns, fbs_stats::now_ns() - t0);
+
+	return b;
+}
+
+size_t rle_encoder::encode_packed(const byte *bytes, size_t offset_in_bits, size_t n_bits, byte *out) {
+
+	byte scratch[4096];
+	size_t b = 0;
+
+	while (n_bits) {
+		const size_t n = n_bits < sizeof(scratch) ? n_bits : sizeof(scratch);
+		fast_bitstring::explode_bits(scratch, bytes, offset_in_bits, n);
+		b += encode(scratch, n, &out[b]);
+		offset_in_bits += n;
+		n_bits -= n;
+	}
+
+	return b;
+}
+
+size_t rle_encoder::finish(byte *out) {
+
+	size_t b = 0;
+
+	if (run_len) b += end_run(out);
+	if (v) b += flush_verbatim(&out[b]);
+
+	fbs_stats::add(fbs_stats::local()->rle_encode_bytes, b);
+
+	reset();
+
+	return b;
+}
+
+
+//
+// Decoder.
+//
+
+rle_decoder::rle_decoder(fast_bitstring::chunk_consumer consumer, void *context, size_t chunk_bits)
+	: consumer(consumer), context(context) {
+
+	// Room for at least one whole verbatim block.
+	this->chunk_bits = chunk_bits < 256 ? 256 : chunk_bits;
+	bits = (byte *)malloc(this->chunk_bits);
+	fill = offset = 0;
+	state = GUIDE;
+	nvb = n_partial = 0;
+}
+
+rle_decoder::~rle_decoder() {
+	free(bits);
+}
+
+int rle_decoder::flush() {
+
+	if (fill == 0) return 0;
+
+	int rc = consumer(bits, offset, fill, context);
+	offset += fill;
+	fill = 0;
+
+	return rc;
+}
+
+int rle_decoder::decode(const byte *rle_bytes, size_t num_bytes) {
+
+	size_t b = 0;
+	int rc;
+	const size_t bits_before = offset + fill;
+	const uint64_t t0 = fbs_stats::now_ns();
+
+	while (b < num_bytes) {
+
+		// Keep room for the largest block, a 256 bit verbatim one.
+		if (fill + 256 > chunk_bits && (rc = flush()) != 0) return rc;
+
+		switch (state) {
+		case GUIDE:
+			if (rle_bytes[b] == 128) {
+				state = COUNT;
+			} else {
+				memset(&bits[fill], rle_bytes[b] >> 7, rle_bytes[b] & 0x7F);
+				fill += rle_bytes[b] & 0x7F;
+			}
+			++b;
+			break;
+
+		case COUNT: {
+			nvb = rle_bytes[b++] + 1;
+			const size_t stride = fast_bitstring::bit_count_to_byte_count(nvb);
+			if (num_bytes - b >= stride) {
+				// Whole block in hand: explode it straight from the input.
+				fast_bitstring::explode_bits(&bits[fill], &rle_bytes[b], 0, nvb);
+				fill += nvb;
+				b += stride;
+				state = GUIDE;
+			} else {
+				n_partial = 0;
+				state = VERBATIM;
+			}
+			break;
+		}
+
+		case VERBATIM: {
+			const size_t stride = fast_bitstring::bit_count_to_byte_count(nvb);
+			size_t n = stride - n_partial;
+			if (n > num_bytes - b) n = num_bytes - b;
+			memcpy(&partial[n_partial], &rle_bytes[b], n);
+			n_partial += n;
+			b += n;
+			if (n_partial == stride) {
+				fast_bitstring::explode_bits(&bits[fill], partial, 0, nvb);
+				fill += nvb;
+				state = GUIDE;
+			}
+			break;
+		}
+		}
+	}
+
+	fbs_stats::counters *stats = fbs_stats::local();
+	fbs_stats::add(stats->rle_decode_calls, 1);
+	fbs_stats::add(stats->rle_decode_bytes, num_bytes);
+	fbs_stats::add(stats->rle_decode_bits, offset + fill - bits_before);
+	fbs_stats::add(stats->rle_decode_ns, fbs_stats::now_ns() - t0);
+
+	return 0;
+}
+
+int rle_decoder::finish() {
+
+	if (state != GUIDE) {
+		state = GUIDE;
+		fill = offset = 0;
+		throw "Truncated RLE encoding.";
+	}
+
+	int rc = flush();
+	offset = 0;
+
+	return rc;
+}
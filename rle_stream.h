@@ -0,0 +1,129 @@
+/*
+ * rle_stream.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _RLE_STREAM_H
+#define _RLE_STREAM_H
+
+#include "fast_bitstring.h"
+
+class rle_index;
+
+/*
+ * Incremental adaptive RLE encoder.
+ *
+ * Bits are fed in arbitrary chunks and the encoding comes out as it is
+ * decided, byte for byte identical to fast_bitstring::run_length_encode() of
+ * the concatenated input.  At most one run (127 bits) and one verbatim block
+ * (256 bits) are held back between calls, so memory use is constant.
+ *
+ * If given an rle_index the encoder notes each block it emits in it, so the
+ * index is ready to attach() to the finished encoding without a rescan.
+ */
+class rle_encoder {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	rle_encoder(rle_index *index = NULL) : index(index) { reset(); }
+
+	// Largest number of bytes a call encoding n_bits can produce; size the
+	// output buffer passed to encode() or encode_packed() accordingly.
+	static size_t max_encoded_length(size_t n_bits) {
+		return 3 + (2 * (n_bits + 127 + 256) + 4) / 5;
+	}
+
+	// Largest number of bytes finish() can produce.
+	static const size_t MAX_FINISH_LENGTH = 3 + 2 + 32;
+
+	// Encode n_bits bits, one per byte, appending to out.  Returns the number
+	// of bytes written.
+	size_t encode(const byte *bits, size_t n_bits, byte *out);
+
+	// As encode() but for bits packed 8 to a byte, skipping the first
+	// offset_in_bits bits of bytes.
+	size_t encode_packed(const byte *bytes, size_t offset_in_bits, size_t n_bits, byte *out);
+
+	// Encode whatever is held back and reset for a new stream.  Returns the
+	// number of bytes written.
+	size_t finish(byte *out);
+
+	void reset() {
+		run_len = 0;
+		v = 0;
+		bits_out = bytes_out = 0;
+		memset(verbatim, 0, sizeof(verbatim));
+	}
+
+private:
+	size_t end_run(byte *out);
+	size_t flush_verbatim(byte *out);
+
+	byte run_value;		// Value of the pending run.
+	size_t run_len;		// Length of the pending run, 0 if none.
+	byte verbatim[32];	// Pending verbatim bits, packed.
+	size_t v;		// Number of pending verbatim bits.
+
+	rle_index *index;	// Optional index of the blocks emitted.
+	size_t bits_out;	// Bits encoded by the blocks emitted so far.
+	size_t bytes_out;	// Bytes emitted so far.
+};
+
+
+/*
+ * Incremental adaptive RLE decoder.
+ *
+ * The encoding is fed in arbitrary chunks, split anywhere, including inside a
+ * verbatim block.  Decoded bits are handed to the consumer, one byte per bit,
+ * in chunks of up to chunk_bits, so memory use is constant.
+ */
+class rle_decoder {
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	rle_decoder(fast_bitstring::chunk_consumer consumer, void *context, size_t chunk_bits = 1 << 16);
+	~rle_decoder();
+
+	// Decode num_bytes more bytes of the encoding.  Returns 0, or the
+	// consumer's non-zero return if it asked to stop.
+	int decode(const byte *rle_bytes, size_t num_bytes);
+
+	// Hand any remaining decoded bits to the consumer and reset for a new
+	// stream.  Throws if the encoding ended part way through a verbatim block.
+	int finish();
+
+	// Total number of bits decoded so far.
+	inline size_t length() const { return offset + fill; }
+
+private:
+	rle_decoder(const rle_decoder &);
+	rle_decoder &operator =(const rle_decoder &);
+
+	int flush();
+
+	typedef enum { GUIDE, COUNT, VERBATIM } STATE;
+
+	fast_bitstring::chunk_consumer consumer;
+	void *context;
+
+	byte *bits;		// Decoded bits not yet handed to the consumer.
+	size_t chunk_bits;	// Capacity of bits.
+	size_t fill;		// Number of decoded bits held in bits.
+	size_t offset;		// Number of bits already handed to the consumer.
+
+	STATE state;
+	size_t nvb;		// Bit count of the current verbatim block.
+	byte partial[32];	// Verbatim bytes of the current block seen so far.
+	size_t n_partial;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * static_fast_bitstring.h
+ *
+ * Copyright (C) 2017-2020 Ken Hilton, all rights reserved.
+ *
+ * The contents of this source code is protected by trade secret law and may not be viewed,
+ * studied, compiled or otherwise utilized in any manner with out executing a binding non-
+ * disclosure agreement including written permission of permissible use from Ken Hilton.
+ * Furthermore, this source code contains both intellectual property and trade
+ * secrets that are the exclusive propery of Ken Hilton.
+ */
+
+#ifndef _STATIC_FAST_BITSTRING_H
+#define _STATIC_FAST_BITSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fast_bitstring.h"
+
+
+/*
+ * A bitstring of N bits fixed at compile time, for keys, masks and the like
+ * of a few hundred bits at most: the bits are held in the object itself, one
+ * byte (0 or 1) per bit as in fast_bitstring, so making one never touches the
+ * allocator, and every kernel runs to a trip count known at compile time.
+ *
+ * Everything but the conversions to and from views is constexpr, so keys can
+ * be built from packed literals at compile time:
+ *
+ *	static constexpr byte magic_bytes[] = { 0xFB, 0x01, 0xC0 };
+ *	constexpr static_fast_bitstring<18> magic(magic_bytes);
+ *	constexpr static_fast_bitstring<12> tag = static_fast_bitstring<12>::from_uint(0xABC);
+ *
+ * A static_fast_bitstring converts to a fast_bitstring_view of its bits, so
+ * any function taking a view, or a fast_bitstring constructor, takes one too.
+ */
+
+#define FBS_STATIC_UNROLL _Pragma("GCC unroll 64")
+
+template <size_t N>
+class static_fast_bitstring {
+
+	static_assert(N > 0, "static_fast_bitstring needs at least one bit.");
+
+public:
+	typedef fast_bitstring::byte byte;
+
+	// Bytes of the bits packed.
+	static constexpr size_t N_BYTES = (N + 7) / 8;
+
+	// All zero bits.
+	constexpr static_fast_bitstring() : bits{} {}
+
+	// From N bits packed in byte_array, skipping the first offset_in_bits bits.
+	constexpr explicit static_fast_bitstring(const byte *byte_array, size_t offset_in_bits = 0) : bits{} {
+		explode(byte_array, offset_in_bits);
+	}
+
+	// Copy bit[offset, offset + N) of a bitstring or view.
+	explicit static_fast_bitstring(const fast_bitstring_view &f, size_t offset = 0) {
+		if (offset > f.length() || N > f.length() - offset) throw "Invalid copy constructor parameters: offset + N > copy source length.";
+		FBS_STATIC_UNROLL
+		for (size_t i = 0; i < N; ++i)
+			bits[i] = f[offset + i] ? 1 : 0;
+	}
+
+	// The low N bits of v, for N <= 64, first bit most significant: the bits
+	// in the order a hexadecimal literal of them reads.
+	static constexpr static_fast_bitstring from_uint(uint64_t v) {
+		static_assert(N <= 64, "from_uint() takes at most 64 bits.");
+		static_fast_bitstring s;
+		for (size_t i = 0; i < N; ++i)
+			s.bits[i] = (v >> (N - 1 - i)) & 1;
+		return s;
+	}
+
+	operator fast_bitstring_view() const { return fast_bitstring_view(bits, N); }
+	fast_bitstring_view view() const { return fast_bitstring_view(bits, N); }
+
+	constexpr size_t length() const { return N; }
+	constexpr const byte *data() const { return bits; }
+
+	constexpr byte operator [](const size_t i) const { return bits[i]; }
+	constexpr void set(const size_t i, const byte bit = 1) { bits[i] = bit ? 1 : 0; }
+
+	// Overwrite the bits with N packed bits, skipping the first offset_in_bits
+	// bits of src, as fast_bitstring::explode_bits() does.
+	constexpr void explode(const byte *src, size_t offset_in_bits = 0) {
+
+		src += offset_in_bits / 8;
+		const unsigned shift = offset_in_bits % 8;
+		size_t i = 0;
+
+		FBS_STATIC_UNROLL
+		for (size_t k = 0; k < N / 8; ++k, i += 8) {
+			const byte b = shift ? (byte)(src[k] << shift | src[k + 1] >> (8 - shift)) : src[k];
+			store8(&bits[i], spread8(b));
+		}
+		for (; i < N; ++i) {
+			const size_t j = shift + i;
+			bits[i] = (src[j / 8] >> (7 - j % 8)) & 1;
+		}
+	}
+
+	// Pack the bits into dst[0, N_BYTES), zero filling the last byte, as
+	// fast_bitstring::pack_bits() does.  Returns N_BYTES.
+	constexpr size_t pack(byte *dst) const {
+
+		size_t i = 0;
+
+		FBS_STATIC_UNROLL
+		for (size_t k = 0; k < N / 8; ++k, i += 8)
+			dst[k] = gather8(&bits[i]);
+		if (i < N) {
+			byte b = 0;
+			for (size_t j = 0; i + j < N; ++j)
+				b |= bits[i + j] << (7 - j);
+			dst[N / 8] = b;
+		}
+
+		return N_BYTES;
+	}
+
+	// Number of 1 bits.
+	constexpr size_t count() const {
+
+		size_t n = 0, i = 0;
+
+		// The bytes are 0 or 1, so the multiply sums them into the top byte.
+		FBS_STATIC_UNROLL
+		for (; i + 8 <= N; i += 8)
+			n += load8(&bits[i]) * 0x0101010101010101ULL >> 56;
+		for (; i < N; ++i)
+			n += bits[i];
+
+		return n;
+	}
+
+	// Index of the first bit that differs from that, or N if there is none.
+	constexpr size_t first_difference(const static_fast_bitstring &that) const {
+
+		size_t i = 0;
+
+		FBS_STATIC_UNROLL
+		for (; i + 8 <= N; i += 8)
+			if (load8(&bits[i]) != load8(&that.bits[i])) break;
+		while (i < N && bits[i] == that.bits[i])
+			++i;
+
+		return i;
+	}
+
+	// As for fast_bitstring_view: the first differing bit decides.
+	constexpr int compare(const static_fast_bitstring &that) const {
+		const size_t i = first_difference(that);
+		return i == N ? 0 : bits[i] ? 1 : -1;
+	}
+
+	constexpr bool operator ==(const static_fast_bitstring &that) const { return first_difference(that) == N; }
+	constexpr bool operator !=(const static_fast_bitstring &that) const { return first_difference(that) != N; }
+	constexpr bool operator <(const static_fast_bitstring &that) const { return compare(that) < 0; }
+
+	constexpr size_t hamming_distance(const static_fast_bitstring &that) const {
+
+		size_t n = 0, i = 0;
+
+		FBS_STATIC_UNROLL
+		for (; i + 8 <= N; i += 8)
+			n += (load8(&bits[i]) ^ load8(&that.bits[i])) * 0x0101010101010101ULL >> 56;
+		for (; i < N; ++i)
+			n += bits[i] ^ that.bits[i];
+
+		return n;
+	}
+
+private:
+	// 8 bytes as a word, p[k] in byte k.  Written out byte by byte to stay
+	// constexpr; GCC merges the bytes into a single load or store.
+	static constexpr uint64_t load8(const byte *p) {
+		return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		       (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+	}
+
+	static constexpr void store8(byte *p, uint64_t w) {
+		p[0] = (byte)w; p[1] = (byte)(w >> 8); p[2] = (byte)(w >> 16); p[3] = (byte)(w >> 24);
+		p[4] = (byte)(w >> 32); p[5] = (byte)(w >> 40); p[6] = (byte)(w >> 48); p[7] = (byte)(w >> 56);
+	}
+
+	// b exploded: byte k is bit 7 - k of b.  The multiply copies b to every
+	// byte, the mask keeps one bit in each, and adding 0x7F carries a set bit
+	// up to bit 7 without reaching the next byte.
+	static constexpr uint64_t spread8(byte b) {
+		const uint64_t w = (b * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+		return (w + 0x7F7F7F7F7F7F7F7FULL) >> 7 & 0x0101010101010101ULL;
+	}
+
+	// The inverse for bytes of 0 or 1: the multiply moves byte k to bit
+	// 63 - k, the partial products never overlapping, so carrying nothing.
+	static constexpr byte gather8(const byte *p) {
+		return (byte)(load8(p) * 0x8040201008040201ULL >> 56);
+	}
+
+	byte bits[N];
+};
+
+#undef FBS_STATIC_UNROLL
+
+#endif
@@ -15,7 +15,19 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <thread>
+
+#include "bit_cursor.h"
+#include "bit_search.h"
 #include "fast_bitstring.h"
+#include "fbs_codec.h"
+#include "fast_packed_bitstring.h"
+#include "hybrid_fast_bitstring.h"
+#include "lazy_fast_bitstring.h"
+#include "rank_select.h"
+#include "rle_index.h"
+#include "rle_stream.h"
+#include "static_fast_bitstring.h"
 
 
 static size_t file_size(const char *filename) {
@@ -27,6 +39,15 @@ static size_t file_size(const char *filename) {
 }
 
 
+// Deterministic pseudo random bytes so failures reproduce.
+static void fill_random(fast_bitstring::byte *bytes, size_t n, unsigned int seed = 1) {
+	for (size_t i = 0; i < n; ++i) {
+		seed = seed * 1103515245 + 12345;
+		bytes[i] = (fast_bitstring::byte)(seed >> 16);
+	}
+}
+
+
 int test_create() {
 
 	printf("\tTest create...\n");
@@ -128,6 +149,13 @@ int test_to_byte() {
 	assert(num_bytes == sizeof(bytes));
 	assert(strncmp((const char *)bytes, (const char *)out_bytes, sizeof(bytes)) == 0);
 
+	// to_byte() at and between byte boundaries, zero filled past the end.
+	for (size_t i = 0; i < sizeof(bytes); ++i)
+		assert(fbs.to_byte(i * 8) == bytes[i]);
+	assert(fbs.to_byte(4) == 0xF5);
+	assert(fbs.to_byte(8 * sizeof(bytes) - 3) == 0xE0);
+	assert(fbs.to_byte(8 * sizeof(bytes)) == 0);
+
 	return 1;
 }
 
@@ -228,6 +256,349 @@ int test_rle() {
 		free(rle_bytes);
         }
 
+        if (1) {
+		// Runs of 9 1's each followed by a single 0: the worst case encoding.
+	        fast_bitstring fbs(1000, fast_bitstring::FROM_BITS);
+		for (size_t i = 0; i < fbs.length(); ++i)
+			fbs[i] = (i % 10) < 9;
+		fast_bitstring::byte *rle_bytes = NULL;
+	        size_t num_bytes = fbs.run_length_encode(&rle_bytes);
+                assert(num_bytes <= fbs.run_length_encode(NULL));
+                assert(num_bytes == 400);
+
+	        fast_bitstring *rld = fast_bitstring::run_length_decode(rle_bytes, num_bytes);
+                assert(fbs.compare(*rld) == 0);
+
+		delete rld;
+		free(rle_bytes);
+        }
+
+        if (1) {
+		// Verbatim blocks longer than 256 bits and runs longer than 127 bits.
+	        fast_bitstring fbs(1200, fast_bitstring::FROM_BITS);
+		for (size_t i = 0; i < 600; ++i)
+			fbs[i] = (i / 2) & 1;
+		for (size_t i = 600; i < fbs.length(); ++i)
+			fbs[i] = 1;
+		fast_bitstring::byte *rle_bytes = NULL;
+	        size_t num_bytes = fbs.run_length_encode(&rle_bytes);
+		// The 0011 pattern ends in 1's, so 256 + 256 + 86 verbatim bits, then
+		// 602 1's as 4 runs of 127 + a run of 94.
+                assert(num_bytes == (2 + 32) + (2 + 32) + (2 + 11) + 5);
+                assert(rle_bytes[0] == 128 && rle_bytes[1] == 255);
+                assert(rle_bytes[34] == 128 && rle_bytes[35] == 255);
+                assert(rle_bytes[68] == 128 && rle_bytes[69] == 85);
+                assert(rle_bytes[81] == 255 && rle_bytes[85] == 128 + 94);
+
+	        fast_bitstring *rld = fast_bitstring::run_length_decode(rle_bytes, num_bytes);
+                assert(fbs.compare(*rld) == 0);
+
+		delete rld;
+		free(rle_bytes);
+        }
+
+	return 1;
+}
+
+int test_rle_decode() {
+
+	printf("\tTest rle decode...\n");
+
+	fast_bitstring fbs((char *)"./test.bin");
+	fast_bitstring::byte *rle_bytes = NULL;
+	size_t num_bytes = fbs.run_length_encode(&rle_bytes);
+
+	assert(fast_bitstring::run_length_decoded_length(rle_bytes, num_bytes) == fbs.length());
+
+	// Known length: single pass.
+	{
+		fast_bitstring *rld = fast_bitstring::run_length_decode(rle_bytes, num_bytes, fbs.length());
+		assert(fbs.compare(*rld) == 0);
+		delete rld;
+	}
+
+	// Wrong known lengths are rejected.
+	{
+		bool threw = false;
+		try { fast_bitstring::run_length_decode(rle_bytes, num_bytes, fbs.length() - 1); } catch (const char *) { threw = true; }
+		assert(threw);
+		threw = false;
+		try { fast_bitstring::run_length_decode(rle_bytes, num_bytes, fbs.length() + 1); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Into a preallocated fast_bitstring at an offset.
+	{
+		fast_bitstring dst(fbs.length() + 5, fast_bitstring::FROM_BITS);
+		dst.set_all(7);
+		assert(fast_bitstring::run_length_decode_into(rle_bytes, num_bytes, dst, 3) == fbs.length());
+		assert(dst[0] == 7 && dst[1] == 7 && dst[2] == 7 && dst[dst.length() - 1] == 7);
+		fast_bitstring decoded(dst, fbs.length(), 3);
+		assert(fbs.compare(decoded) == 0);
+	}
+
+	// Into a raw buffer, which must be large enough.
+	{
+		fast_bitstring::byte *bits = (fast_bitstring::byte *)malloc(fbs.length());
+		assert(fast_bitstring::run_length_decode_into(rle_bytes, num_bytes, bits, fbs.length()) == fbs.length());
+		assert(memcmp(bits, &fbs[0], fbs.length()) == 0);
+
+		bool threw = false;
+		try { fast_bitstring::run_length_decode_into(rle_bytes, num_bytes, bits, fbs.length() - 1); } catch (const char *) { threw = true; }
+		assert(threw);
+		free(bits);
+	}
+
+	// Truncated encodings.
+	{
+		fast_bitstring::byte verbatim[] = {128, 15, 0xAA};
+		bool threw = false;
+		try { fast_bitstring::run_length_decoded_length(verbatim, sizeof(verbatim)); } catch (const char *) { threw = true; }
+		assert(threw);
+		threw = false;
+		fast_bitstring::byte bits[16];
+		try { fast_bitstring::run_length_decode_into(verbatim, sizeof(verbatim), bits, sizeof(bits)); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	free(rle_bytes);
+
+	return 1;
+}
+
+static int collect_bits(const fast_bitstring::byte *bits, size_t offset_in_bits, size_t n_bits, void *context) {
+	fast_bitstring *dst = (fast_bitstring *)context;
+	assert(offset_in_bits + n_bits <= dst->length());
+	memcpy(&(*dst)[offset_in_bits], bits, n_bits);
+	return 0;
+}
+
+int test_rle_stream() {
+
+	printf("\tTest rle stream...\n");
+
+	fast_bitstring::byte bytes[1024];
+	fill_random(bytes, sizeof(bytes), 11);
+
+	// Random data, long runs and 256+ bit verbatim blocks.
+	fast_bitstring fbs((char *)"./test.bin");
+	for (size_t i = 0; i < 3000; ++i)
+		fbs[i] = (i / 700) & 1;
+	for (size_t i = 3000; i < 3600; ++i)
+		fbs[i] = (i / 2) & 1;
+
+	fast_bitstring::byte *expected = NULL;
+	const size_t n_expected = fbs.run_length_encode(&expected);
+
+	const size_t max_len = rle_encoder::max_encoded_length(fbs.length()) + rle_encoder::MAX_FINISH_LENGTH;
+	fast_bitstring::byte *out = (fast_bitstring::byte *)malloc(max_len);
+
+	for (unsigned int seed = 1; seed < 20; ++seed) {
+
+		// Chunk sizes come from r, stepped per chunk, each seed giving a
+		// different sequence.
+		unsigned int r = seed * sizeof(bytes) / 20;
+
+		// Encode in random sized chunks, exploded and packed.
+		rle_encoder enc;
+		size_t n = 0;
+		for (size_t i = 0, k = 0; i < fbs.length(); i += k, ++r) {
+			k = 1 + (bytes[r % sizeof(bytes)] * seed) % 300;
+			if (i + k > fbs.length()) k = fbs.length() - i;
+			const size_t before = n;
+			n += enc.encode(&fbs[i], k, &out[n]);
+			assert(n - before <= rle_encoder::max_encoded_length(k));
+		}
+		n += enc.finish(&out[n]);
+		assert(n == n_expected);
+		assert(memcmp(out, expected, n) == 0);
+
+		fast_bitstring::byte packed[1024];
+		assert(fbs.to_bytes(packed) == sizeof(packed));
+		n = enc.encode_packed(packed, 0, 5, out);
+		n += enc.encode_packed(packed, 5, fbs.length() - 5, &out[n]);
+		n += enc.finish(&out[n]);
+		assert(n == n_expected);
+		assert(memcmp(out, expected, n) == 0);
+
+		// Decode in random sized chunks, split anywhere.
+		fast_bitstring decoded(fbs.length(), fast_bitstring::FROM_BITS);
+		rle_decoder dec(collect_bits, &decoded, 300 + seed);
+		for (size_t i = 0, k = 0; i < n_expected; i += k, ++r) {
+			k = 1 + (bytes[r % sizeof(bytes)] * seed) % 40;
+			if (i + k > n_expected) k = n_expected - i;
+			assert(dec.decode(&expected[i], k) == 0);
+		}
+		assert(dec.finish() == 0);
+		assert(fbs.compare(decoded) == 0);
+	}
+
+	// A stream that ends inside a verbatim block.
+	{
+		fast_bitstring decoded(64, fast_bitstring::FROM_BITS);
+		rle_decoder dec(collect_bits, &decoded);
+		fast_bitstring::byte truncated[] = {0x8A, 128, 15, 0xAA};
+		assert(dec.decode(truncated, sizeof(truncated)) == 0);
+		bool threw = false;
+		try { dec.finish(); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	free(out);
+	free(expected);
+
+	return 1;
+}
+
+int test_rle_parallel() {
+
+	printf("\tTest rle parallel...\n");
+
+	// Big enough for 4 threads: random stretches, long runs and verbatim blocks.
+	const size_t n = 5 << 20;
+	fast_bitstring::byte *bytes = (fast_bitstring::byte *)malloc(n / 8);
+	fill_random(bytes, n / 8, 5);
+	for (size_t i = n / 32; i < n / 16; ++i)
+		bytes[i] = 0;
+	for (size_t i = n / 12; i < n / 10; ++i)
+		bytes[i] = 0xF0;
+	fast_bitstring fbs(bytes, n / 8);
+	free(bytes);
+
+	fast_bitstring::byte *serial = NULL;
+	const size_t n_serial = fbs.run_length_encode(&serial);
+
+	for (size_t threads = 1; threads <= 5; ++threads) {
+		fast_bitstring::byte *rle_bytes = NULL;
+		const size_t num_bytes = fbs.run_length_encode_parallel(&rle_bytes, threads);
+		assert(fast_bitstring::run_length_decoded_length(rle_bytes, num_bytes) == n);
+
+		fast_bitstring *rld = fast_bitstring::run_length_decode_parallel(rle_bytes, num_bytes, threads);
+		assert(fbs.compare(*rld) == 0);
+		delete rld;
+
+		rld = fast_bitstring::run_length_decode_parallel(serial, n_serial, threads);
+		assert(fbs.compare(*rld) == 0);
+		delete rld;
+
+		free(rle_bytes);
+	}
+
+	free(serial);
+
+	return 1;
+}
+
+// Runs the tasks last to first on the calling thread, counting them.
+static void reverse_executor(size_t n_tasks, fast_bitstring::task_fn fn, void *context, void *exec_context) {
+
+	*(size_t *)exec_context += n_tasks;
+	for (size_t k = n_tasks; k-- > 0; )
+		fn(k, context);
+}
+
+int test_explode_parallel() {
+
+	printf("\tTest explode parallel...\n");
+
+	// Big enough for 3 threads, with a ragged tail.
+	const size_t n = (3 << 23) + 4101;
+	const size_t n_bytes = n / 8 + 2;
+	fast_bitstring::byte *bytes = (fast_bitstring::byte *)malloc(n_bytes);
+	fill_random(bytes, n_bytes, 7);
+
+	fast_bitstring::byte *serial = (fast_bitstring::byte *)malloc(n);
+	fast_bitstring::byte *parallel = (fast_bitstring::byte *)malloc(n);
+	fast_bitstring::byte *packed = (fast_bitstring::byte *)malloc(n_bytes);
+
+	for (size_t offset = 0; offset < 10; offset += 5) {
+		const size_t n_bits = n - offset;
+		fast_bitstring::explode_bits(serial, bytes, offset, n_bits);
+
+		for (size_t threads = 1; threads <= 4; ++threads) {
+			memset(parallel, 0xAA, n);
+			fast_bitstring::explode_bits_parallel(parallel, bytes, offset, n_bits, threads);
+			assert(memcmp(serial, parallel, n_bits) == 0);
+
+			// Unaligned output, so the first and last pieces are part pages.
+			memset(packed, 0xAA, n_bytes);
+			const size_t num_bytes = fast_bitstring::pack_bits_parallel(packed + 1, serial, n_bits, threads);
+			assert(num_bytes == (n_bits + 7) / 8);
+			fast_bitstring::explode_bits(parallel, packed + 1, 0, n_bits);
+			assert(memcmp(serial, parallel, n_bits) == 0);
+		}
+
+		size_t n_tasks = 0;
+		fast_bitstring *exploded = fast_bitstring::explode_parallel(bytes, offset, n_bits, 3, reverse_executor, &n_tasks);
+		assert(n_tasks == 3);
+		assert(exploded->length() == n_bits);
+		assert(memcmp(serial, &(*exploded)[0], n_bits) == 0);
+
+		n_tasks = 0;
+		memset(packed, 0, n_bytes);
+		assert(exploded->to_bytes_parallel(packed, 3, 0, 3, reverse_executor, &n_tasks) == (n_bits - 3 + 7) / 8);
+		assert(n_tasks == 3);
+		fast_bitstring::explode_bits(parallel, packed, 0, n_bits - 3);
+		assert(memcmp(serial + 3, parallel, n_bits - 3) == 0);
+		delete exploded;
+	}
+
+	free(packed);
+	free(parallel);
+	free(serial);
+	free(bytes);
+
+	return 1;
+}
+
+int test_rle_index() {
+
+	printf("\tTest rle index...\n");
+
+	fast_bitstring fbs((char *)"./test.bin");
+	for (size_t i = 2000; i < 5000; ++i)
+		fbs[i] = (i / 300) & 1;
+
+	fast_bitstring::byte *rle_bytes = NULL;
+	const size_t num_bytes = fbs.run_length_encode(&rle_bytes);
+
+	// Built by scanning, and by the encoder as it encodes.
+	rle_index scanned(rle_bytes, num_bytes, 512);
+
+	rle_index built(512);
+	rle_encoder enc(&built);
+	fast_bitstring::byte *out = (fast_bitstring::byte *)malloc(num_bytes + rle_encoder::MAX_FINISH_LENGTH);
+	size_t n = enc.encode(&fbs[0], 3333, out);
+	n += enc.encode(&fbs[3333], fbs.length() - 3333, &out[n]);
+	n += enc.finish(&out[n]);
+	assert(n == num_bytes);
+	built.attach(out, n);
+
+	rle_index *indexes[] = { &scanned, &built };
+	for (int k = 0; k < 2; ++k) {
+		rle_index &index = *indexes[k];
+		assert(index.length() == fbs.length());
+		assert(index.size() >= fbs.length() / 512);
+
+		for (size_t i = 0; i < fbs.length(); ++i)
+			assert(index.get_bit(i) == fbs[i]);
+
+		fast_bitstring::byte window[700];
+		for (size_t first = 0; first < fbs.length(); first += 97) {
+			const size_t got = index.decode_range(first, sizeof(window), window);
+			const size_t want = fbs.length() - first < sizeof(window) ? fbs.length() - first : sizeof(window);
+			assert(got == want);
+			assert(memcmp(window, &fbs[first], got) == 0);
+		}
+
+		bool threw = false;
+		try { index.get_bit(fbs.length()); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	free(out);
+	free(rle_bytes);
+
 	return 1;
 }
 
@@ -247,19 +618,1629 @@ int test_reverse() {
 }
 
 
+int test_explode() {
+
+	printf("\tTest explode...\n");
+
+	fast_bitstring::byte bytes[300];
+	fast_bitstring::byte expected[sizeof(bytes) * 8];
+	fill_random(bytes, sizeof(bytes));
+
+	for (size_t i = 0; i < sizeof(expected); ++i)
+		expected[i] = (bytes[i / 8] >> (7 - (i % 8))) & 1;
+
+	const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+
+	// Every supported kernel, every sub-byte offset and a spread of lengths so
+	// both the vector bodies and the scalar heads and tails are covered.
+	for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+		if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+			continue;
+		for (size_t offset = 0; offset < 17; ++offset) {
+			for (size_t len = 0; offset + len <= sizeof(expected); len += 1 + len / 3) {
+				fast_bitstring fbs(bytes, offset, len);
+				assert(fbs.length() == len);
+				for (size_t i = 0; i < len; ++i)
+					assert(fbs[i] == expected[offset + i]);
+			}
+		}
+	}
+
+	fast_bitstring::set_simd_level(best);
+
+	return 1;
+}
+
+
+int test_pack() {
+
+	printf("\tTest pack...\n");
+
+	fast_bitstring::byte bits[2500];
+	fast_bitstring::byte expected[sizeof(bits) / 8 + 1];
+	fast_bitstring::byte out[sizeof(expected)];
+
+	// Only the low bit of each byte counts, as in the original to_bytes().
+	fill_random(bits, sizeof(bits), 7);
+	fast_bitstring fbs(sizeof(bits), fast_bitstring::FROM_BITS);
+	for (size_t i = 0; i < sizeof(bits); ++i)
+		fbs[i] = bits[i] & 0x81;
+
+	const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+
+	for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+		if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+			continue;
+		for (size_t offset = 0; offset < 19; offset += 3) {
+			for (size_t len = 1; offset + len <= sizeof(bits); len += 1 + len / 2) {
+				memset(expected, 0, sizeof(expected));
+				for (size_t i = 0; i < len; ++i)
+					expected[i / 8] |= (bits[offset + i] & 1) << (7 - (i % 8));
+
+				size_t n = fbs.to_bytes(out, offset, len);
+				assert(n == (len + 7) / 8);
+				assert(n == fbs.to_bytes(NULL, offset, len));
+				assert(memcmp(out, expected, n) == 0);
+			}
+		}
+	}
+
+	fast_bitstring::set_simd_level(best);
+
+	// Round trip through explode.
+	{
+		fast_bitstring::byte bytes[123];
+		fill_random(bytes, sizeof(bytes), 3);
+		fast_bitstring rt(bytes, sizeof(bytes));
+		assert(rt.to_bytes(out) == sizeof(bytes));
+		assert(memcmp(out, bytes, sizeof(bytes)) == 0);
+	}
+
+	return 1;
+}
+
+
+int test_lazy() {
+
+	printf("\tTest lazy...\n");
+
+	fast_bitstring fbs((char *)"./test.bin");
+
+	// Small blocks and a budget of one block so reads force evictions.
+	lazy_fast_bitstring lazy("./test.bin", 4096, 1);
+	assert(lazy.length() == fbs.length());
+	assert(lazy.resident_blocks() == 0);
+
+	const size_t bb = lazy.block_bits();
+	assert(bb >= 4096 && (bb & (bb - 1)) == 0);
+
+	for (size_t i = 0; i < fbs.length(); i += 7)
+		assert(lazy[i] == fbs[i]);
+	assert(lazy.resident_blocks() == 1);
+
+	// Walk backwards across block boundaries, re-exploding evicted blocks.
+	for (size_t i = fbs.length(); i-- > 0; )
+		assert(lazy[i] == fbs[i]);
+
+	lazy.evict();
+	assert(lazy.resident_blocks() == 0);
+	assert(lazy[fbs.length() / 2] == fbs[fbs.length() / 2]);
+
+	// Bulk reads.
+	fast_bitstring::byte exploded[1000], packed[130], expected[130];
+	assert(lazy.copy(exploded, 13, sizeof(exploded)) == sizeof(exploded));
+	assert(memcmp(exploded, &fbs[13], sizeof(exploded)) == 0);
+
+	for (size_t offset = 0; offset < 9; ++offset) {
+		size_t n = lazy.to_bytes(packed, offset, 1001);
+		assert(n == fbs.to_bytes(expected, offset, 1001));
+		assert(memcmp(packed, expected, n) == 0);
+	}
+
+	fast_bitstring *s = lazy.slice(101, 555);
+	fast_bitstring t(fbs, 555, 101);
+	assert(s->compare(t) == 0);
+	delete s;
+
+	return 1;
+}
+
+
+typedef struct {
+	fast_bitstring *expected;
+	size_t n_bits;
+	size_t n_chunks;
+	size_t stop_after;
+} stream_check;
+
+static int check_chunk(const fast_bitstring::byte *bits, size_t offset_in_bits, size_t n_bits, void *context) {
+
+	stream_check *c = (stream_check *)context;
+
+	assert(offset_in_bits == c->n_bits);
+	assert(memcmp(bits, &(*c->expected)[offset_in_bits], n_bits) == 0);
+	c->n_bits += n_bits;
+
+	return ++c->n_chunks == c->stop_after ? 42 : 0;
+}
+
+static int throw_chunk(const fast_bitstring::byte *bits, size_t offset_in_bits, size_t n_bits, void *context) {
+	if (offset_in_bits > 0) throw "Consumer failed.";
+	return 0;
+}
+
+int test_stream() {
+
+	printf("\tTest stream...\n");
+
+	fast_bitstring::byte bytes[1024];
+	FILE *f = fopen("./test.bin", "rb");
+	assert(fread(bytes, 1, sizeof(bytes), f) == sizeof(bytes));
+	fclose(f);
+	fast_bitstring expected(bytes, sizeof(bytes));
+
+	// Pipelined load, with a chunk size that leaves a partial last chunk.
+	{
+		fast_bitstring fbs((char *)"./test.bin", 100);
+		assert(fbs.compare(expected) == 0);
+	}
+
+	// Streaming to a consumer.
+	{
+		stream_check c = { &expected, 0, 0, 0 };
+		assert(fast_bitstring::stream("./test.bin", check_chunk, &c, 100) == 0);
+		assert(c.n_bits == expected.length());
+		assert(c.n_chunks == 11);
+	}
+
+	// Consumer stops early.
+	{
+		stream_check c = { &expected, 0, 0, 3 };
+		assert(fast_bitstring::stream("./test.bin", check_chunk, &c, 100) == 42);
+		assert(c.n_chunks == 3);
+	}
+
+	// Consumer throws: the reader is stopped and the exception passed on.
+	{
+		bool threw = false;
+		try {
+			fast_bitstring::stream("./test.bin", throw_chunk, NULL, 100);
+		} catch (const char *) {
+			threw = true;
+		}
+		assert(threw);
+	}
+
+	assert(fast_bitstring::stream("./no_such_file.bin", check_chunk, NULL) == ENOENT);
+	assert(fast_bitstring::stream("./test.bin", check_chunk, NULL, ~(size_t)0 / 4) == ENOMEM);
+
+	return 1;
+}
+
+
+int test_packed() {
+
+	printf("\tTest packed...\n");
+
+	fast_bitstring::byte bytes[301];
+	fill_random(bytes, sizeof(bytes), 13);
+	memset(&bytes[100], 0, 40);
+
+	// Same bits as the exploded form, however constructed.
+	for (size_t offset = 0; offset < 10; offset += 3) {
+		const size_t len = sizeof(bytes) * 8 - offset - 5;
+		fast_bitstring fbs(bytes, offset, len);
+		fast_packed_bitstring pbs(bytes, offset, len);
+		fast_packed_bitstring from_fbs(fbs);
+		assert(pbs.length() == len);
+		assert(pbs.compare(from_fbs) == 0);
+		for (size_t i = 0; i < len; ++i)
+			assert(pbs[i] == fbs[i]);
+
+		fast_bitstring *back = pbs.to_fast_bitstring();
+		assert(back->compare(fbs) == 0);
+		delete back;
+
+		// to_bytes
+		fast_bitstring::byte a[sizeof(bytes)], b[sizeof(bytes)];
+		for (size_t o = 0; o < 20; o += 7) {
+			assert(pbs.to_bytes(a, o, 999) == fbs.to_bytes(b, o, 999));
+			assert(memcmp(a, b, fbs.to_bytes(NULL, o, 999)) == 0);
+		}
+		assert(pbs.to_bytes(a) == fbs.to_bytes(b));
+		assert(memcmp(a, b, fbs.to_bytes(NULL)) == 0);
+
+		// reverse
+		fbs.reverse();
+		pbs.reverse();
+		fast_packed_bitstring reversed(fbs);
+		assert(pbs.compare(reversed) == 0);
+
+		// RLE, byte for byte the same as the exploded encoder.
+		fast_bitstring::byte *e1 = NULL, *e2 = NULL;
+		const size_t n1 = fbs.run_length_encode(&e1);
+		const size_t n2 = pbs.run_length_encode(&e2);
+		assert(n1 == n2 && memcmp(e1, e2, n1) == 0);
+		fast_packed_bitstring *rld = fast_packed_bitstring::run_length_decode(e2, n2);
+		assert(rld->compare(pbs) == 0);
+		delete rld;
+		free(e1);
+		free(e2);
+	}
+
+	// Bit proxy and ordering.
+	{
+		fast_packed_bitstring pbs(70, fast_bitstring::FROM_BITS);
+		fast_packed_bitstring other(pbs);
+		assert(pbs[69] == 0);
+		pbs[69] = 1;
+		assert(pbs[69] == 1);
+		pbs[69] = !pbs[69];
+		assert(pbs[69] == 0);
+		pbs[3] = pbs[2] = 1;
+		assert(pbs[3] == 1 && pbs.compare(other) == 1 && other.compare(pbs) == -1);
+		pbs.set_all();
+		assert(pbs[69] == 1 && pbs.bytes()[8] == 0xFC && pbs.bytes()[9] == 0);
+		pbs.clear();
+		assert(pbs.compare(other) == 0);
+	}
+
+	// save
+	{
+		fast_packed_bitstring pbs(bytes, sizeof(bytes));
+		unlink("./foo.out");
+		assert(pbs.save("./foo.out") == sizeof(bytes));
+		fast_bitstring loaded((char *)"./foo.out");
+		fast_packed_bitstring from_loaded(loaded);
+		assert(pbs.compare(from_loaded) == 0);
+		assert(unlink("./foo.out") == 0);
+	}
+
+	return 1;
+}
+
+
+int test_rank_select() {
+
+	printf("\tTest rank select...\n");
+
+	const size_t n = 3 * rank_select::SUPERBLOCK_BITS + 777;
+	fast_bitstring::byte *bytes = (fast_bitstring::byte *)malloc(n / 8 + 1);
+	fill_random(bytes, n / 8 + 1, 17);
+	memset(&bytes[1000], 0, 9000);
+	fast_bitstring fbs(bytes, 0, n);
+	free(bytes);
+
+	// count() at every SIMD level, on any byte values and misaligned ends.
+	{
+		const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+		fast_bitstring::byte bits[300];
+		fill_random(bits, sizeof(bits), 5);
+		for (size_t i = 0; i < sizeof(bits); ++i)
+			if (i % 3 == 0) bits[i] = 0;
+
+		for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+			if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+				continue;
+			for (size_t offset = 0; offset < 70; offset += 9) {
+				for (size_t len = 0; offset + len <= sizeof(bits); len += 1 + len / 3) {
+					size_t expected = 0;
+					for (size_t i = 0; i < len; ++i)
+						expected += bits[offset + i] != 0;
+					assert(fast_bitstring::count_bits(&bits[offset], len) == expected);
+				}
+			}
+		}
+		fast_bitstring::set_simd_level(best);
+	}
+
+	std::vector<size_t> ones;
+	for (size_t i = 0; i < n; ++i)
+		if (fbs[i]) ones.push_back(i);
+
+	rank_select rs(fbs);
+	assert(rs.count() == ones.size());
+	assert(fbs.count() == ones.size());
+
+	// rank1 against a running count, select1 against the positions.
+	{
+		size_t r = 0;
+		for (size_t i = 0; i <= n; ++i) {
+			if (i % 97 == 0 || i % rank_select::BLOCK_BITS < 2)
+				assert(rs.rank1(i) == r && rs.rank0(i) == i - r);
+			if (i < n && fbs[i]) ++r;
+		}
+		for (size_t k = 0; k < ones.size(); k += 1 + k % 13)
+			assert(rs.select1(k) == ones[k]);
+		assert(rs.select1(ones.size() - 1) == ones.back());
+		assert(rs.select1(ones.size()) == n);
+	}
+
+	// In place updates through set().
+	{
+		const size_t flips[] = { 0, 5, rank_select::BLOCK_BITS, rank_select::SUPERBLOCK_BITS + 3, 8500, n - 1 };
+		for (size_t j = 0; j < sizeof(flips) / sizeof(flips[0]); ++j)
+			rs.set(flips[j], !fbs[flips[j]]);
+
+		size_t r = 0;
+		for (size_t i = 0; i <= n; ++i) {
+			if (i % 101 == 0)
+				assert(rs.rank1(i) == r);
+			if (i < n && fbs[i]) ++r;
+		}
+		assert(rs.count() == r && fbs.count() == r);
+		assert(fbs[rs.select1(r - 1)] && rs.rank1(rs.select1(r - 1)) == r - 1);
+	}
+
+	// Writes through operator[] are seen after touch(), resizes on their own.
+	{
+		fbs[2 * rank_select::SUPERBLOCK_BITS] = !fbs[2 * rank_select::SUPERBLOCK_BITS];
+		fbs.touch();
+		assert(rs.count() == fbs.count());
+		fbs.clear();
+		assert(rs.count() == 0 && rs.select1(0) == n);
+		fbs.set_all();
+		assert(rs.rank1(12345) == 12345 && rs.select1(4321) == 4321);
+	}
+
+	return 1;
+}
+
+
+int test_bitwise() {
+
+	printf("\tTest bitwise...\n");
+
+	const size_t n = 1000 + 37;
+	fast_bitstring a(n, fast_bitstring::FROM_BITS), b(n, fast_bitstring::FROM_BITS), c(n, fast_bitstring::FROM_BITS);
+	fill_random(&a[0], n, 1);
+	fill_random(&b[0], n, 2);
+	fill_random(&c[0], n, 3);
+
+	// Any non-zero byte is a 1, and some must be zero for the test to mean much.
+	for (size_t i = 0; i < n; ++i) {
+		if (a[i] & 1) a[i] = 0;
+		if (b[i] & 2) b[i] = 0;
+		if (c[i] % 3 == 0) c[i] = 0;
+	}
+
+	const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+
+	for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+		if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+			continue;
+
+		// Fused out of place.
+		fast_bitstring r = (a & b) | ~c;
+		assert(r.length() == n);
+		for (size_t i = 0; i < n; ++i)
+			assert(r[i] == ((a[i] && b[i]) || !c[i]));
+
+		r = a ^ fbs_expr::and_not(b, c);
+		for (size_t i = 0; i < n; ++i)
+			assert(r[i] == ((a[i] != 0) != (b[i] && !c[i])));
+
+		// In place, reading the destination.
+		fast_bitstring s(a);
+		s &= b | c;
+		for (size_t i = 0; i < n; ++i)
+			assert(s[i] == (a[i] && (b[i] || c[i])));
+		s = ~s;
+		for (size_t i = 0; i < n; ++i)
+			assert(s[i] == !(a[i] && (b[i] || c[i])));
+
+		fast_bitstring t(a);
+		t ^= b;
+		t |= c;
+		for (size_t i = 0; i < n; ++i)
+			assert(t[i] == (((a[i] != 0) != (b[i] != 0)) || c[i]));
+		fast_bitstring v(a);
+		v.and_not(b);
+		for (size_t i = 0; i < n; ++i)
+			assert(v[i] == (a[i] && !b[i]));
+
+		// Ranges.
+		for (size_t offset = 0; offset < 40; offset += 13) {
+			fast_bitstring u(a);
+			u.apply(fast_bitstring::BIT_OR, b, offset, 5, 300);
+			u.invert(500, 77);
+			for (size_t i = 0; i < n; ++i) {
+				bool expected = a[i] != 0;
+				if (i >= offset && i < offset + 300) expected = expected || b[i - offset + 5];
+				if (i >= 500 && i < 577) expected = !expected;
+				assert((u[i] != 0) == expected);
+			}
+		}
+	}
+
+	fast_bitstring::set_simd_level(best);
+
+	// Lengths must agree.
+	{
+		fast_bitstring short_one(n - 1, fast_bitstring::FROM_BITS);
+		bool threw = false;
+		try {
+			fast_bitstring r = a & short_one;
+		} catch (const char *) {
+			threw = true;
+		}
+		assert(threw);
+	}
+
+	return 1;
+}
+
+
+int test_compare() {
+
+	printf("\tTest compare...\n");
+
+	const size_t n = 700 + 13;
+	fast_bitstring a(n, fast_bitstring::FROM_BITS), b(n, fast_bitstring::FROM_BITS);
+	fill_random(&a[0], n, 21);
+
+	// Same bits as a, but with different non-zero byte values.
+	for (size_t i = 0; i < n; ++i) {
+		if (a[i] & 1) a[i] = 0;
+		b[i] = a[i] ? (a[i] | 0x80) : 0;
+	}
+
+	const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+
+	for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+		if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+			continue;
+
+		assert(a.compare(b) == 0 && b.compare(a) == 0);
+		assert(a.first_difference(b) == n);
+		assert(a.hamming_distance(b) == 0);
+		assert(a.equal_range(b, 3, 3, n - 3));
+
+		// Flip single bits anywhere, including in the tails the kernels leave
+		// to the scalar code.
+		for (size_t i = 0; i < n; i += 1 + i / 7) {
+			const fast_bitstring::byte was = b[i];
+			b[i] = !was;
+			assert(a.first_difference(b) == i);
+			assert(a.first_difference(b, i) == i);
+			assert(a.first_difference(b, i + 1) == n);
+			assert(a.compare(b) == (was ? 1 : -1) && b.compare(a) == -a.compare(b));
+			assert(a.hamming_distance(b) == 1);
+			assert(a.hamming_distance(b, i + 1) == 0);
+			assert(!a.equal_range(b, 0, 0, n) && a.equal_range(b, 0, 0, i));
+			b[i] = was;
+		}
+
+		// Hamming distance against a per bit count.
+		fast_bitstring c(n, fast_bitstring::FROM_BITS);
+		fill_random(&c[0], n, 22);
+		for (size_t offset = 0; offset < 100; offset += 33) {
+			for (size_t len = 0; offset + len <= n; len += 1 + len / 2) {
+				size_t expected = 0;
+				for (size_t i = offset; i < offset + len; ++i)
+					expected += !a[i] != !c[i];
+				assert(a.hamming_distance(c, offset, len) == expected);
+			}
+		}
+	}
+
+	fast_bitstring::set_simd_level(best);
+
+	// Ranges at different offsets, and lengths.
+	{
+		fast_bitstring shifted(a, n - 5, 5);
+		assert(a.equal_range(shifted, 5, 0, n - 5));
+		assert(!a.equal_range(shifted, 5, 0, n - 4));
+		assert(shifted.compare(a) == -1 && a.compare(shifted) == 1);
+
+		fast_bitstring prefix(a, 100, 0);
+		assert(a.first_difference(prefix) == 100);
+		assert(a.hamming_distance(prefix) == 0);
+	}
+
+	return 1;
+}
+
+
+static std::vector<size_t> naive_find_all(const fast_bitstring &text, const fast_bitstring &pattern, bool overlapping) {
+
+	std::vector<size_t> found;
+	const size_t n = text.length(), m = pattern.length();
+
+	for (size_t i = 0; m && i + m <= n; ++i) {
+		size_t j = 0;
+		while (j < m && !text[i + j] == !pattern[j]) ++j;
+		if (j == m) {
+			found.push_back(i);
+			if (!overlapping) i += m - 1;
+		}
+	}
+
+	return found;
+}
+
+static int collect_match(size_t position, void *context) {
+	((std::vector<size_t> *)context)->push_back(position);
+	return 0;
+}
+
+int test_search() {
+
+	printf("\tTest search...\n");
+
+	// Mostly zeros with bursts, so short patterns match a lot and long ones a few times.
+	const size_t n = 20000;
+	fast_bitstring text(n, fast_bitstring::FROM_BITS);
+	fill_random(&text[0], n, 31);
+	for (size_t i = 0; i < n; ++i) {
+		if ((i / 300) % 3) text[i] = 0;
+		else if (text[i] & 4) text[i] = 0;
+	}
+
+	const size_t lengths[] = { 1, 3, 8, 31, 32, 33, 64, 65, 100, 300 };
+	const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+
+	for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+		if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+			continue;
+
+		for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+			const size_t m = lengths[l];
+
+			// A pattern cut from the text, and one of all zeros.
+			for (int kind = 0; kind < 2; ++kind) {
+				fast_bitstring pattern(m, fast_bitstring::FROM_BITS);
+				if (kind == 0) {
+					for (size_t j = 0; j < m; ++j)
+						pattern[j] = text[4444 + j] ? 1 : 0;
+				}
+
+				for (int overlapping = 0; overlapping < 2; ++overlapping) {
+					std::vector<size_t> expected = naive_find_all(text, pattern, overlapping);
+					std::vector<size_t> found;
+					assert(text.find_all(pattern, found, overlapping) == expected.size());
+					assert(found == expected);
+					assert(text.count_occurrences(pattern, overlapping) == expected.size());
+				}
+
+				std::vector<size_t> expected = naive_find_all(text, pattern, true);
+				assert(!expected.empty());
+				size_t i = text.find(pattern);
+				for (size_t k = 0; k < expected.size() && k < 50; ++k) {
+					assert(i == expected[k]);
+					i = text.find_next(pattern, i);
+				}
+				if (expected.size() <= 50)
+					assert(i == n);
+				assert(text.find(pattern, expected.back() + 1) == n);
+			}
+		}
+	}
+
+	fast_bitstring::set_simd_level(best);
+
+	// Edge cases.
+	{
+		fast_bitstring empty(0, fast_bitstring::FROM_BITS);
+		fast_bitstring longer(n + 1, fast_bitstring::FROM_BITS);
+		std::vector<size_t> found;
+		assert(text.find(empty) == n && text.count_occurrences(empty) == 0);
+		assert(text.find(longer) == n && text.find_all(longer, found) == 0);
+		assert(text.find(text) == 0 && text.count_occurrences(text) == 1);
+	}
+
+	// Streaming, in chunks of every size from 1 bit up, against find_all().
+	{
+		fast_bitstring pattern(text, 70, 4400);
+		for (int overlapping = 0; overlapping < 2; ++overlapping) {
+			std::vector<size_t> expected;
+			text.find_all(pattern, expected, overlapping);
+			assert(expected.size() > 1);
+
+			for (size_t chunk = 1; chunk < 200; chunk += 1 + chunk / 2) {
+				std::vector<size_t> found;
+				bit_searcher s(pattern, collect_match, &found, overlapping);
+				for (size_t i = 0; i < n; i += chunk)
+					assert(s.search(&text[i], i + chunk > n ? n - i : chunk) == 0);
+				assert(s.length() == n);
+				assert(found == expected);
+			}
+		}
+
+		// Through fast_bitstring::stream(), whose chunks are whole bytes.  Packing
+		// keeps only the low bit of each byte, so normalize the text first.
+		fast_bitstring::byte bytes[n / 8];
+		fast_bitstring normalized = text | text;
+		normalized.to_bytes(bytes);
+		FILE *f = fopen("./foo.out", "wb");
+		assert(fwrite(bytes, 1, sizeof(bytes), f) == sizeof(bytes));
+		fclose(f);
+
+		std::vector<size_t> expected, found;
+		text.find_all(pattern, expected);
+		bit_searcher s(pattern, collect_match, &found);
+		assert(fast_bitstring::stream("./foo.out", bit_searcher::consumer, &s, 100) == 0);
+		assert(found == expected);
+		assert(unlink("./foo.out") == 0);
+	}
+
+	return 1;
+}
+
+
+int test_uint() {
+
+	printf("\tTest uint...\n");
+
+	const size_t n = 1000;
+	fast_bitstring fbs(n, fast_bitstring::FROM_BITS);
+	fill_random(&fbs[0], n, 41);
+	for (size_t i = 0; i < n; ++i)
+		if (fbs[i] & 8) fbs[i] = 0;
+
+	// Single fields against a bit at a time, in both orders.
+	for (size_t width = 1; width <= 64; ++width) {
+		for (size_t offset = 0; offset < 20; offset += 3) {
+			uint64_t msb = 0, lsb = 0;
+			for (size_t j = 0; j < width; ++j) {
+				msb = msb << 1 | (fbs[offset + j] != 0);
+				lsb |= (uint64_t)(fbs[offset + j] != 0) << j;
+			}
+			assert(fbs.get_uint(offset, width) == msb);
+			assert(fbs.get_uint(offset, width, fast_bitstring::LSB_FIRST) == lsb);
+		}
+	}
+	assert(fbs.get_uint(n - 64, 64) == fbs.get_uint(n - 64, 32) << 32 | fbs.get_uint(n - 32, 32));
+
+	// Writes touch only the field and read back; high bits of the value past the width are ignored.
+	{
+		fast_bitstring f(200, fast_bitstring::FROM_BITS);
+		for (size_t width = 1; width <= 64; ++width) {
+			const uint64_t value = 0xDEADBEEFCAFEF00DULL * width;
+			const uint64_t expected = width == 64 ? value : value & (((uint64_t)1 << width) - 1);
+			for (int order = fast_bitstring::MSB_FIRST; order <= fast_bitstring::LSB_FIRST; ++order) {
+				f.set_all(7);
+				f.set_uint(61, width, value, (fast_bitstring::BIT_ORDER)order);
+				assert(f.get_uint(61, width, (fast_bitstring::BIT_ORDER)order) == expected);
+				assert(f[60] == 7 && f[61 + width] == 7);
+				for (size_t j = 0; j < width; ++j)
+					assert(f[61 + j] <= 1);
+			}
+		}
+		f.set_uint(0, 8, 0xA5);
+		assert(f.to_byte(0) == 0xA5);
+		f.set_uint(0, 8, 0xA5, fast_bitstring::LSB_FIRST);
+		assert(f.to_byte(0) == 0xA5 && f[0] == 1 && f[1] == 0 && f[2] == 1);
+	}
+
+	// Bulk fields match single ones at every SIMD level.
+	{
+		const fast_bitstring::SIMD_LEVEL best = fast_bitstring::simd_level();
+		const size_t widths[] = { 1, 5, 8, 13, 31, 32, 33, 63, 64 };
+		uint64_t values[n];
+
+		for (int level = fast_bitstring::SIMD_SCALAR; level <= fast_bitstring::SIMD_AVX512; ++level) {
+			if (fast_bitstring::set_simd_level((fast_bitstring::SIMD_LEVEL)level) != level)
+				continue;
+			for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+				const size_t width = widths[w], offset = 3, count = (n - offset) / width;
+				for (int order = fast_bitstring::MSB_FIRST; order <= fast_bitstring::LSB_FIRST; ++order) {
+					const fast_bitstring::BIT_ORDER o = (fast_bitstring::BIT_ORDER)order;
+					fbs.get_uints(values, offset, width, count, o);
+					for (size_t i = 0; i < count; ++i)
+						assert(values[i] == fbs.get_uint(offset + i * width, width, o));
+
+					fast_bitstring copy(n, fast_bitstring::FROM_BITS);
+					copy.set_uints(offset, width, values, count, o);
+					for (size_t i = 0; i < offset + count * width; ++i)
+						assert(copy[i] == (i < offset ? 0 : fbs[i] != 0));
+				}
+			}
+		}
+		fast_bitstring::set_simd_level(best);
+
+		bool threw = false;
+		try {
+			fbs.get_uints(values, 1, 10, 100);
+		} catch (const char *) {
+			threw = true;
+		}
+		assert(threw);
+	}
+
+	return 1;
+}
+
+
+int test_allocator() {
+
+	printf("\tTest allocator...\n");
+
+	fbs_allocator *policies[] = {
+		fbs_allocator::standard(), fbs_allocator::aligned(), fbs_allocator::huge_pages(),
+		fbs_allocator::thread_arena(), fbs_allocator::automatic()
+	};
+	const size_t sizes[] = { 1, 100, 4096, 70000, 5 << 20 };
+
+	for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+			const size_t n = sizes[s];
+			fast_bitstring fbs(n, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, policies[p]);
+			assert(fbs.get_allocator() == policies[p]);
+			assert(fbs.count() == 0);
+			if (policies[p] != fbs_allocator::standard())
+				assert((size_t)&fbs[0] % fbs_allocator::ALIGNMENT == 0);
+			if (policies[p] == fbs_allocator::huge_pages())
+				assert((size_t)&fbs[0] % (1 << 21) == 0);
+
+			// Contents survive growing and shrinking across size classes.
+			fbs[0] = 1;
+			fbs[n - 1] = 1;
+			fbs.resize(2 * n + 3);
+			assert(fbs[0] == 1 && fbs[n - 1] == 1);
+			fbs.resize(n / 2 + 1);
+			assert(fbs[0] == 1);
+
+			// Copies share the policy.
+			fast_bitstring copy(fbs);
+			assert(copy.get_allocator() == policies[p] && copy.compare(fbs) == 0);
+
+			fast_bitstring unfilled(n, fast_bitstring::FROM_BITS, fast_bitstring::NO_FILL, policies[p]);
+			unfilled.set_all();
+			assert(unfilled.count() == n);
+		}
+	}
+
+	// The arena hands back the block just released for the same size class.
+	{
+		fbs_allocator *arena = fbs_allocator::thread_arena();
+		void *a = arena->allocate(1000);
+		arena->release(a, 1000);
+		void *b = arena->allocate(1024);
+		assert(a == b);
+		arena->release(b, 1024);
+	}
+
+	// Sizes whose rounding would wrap are refused, not mapped short.
+	{
+		bool threw = false;
+		try { fbs_allocator::huge_pages()->allocate(~(size_t)0 - 5); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Bitstrings may be freed on another thread than the one that made them,
+	// including after that thread has exited.
+	{
+		fast_bitstring *made = NULL;
+		std::thread t([&] {
+			made = new fast_bitstring(300, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, fbs_allocator::thread_arena());
+			fast_bitstring scratch(200, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, fbs_allocator::thread_arena());
+		});
+		t.join();
+		assert(made->count() == 0);
+		delete made;
+	}
+
+	// A thread that only frees still empties its pool when it exits, see
+	// the leak check of an ASan build.
+	{
+		std::vector<fast_bitstring *> made;
+		for (int i = 0; i < 20; ++i)
+			made.push_back(new fast_bitstring(1000, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, fbs_allocator::thread_arena()));
+		std::thread t([&] {
+			for (size_t i = 0; i < made.size(); ++i)
+				delete made[i];
+		});
+		t.join();
+	}
+
+	// The default policy applies when none is given.
+	{
+		fbs_allocator::set_default(fbs_allocator::standard());
+		fast_bitstring fbs(10);
+		assert(fbs.get_allocator() == fbs_allocator::standard());
+		fbs_allocator::set_default(NULL);
+		assert(fbs_allocator::get_default() == fbs_allocator::automatic());
+	}
+
+	return 1;
+}
+
+
+int test_view() {
+
+	printf("\tTest view...\n");
+
+	const size_t n = 5000;
+	fast_bitstring::byte bytes[n / 8];
+	fill_random(bytes, sizeof(bytes), 17);
+	fast_bitstring a(bytes, sizeof(bytes));
+
+	// Copies are deep, including from a const bitstring and by assignment.
+	{
+		const fast_bitstring &c = a;
+		fast_bitstring b(c);
+		assert(&b[0] != &a[0] && b.compare(a) == 0);
+
+		fast_bitstring d(10);
+		d = c;
+		assert(&d[0] != &a[0] && d.compare(a) == 0);
+		d[0] ^= 1;
+		assert(d.compare(a) != 0 && b.compare(a) == 0);
+	}
+
+	// Moves take the bits over and leave the source empty.
+	{
+		fast_bitstring b(a);
+		const fast_bitstring::byte *bits = &b[0];
+		fast_bitstring m(std::move(b));
+		assert(&m[0] == bits && b.length() == 0 && m.compare(a) == 0);
+
+		fast_bitstring k(3);
+		k = std::move(m);
+		assert(&k[0] == bits && m.length() == 0 && k.compare(a) == 0);
+
+		std::vector<fast_bitstring> v;
+		for (size_t i = 0; i < 20; ++i)
+			v.push_back(fast_bitstring(a, 100, i));
+		for (size_t i = 0; i < 20; ++i)
+			assert(v[i].equal_range(a, 0, i, 100));
+	}
+
+	// Slices share the bits and answer as a copy of the range would.
+	fast_bitstring_view whole = a;
+	assert(whole.data() == &a[0] && whole.length() == n);
+
+	for (size_t offset = 0; offset < n; offset += 777) {
+		const size_t len = n - offset < 1000 ? n - offset : 1000;
+		fast_bitstring_view s = a.slice(offset, len);
+		fast_bitstring copy(a, len, offset);
+
+		assert(s.data() == &a[offset] && s.length() == len);
+		assert(s.compare(copy) == 0 && copy.compare(s) == 0);
+		assert(s.count() == copy.count());
+		assert(s.hamming_distance(copy) == 0);
+		assert(s.to_byte(3) == copy.to_byte(3));
+		if (len >= 64) assert(s.get_uint(0, 64) == copy.get_uint(0, 64));
+
+		fast_bitstring::byte p1[128], p2[128];
+		assert(s.to_bytes(p1) == copy.to_bytes(p2) && memcmp(p1, p2, (len + 7) / 8) == 0);
+
+		fast_bitstring::byte *e1, *e2;
+		const size_t n1 = s.run_length_encode(&e1), n2 = copy.run_length_encode(&e2);
+		assert(n1 == n2 && memcmp(e1, e2, n1) == 0);
+		free(e1);
+		free(e2);
+
+		fast_bitstring_view pattern = s.slice(len / 2, 12);
+		assert(a.find(pattern, offset) <= offset + len / 2);
+		assert(s.find(pattern) == copy.find(pattern));
+		assert(s.count_occurrences(pattern) == copy.count_occurrences(pattern));
+
+		fast_bitstring r = s & copy;
+		fast_bitstring o = copy | s;
+		assert(r.compare(o) == 0 && r.compare(copy) == 0);
+	}
+
+	// Slices clip to the bits there are.
+	assert(a.slice(n - 10, 100).length() == 10);
+	assert(a.slice(n + 10).length() == 0);
+	assert(whole.slice(100, 50).slice(10, 5).data() == &a[110]);
+
+	// Assigning a view of itself.
+	{
+		fast_bitstring b(a);
+		b = b.slice(8, 16);
+		assert(b.length() == 16 && b.equal_range(a, 0, 8, 16));
+	}
+
+	return 1;
+}
+
+
+int test_append() {
+
+	printf("\tTest append...\n");
+
+	const size_t n = 10000;
+	fast_bitstring::byte bytes[n / 8];
+	fill_random(bytes, sizeof(bytes), 23);
+	fast_bitstring ref(bytes, sizeof(bytes));
+
+	fbs_allocator *policies[] = { fbs_allocator::standard(), fbs_allocator::thread_arena(), fbs_allocator::automatic() };
+
+	for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+
+		// Bit at a time, with few reallocations.
+		fast_bitstring b(0, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, policies[p]);
+		size_t moves = 0;
+		const fast_bitstring::byte *last = NULL;
+		for (size_t i = 0; i < n; ++i) {
+			b.push_back(ref[i]);
+			if (&b[0] != last) ++moves;
+			last = &b[0];
+		}
+		assert(b.length() == n && b.capacity() >= n && b.compare(ref) == 0);
+		assert(moves < 20);
+
+		// Packed input, from any bit offset, matches exploding it up front.
+		fast_bitstring c(0, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, policies[p]);
+		for (size_t off = 0, len = 1; off + len <= n; off += len, len = len * 3 % 97 + 1)
+			assert(c.append_packed(bytes, off, len) == len);
+		assert(c.equal_range(ref, 0, 0, c.length()));
+
+		// Runs and ranges of other bitstrings.
+		fast_bitstring d(0, fast_bitstring::FROM_BITS, fast_bitstring::ZERO_FILL, policies[p]);
+		assert(d.append_run(1, 300) == 300 && d.append_run(0, 5) == 5);
+		assert(d.count() == 300 && d.length() == 305 && d[304] == 0);
+		assert(d.append(ref, 100, 1000) == 1000);
+		assert(d.equal_range(ref, 305, 100, 1000));
+		assert(d.append(ref, n - 10) == 10);
+		assert(d.length() == 1315 && d.equal_range(ref, 1305, n - 10, 10));
+
+		// Appending a view of itself survives the bits moving.
+		d.shrink_to_fit();
+		assert(d.capacity() == d.length());
+		assert(d.append(d.slice(305, 1000)) == 1000);
+		assert(d.equal_range(ref, 1315, 100, 1000));
+	}
+
+	// Writing at an offset overwrites, then extends.
+	{
+		fast_bitstring e(ref, 100);
+		assert(e.append(90, ref.slice(500, 20)) == 20);
+		assert(e.length() == 110 && e.equal_range(ref, 0, 0, 90) && e.equal_range(ref, 90, 500, 20));
+		assert(e.append(10, ref, 5) == 5 && e.length() == 110);
+
+		bool threw = false;
+		try { e.append(111, ref); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Capacity is kept across shrinking and reserved up front.
+	{
+		fast_bitstring f(1000, fast_bitstring::FROM_BITS);
+		f.resize(10);
+		assert(f.length() == 10 && f.capacity() == 1000);
+		f.resize(900);
+		assert(f.capacity() == 1000);
+		f.reserve(5000);
+		const fast_bitstring::byte *bits = &f[0];
+		f.append_run(1, 4000);
+		assert(&f[0] == bits && f.length() == 4900 && f.capacity() == 5000);
+		f.resize(1001);
+		f.shrink_to_fit();
+		assert(f.capacity() == 1001);
+	}
+
+	return 1;
+}
+
+
+int test_cursor() {
+
+	printf("\tTest cursor...\n");
+
+	const size_t n = 20000;
+	fast_bitstring::byte bytes[n / 8];
+	fill_random(bytes, sizeof(bytes), 29);
+	fast_bitstring ref(bytes, sizeof(bytes));
+
+	// Fields of every width from every kind of source agree with get_uint().
+	for (size_t offset = 0; offset < 13; offset += 3) {
+		bit_reader packed(bytes, n - offset, offset);
+		bit_reader exploded(ref.slice(offset));
+		size_t at = offset;
+
+		for (unsigned int w = 0; at + w <= n; w = (w + 7) % 65) {
+			const uint64_t want = w ? ref.get_uint(at, w) : 0;
+			if (w && w <= bit_reader::MAX_PEEK) assert(packed.peek(w) == want);
+			assert(packed.read(w) == want && exploded.read(w) == want);
+			at += w;
+			assert(packed.position() == at - offset && exploded.remaining() == n - at);
+		}
+		packed.skip(packed.remaining());
+		assert(packed.at_end());
+
+		bool threw = false;
+		try { packed.read(1); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Skips across and within the buffer.
+	{
+		bit_reader r(bytes, n);
+		r.read(5);
+		r.skip(3);
+		assert(r.read(8) == ref.get_uint(8, 8));
+		r.skip(1000);
+		assert(r.position() == 1016 && r.read(17) == ref.get_uint(1016, 17));
+	}
+
+	// Codes written packed and onto a bitstring read back the same.
+	{
+		bit_writer packed;
+		fast_bitstring exploded(0, fast_bitstring::FROM_BITS);
+		bit_writer onto(exploded);
+		size_t n_bits = 0;
+
+		for (uint64_t i = 0; i < 3000; ++i) {
+			const uint64_t v = i * i * 7919 % 100003;
+			packed.write(v, 17);
+			packed.write_exp_golomb(v);
+			packed.write_exp_golomb(i, 3);
+			packed.write_signed_exp_golomb((int64_t)v - 50000);
+			packed.write_unary(i % 70);
+			packed.write_bit(i & 1);
+			onto.write(v, 17);
+			onto.write_exp_golomb(v);
+			onto.write_exp_golomb(i, 3);
+			onto.write_signed_exp_golomb((int64_t)v - 50000);
+			onto.write_unary(i % 70);
+			onto.write_bit(i & 1);
+		}
+		packed.write(~(uint64_t)0, 64);
+		onto.write(~(uint64_t)0, 64);
+		n_bits = packed.length();
+		onto.flush();
+		assert(onto.length() == n_bits && exploded.length() == n_bits);
+		assert(packed.n_bytes() == (n_bits + 7) / 8);
+
+		bit_reader from_packed(packed.bytes(), n_bits);
+		bit_reader from_exploded(exploded);
+		bit_reader *readers[] = { &from_packed, &from_exploded };
+		for (size_t k = 0; k < 2; ++k) {
+			bit_reader &r = *readers[k];
+			for (uint64_t i = 0; i < 3000; ++i) {
+				const uint64_t v = i * i * 7919 % 100003;
+				assert(r.read(17) == v);
+				assert(r.read_exp_golomb() == v);
+				assert(r.read_exp_golomb(3) == i);
+				assert(r.read_signed_exp_golomb() == (int64_t)v - 50000);
+				assert(r.read_unary() == i % 70);
+				assert(r.read_bit() == (i & 1));
+			}
+			assert(r.read(64) == ~(uint64_t)0 && r.at_end());
+		}
+
+		// Small Exp-Golomb codes are the textbook ones.
+		bit_writer eg;
+		eg.write_exp_golomb(0);
+		eg.write_exp_golomb(1);
+		eg.write_exp_golomb(4);
+		assert(eg.length() == 1 + 3 + 5);
+		assert(eg.bytes()[0] == 0xA2 && eg.bytes()[1] == 0x80);	// 1 010 00101
+
+		// Writing on after bytes() replaces the partial last byte.
+		eg.write(1, 1);
+		assert(eg.n_bytes() == 2 && eg.bytes()[1] == 0xC0);
+
+		// The signed extremes: INT64_MAX has a code, INT64_MIN has none.
+		bit_writer se;
+		se.write_signed_exp_golomb(INT64_MAX);
+		se.write_signed_exp_golomb(INT64_MIN + 1);
+		bool threw = false;
+		try { se.write_signed_exp_golomb(INT64_MIN); } catch (const char *) { threw = true; }
+		assert(threw);
+		bit_reader sr(se.bytes(), se.length());
+		assert(sr.read_signed_exp_golomb() == INT64_MAX);
+		assert(sr.read_signed_exp_golomb() == INT64_MIN + 1);
+		assert(sr.at_end());
+	}
+
+	return 1;
+}
+
+
+int test_stats() {
+
+	printf("\tTest stats...\n");
+
+	// 20 0's, 1010 left verbatim, then 31 1's.
+	fast_bitstring fbs(55, fast_bitstring::FROM_BITS);
+	for (size_t i = 20; i < 55; ++i)
+		fbs[i] = i < 24 ? (i + 1) % 2 : 1;
+
+	fbs_stats::reset();
+
+	fast_bitstring::byte *rle = NULL;
+	const size_t n_rle = fbs.run_length_encode(&rle);
+	assert(n_rle == 5);
+
+	fast_bitstring decoded(55, fast_bitstring::FROM_BITS);
+	assert(fast_bitstring::run_length_decode_into(rle, n_rle, decoded) == 55);
+	assert(decoded.compare(fbs) == 0);
+	free(rle);
+
+	fbs_stats::counters c = fbs_stats::collect();
+	assert(c.rle_encode_calls == 1 && c.rle_encode_bits == 55 && c.rle_encode_bytes == 5);
+	assert(c.rle_decode_calls == 1 && c.rle_decode_bits == 55 && c.rle_decode_bytes == 5);
+	assert(c.rle_runs == 2 && c.rle_run_bits == 51);
+	assert(c.run_length[20] == 1 && c.run_length[31] == 1);
+	assert(c.rle_verbatim_blocks == 1 && c.rle_verbatim_bits == 4);
+	assert(fbs_stats::verbatim_ratio(c) == 4.0 / 55);
+	assert(c.pack_calls == 1 && c.pack_bits == 4);
+	assert(c.explode_calls == 1 && c.explode_bits == 4);
+	assert(c.allocations == 1 && c.allocated_bytes == 55);
+
+	// Storage.
+	fbs_stats::reset();
+	{
+		fast_bitstring grown(10, fast_bitstring::FROM_BITS);
+		grown.reserve(1000);
+		grown.shrink_to_fit();
+	}
+	c = fbs_stats::collect();
+	assert(c.allocations == 1 && c.allocated_bytes == 10);
+	assert(c.reallocations == 2 && c.releases == 1);
+
+	// Counts made on a thread that has since exited are kept.
+	fbs_stats::reset();
+	const fbs_stats::counters before = fbs_stats::collect_local();
+	std::thread t([] {
+		fast_bitstring::byte bytes[16] = {0};
+		fast_bitstring exploded(bytes, sizeof(bytes));
+		assert(fbs_stats::collect_local().explode_bits == 128);
+	});
+	t.join();
+	c = fbs_stats::collect();
+	assert(c.explode_calls == 1 && c.explode_bits == 128);
+	assert(fbs_stats::collect_local().explode_bits == before.explode_bits);
+
+	// Counters never go back, so a reset starts from nothing.
+	fbs_stats::reset();
+	c = fbs_stats::collect();
+	assert(c.explode_calls == 0 && c.rle_encode_calls == 0 && c.allocations == 0);
+
+	return 1;
+}
+
+
+int test_codec() {
+
+	printf("\tTest codec...\n");
+
+	typedef fast_bitstring::byte byte;
+	const size_t n = 100003;
+	const size_t block_bits = 1 << 14;
+
+	// Random, 1 in 1000 set, runs averaging 2000 bits, all 1's and empty.
+	std::vector<byte> packed(n / 8 + 1);
+	fill_random(&packed[0], packed.size(), 7);
+	fast_bitstring random(&packed[0], 0, n);
+
+	fast_bitstring sparse(n, fast_bitstring::FROM_BITS);
+	for (size_t i = 13; i < n; i += 997)
+		sparse[i] = 1;
+
+	fast_bitstring runs(n, fast_bitstring::FROM_BITS);
+	for (size_t i = 0; i < n; ++i)
+		runs[i] = (i / 2000 + i / 3331) & 1;
+
+	fast_bitstring ones(n, fast_bitstring::FROM_BITS);
+	ones.set_all();
+
+	fast_bitstring empty(0, fast_bitstring::FROM_BITS);
+
+	const fast_bitstring *inputs[] = { &random, &sparse, &runs, &ones, &empty };
+
+	for (size_t k = 0; k < sizeof(inputs) / sizeof(inputs[0]); ++k) {
+		const fast_bitstring &in = *inputs[k];
+		const size_t raw = (in.length() + 7) / 8;
+
+		for (int c = 0; c <= fbs_codec::N_CODECS; ++c) {
+			byte *encoding = NULL;
+			const size_t num_bytes = c < fbs_codec::N_CODECS
+				? fbs_codec::encode_with(in, &encoding, (fbs_codec::CODEC)c, block_bits)
+				: fbs_codec::encode(in, &encoding, fbs_codec::SMALLEST, block_bits);
+
+			// Never more than RAW plus headers.
+			assert(num_bytes <= raw + 8 + 4 * (in.length() / block_bits + 1));
+			assert(encoding[0] == fbs_codec::MAGIC && encoding[1] == fbs_codec::VERSION);
+			assert(fbs_codec::decoded_length(encoding, num_bytes) == in.length());
+
+			fast_bitstring *out = fbs_codec::decode(encoding, num_bytes);
+			assert(out->compare(in) == 0);
+			delete out;
+
+			// Truncations are caught.
+			bool threw = false;
+			if (num_bytes > 2) {
+				try { delete fbs_codec::decode(encoding, num_bytes - 1); } catch (const char *) { threw = true; }
+				assert(threw);
+			}
+
+			free(encoding);
+		}
+	}
+
+	// Each codec is chosen where it fits best.
+	assert(fbs_codec::choose(random.data(), block_bits) == fbs_codec::RAW);
+	assert(fbs_codec::choose(sparse.data(), block_bits) == fbs_codec::SPARSE);
+	assert(fbs_codec::choose(runs.data(), block_bits) == fbs_codec::RLE);
+	assert(fbs_codec::choose(random.data(), block_bits, fbs_codec::FASTEST) == fbs_codec::RAW);
+
+	{
+		byte *encoding = NULL;
+		const size_t num_bytes = fbs_codec::encode(runs, &encoding, fbs_codec::SMALLEST, block_bits);
+		std::vector<fbs_codec::CODEC> codecs = fbs_codec::block_codecs(encoding, num_bytes);
+		assert(codecs.size() == n / block_bits + 1);
+		for (size_t i = 0; i < codecs.size(); ++i)
+			assert(codecs[i] == fbs_codec::RLE);
+		free(encoding);
+	}
+
+	// Long runs cost a few bytes each rather than one per 127 bits.
+	{
+		fast_bitstring zeros(1 << 24, fast_bitstring::FROM_BITS);
+		zeros[1 << 23] = 1;
+
+		byte *rle = NULL, *encoding = NULL;
+		const size_t rle_bytes = zeros.run_length_encode(&rle);
+		const size_t num_bytes = fbs_codec::encode_with(zeros, &encoding, fbs_codec::RLE);
+		assert(rle_bytes > (1 << 24) / 127);
+		assert(num_bytes < 128);
+
+		fast_bitstring *out = fbs_codec::decode(encoding, num_bytes);
+		assert(out->compare(zeros) == 0);
+		delete out;
+
+		free(rle);
+		free(encoding);
+	}
+
+	// Any non-zero byte is a 1: sparse 2's and a long run of 3's.
+	{
+		fast_bitstring odd(20000, fast_bitstring::FROM_BITS), canonical(20000, fast_bitstring::FROM_BITS);
+		for (size_t i = 0; i < odd.length(); i += 900)
+			odd[i] = 2, canonical[i] = 1;
+		for (size_t i = 10000; i < 10500; ++i)
+			odd[i] = 3, canonical[i] = 1;
+
+		for (int c = 0; c <= fbs_codec::N_CODECS; ++c) {
+			byte *encoding = NULL;
+			const size_t num_bytes = c < fbs_codec::N_CODECS
+				? fbs_codec::encode_with(odd, &encoding, (fbs_codec::CODEC)c, block_bits)
+				: fbs_codec::encode(odd, &encoding, fbs_codec::SMALLEST, block_bits);
+
+			fast_bitstring *out = fbs_codec::decode(encoding, num_bytes);
+			assert(out->compare(canonical) == 0);
+			delete out;
+			free(encoding);
+		}
+	}
+
+	// Headers claiming more bits than can be had, or more blocks than are
+	// there, throw rather than allocate.
+	{
+		const byte huge[] = {
+			fbs_codec::MAGIC, fbs_codec::VERSION,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01,	// 2^64 - 1 bits
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01,	// in one block,
+			fbs_codec::RLE, 6, 0, 0x80, 0x80, 0x80, 0x80, 0x08		// a run of 2^30.
+		};
+		bool threw = false;
+		try { delete fbs_codec::decode(huge, sizeof(huge)); } catch (const char *) { threw = true; }
+		assert(threw);
+
+		const byte many[] = { fbs_codec::MAGIC, fbs_codec::VERSION, 0x80, 0x80, 0x80, 0x80, 0x10, 1, fbs_codec::RAW, 0 };
+		threw = false;
+		try { delete fbs_codec::decode(many, sizeof(many)); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Foreign and future encodings are refused.
+	{
+		byte bad[] = { fbs_codec::MAGIC, fbs_codec::VERSION + 1, 0, 1 };
+		bool threw = false;
+		try { fbs_codec::decoded_length(bad, sizeof(bad)); } catch (const char *) { threw = true; }
+		assert(threw);
+
+		bad[0] = 0;
+		bad[1] = fbs_codec::VERSION;
+		threw = false;
+		try { fbs_codec::decoded_length(bad, sizeof(bad)); } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	return 1;
+}
+
+
+// Every read of a hybrid bitstring agrees with the fast_bitstring it mirrors.
+static void check_hybrid(const hybrid_fast_bitstring &h, const fast_bitstring &f) {
+
+	assert(h.length() == f.length());
+	assert(h.count() == f.count());
+
+	fast_bitstring *back = h.to_fast_bitstring();
+	assert(back->compare(f) == 0);
+	delete back;
+
+	for (size_t i = 0; i < f.length(); i += 4099)
+		assert(h[i] == f[i]);
+
+	for (size_t offset = 0; offset < f.length(); offset += 50001) {
+		assert(h.count(offset, 70000) == f.count(offset, 70000));
+		size_t next = offset;
+		while (next < f.length() && !f[next]) ++next;
+		assert(h.next_set(offset) == next);
+	}
+}
+
+int test_hybrid() {
+
+	printf("\tTest hybrid...\n");
+
+	typedef fast_bitstring::byte byte;
+	const size_t C = hybrid_fast_bitstring::CHUNK_BITS;
+	const size_t n = 6 * C + 1000;
+
+	// Chunk by chunk: sparse, runs, random, empty, all 1's, then a short one.
+	std::vector<byte> packed(C / 8);
+	fill_random(&packed[0], packed.size(), 17);
+	fast_bitstring random(&packed[0], 0, C);
+
+	fast_bitstring f(n, fast_bitstring::FROM_BITS);
+	for (size_t i = 0; i < C; i += 97)
+		f[i] = 1;
+	for (size_t i = C; i < 2 * C; ++i)
+		f[i] = (i / 300) & 1;
+	f.append(2 * C, random);
+	memset(&f[4 * C], 1, C);
+	f[5 * C + 3] = 1;
+	f[n - 1] = 1;
+	f.touch();
+
+	hybrid_fast_bitstring h(f);
+	assert(h.n_chunks() == 7);
+	assert(h.container(0) == hybrid_fast_bitstring::ARRAY);
+	assert(h.container(1) == hybrid_fast_bitstring::RUNS);
+	assert(h.container(2) == hybrid_fast_bitstring::DENSE);
+	assert(h.container(3) == hybrid_fast_bitstring::EMPTY);
+	assert(h.container(4) == hybrid_fast_bitstring::RUNS);
+	assert(h.container(5) == hybrid_fast_bitstring::ARRAY);
+	assert(h.container(6) == hybrid_fast_bitstring::ARRAY);
+	check_hybrid(h, f);
+
+	// Packed forms and fields.
+	{
+		std::vector<byte> a(f.to_bytes(NULL)), b(f.to_bytes(NULL));
+		assert(h.to_bytes(&a[0]) == f.to_bytes(&b[0]) && a == b);
+		assert(h.to_bytes(&a[0], 13, 100000) == f.to_bytes(&b[0], 13, 100000));
+		assert(memcmp(&a[0], &b[0], f.to_bytes(NULL, 13, 100000)) == 0);
+
+		for (size_t i = 0; i + 64 <= n; i += 9999)
+			assert(h.get_uint(i, 64) == f.get_uint(i, 64) && h.get_uint(i, 7, fast_bitstring::LSB_FIRST) == f.get_uint(i, 7, fast_bitstring::LSB_FIRST));
+
+		byte *e1 = NULL, *e2 = NULL;
+		const size_t n1 = f.run_length_encode(&e1);
+		const size_t n2 = h.run_length_encode(&e2);
+		assert(n1 == n2 && memcmp(e1, e2, n1) == 0);
+		free(e1);
+		free(e2);
+	}
+
+	// Single bits, crossing every conversion threshold.
+	{
+		hybrid_fast_bitstring g(h);
+		fast_bitstring r(f);
+		unsigned int seed = 3;
+
+		for (size_t k = 0; k < 12000; ++k) {
+			seed = seed * 1103515245 + 12345;
+			const size_t i = (seed >> 8) % (2 * C) + 3 * C;		// Empty then all 1's.
+			const byte bit = k < 9000 ? i < 4 * C : i >= 4 * C;	// Fill both in, then clear.
+			g.set(i, bit);
+			r[i] = bit;
+		}
+		r.touch();
+		check_hybrid(g, r);
+
+		// The empty chunk grew dense, the runs broke up.
+		assert(g.container(3) == hybrid_fast_bitstring::DENSE);
+		assert(g.container(4) != hybrid_fast_bitstring::RUNS);
+
+		for (size_t i = 3 * C; i < 4 * C; ++i) {
+			g.set(i, 0);
+			r[i] = 0;
+		}
+		r.touch();
+		assert(g.container(3) == hybrid_fast_bitstring::EMPTY);
+		check_hybrid(g, r);
+
+		// Runs extend, merge and split.
+		hybrid_fast_bitstring runs(C, fast_bitstring::FROM_BITS);
+		fast_bitstring rr(C, fast_bitstring::FROM_BITS);
+		for (size_t i = 100; i < 2000; ++i) rr[i] = 1;
+		for (size_t i = 2010; i < 3000; ++i) rr[i] = 1;
+		rr.touch();
+		runs.assign(0, rr);
+		assert(runs.container(0) == hybrid_fast_bitstring::RUNS);
+		const size_t flips[] = { 2005, 2000, 2001, 2002, 2003, 2004, 2006, 2007, 2008, 2009, 99, 1500, 3000 };
+		for (size_t k = 0; k < sizeof(flips) / sizeof(flips[0]); ++k) {
+			runs.set(flips[k], !rr[flips[k]]);
+			rr[flips[k]] = !rr[flips[k]];
+			assert(runs.container(0) == hybrid_fast_bitstring::RUNS);
+		}
+		rr.touch();
+		check_hybrid(runs, rr);
+	}
+
+	// Set operations against the exploded ones.
+	{
+		fast_bitstring f2(f);
+		f2.reverse();
+		hybrid_fast_bitstring h2(f2);
+
+		hybrid_fast_bitstring a(h), o(h), x(h), d(h);
+		a &= h2;
+		o |= h2;
+		x ^= h2;
+		d.and_not(h2);
+
+		fast_bitstring fa(f), fo(f), fx(f), fd(f);
+		fa &= f2;
+		fo |= f2;
+		fx ^= f2;
+		fd.and_not(f2);
+
+		check_hybrid(a, fa);
+		check_hybrid(o, fo);
+		check_hybrid(x, fx);
+		check_hybrid(d, fd);
+
+		assert(h.hamming_distance(h2) == f.hamming_distance(f2));
+		assert(h.compare(h2) == f.compare(f2) && h2.compare(h) == f2.compare(f) && h.compare(h) == 0);
+
+		x ^= x;
+		assert(x.count() == 0 && x.storage() == 0);
+
+		bool threw = false;
+		hybrid_fast_bitstring shorter(n - 1, fast_bitstring::FROM_BITS);
+		try { a &= shorter; } catch (const char *) { threw = true; }
+		assert(threw);
+	}
+
+	// Write back an exploded region, and re-optimize.
+	{
+		hybrid_fast_bitstring g(h);
+		fast_bitstring *hot = g.to_fast_bitstring(C / 2, 3 * C);
+		hot->set_all();
+		g.assign(C / 2, *hot);
+		delete hot;
+
+		fast_bitstring r(f);
+		memset(&r[C / 2], 1, 3 * C);
+		r.touch();
+		check_hybrid(g, r);
+
+		g.optimize();
+		assert(g.container(2) == hybrid_fast_bitstring::RUNS);
+		check_hybrid(g, r);
+	}
+
+	// A 99.9% empty bitmap costs a fraction of a bit per bit.
+	{
+		hybrid_fast_bitstring sparse(64 * C, fast_bitstring::FROM_BITS);
+		for (size_t i = 0; i < sparse.length(); i += 1000)
+			sparse.set(i);
+		assert(sparse.count() == (sparse.length() + 999) / 1000);
+		assert(sparse.storage() < sparse.length() / 40);
+	}
+
+	return 1;
+}
+
+
+// Check static_fast_bitstring<N> against fast_bitstring at every offset
+// into bytes.
+template <size_t N>
+static void check_static(const fast_bitstring::byte *bytes) {
+
+	const static_fast_bitstring<N> zero;
+	fast_bitstring::byte packed[N / 8 + 2], expected[N / 8 + 2];
+
+	for (size_t offset = 0; offset < 10; ++offset) {
+		const static_fast_bitstring<N> s(bytes, offset);
+		const fast_bitstring f(bytes, offset, N);
+
+		assert(s.view().compare(f) == 0);
+		assert(s.count() == f.count());
+
+		memset(packed, 0xAA, sizeof(packed));
+		memset(expected, 0xAA, sizeof(expected));
+		assert(s.pack(packed) == f.to_bytes(expected));
+		assert(memcmp(packed, expected, sizeof(packed)) == 0);
+
+		// Back from a view, and into a fast_bitstring.
+		const static_fast_bitstring<N> t(f);
+		assert(t == s);
+		const fast_bitstring g(s);
+		assert(g.compare(f) == 0);
+
+		const static_fast_bitstring<N> u(bytes, offset + 1);
+		const fast_bitstring v(bytes, offset + 1, N);
+		assert(s.hamming_distance(u) == f.hamming_distance(v));
+		assert(s.compare(u) == f.compare(v));
+		assert(s.first_difference(u) == f.first_difference(v));
+		assert((s == u) == (f.compare(v) == 0));
+		assert(s.compare(zero) == (s.count() ? 1 : 0));
+	}
+
+	static_fast_bitstring<N> s;
+	for (size_t i = 0; i < N; i += 3)
+		s.set(i, 2);
+	assert(s.count() == (N + 2) / 3);
+	assert(s[0] == 1 && (N < 2 || s[1] == 0));
+}
+
+int test_static() {
+
+	printf("\tTest static...\n");
+
+	// Built at compile time.
+	static constexpr fast_bitstring::byte magic_bytes[] = { 0xFB, 0x01, 0xC0 };
+	constexpr static_fast_bitstring<18> magic(magic_bytes);
+	constexpr static_fast_bitstring<12> tag = static_fast_bitstring<12>::from_uint(0xABC);
+	constexpr static_fast_bitstring<12> tag2(magic_bytes, 4);
+
+	static_assert(magic.count() == 10, "static count");
+	static_assert(tag.count() == 7 && tag[0] == 1 && tag[1] == 0 && tag[11] == 0, "static from_uint");
+	static_assert(tag2 == static_fast_bitstring<12>::from_uint(0xB01), "static explode");
+	static_assert(tag.compare(tag2) == -1 && tag2.hamming_distance(tag) == 7, "static compare");
+	static_assert(sizeof(magic) == 18, "static storage");
+
+	fast_bitstring::byte bytes[80];
+	fill_random(bytes, sizeof(bytes), 17);
+
+	check_static<1>(bytes);
+	check_static<7>(bytes);
+	check_static<8>(bytes);
+	check_static<13>(bytes);
+	check_static<64>(bytes);
+	check_static<100>(bytes);
+	check_static<256>(bytes);
+	check_static<512>(bytes);
+
+	return 1;
+}
+
 int unit_test() {
 
 	printf("Running unit tests...\n");
 
 	assert(test_create());
+	assert(test_explode());
 	assert(test_bits());
 	assert(test_save());
 	assert(test_to_ascii());
-        // TODO: more comprehensive test_to_byte?
 	assert(test_to_byte());
 	assert(test_to_bytes());
+	assert(test_pack());
 	assert(test_rle());
+	assert(test_rle_decode());
+	assert(test_rle_stream());
+	assert(test_rle_parallel());
+	assert(test_explode_parallel());
+	assert(test_rle_index());
+	assert(test_packed());
 	assert(test_reverse());
+	assert(test_lazy());
+	assert(test_stream());
+	assert(test_rank_select());
+	assert(test_bitwise());
+	assert(test_compare());
+	assert(test_search());
+	assert(test_uint());
+	assert(test_allocator());
+	assert(test_view());
+	assert(test_append());
+	assert(test_cursor());
+	assert(test_stats());
+	assert(test_codec());
+	assert(test_hybrid());
+	assert(test_static());
 
 	return 0;
 }